@@ -16,11 +16,11 @@
 
 #include "authentication.h"
 #include "base64.h"
+#include "jwt.h"
 #include "logging.h"
 #include "requests.h"
 
 #include <array>
-#include <ctime>
 #include <fstream>
 #include <iostream>
 #include <random>
@@ -50,7 +50,9 @@ std::string random_string(int n)
 }
 }
 
-std::string eo::make_authorize_request(std::list<std::string> scopes)
+std::string eo::make_oauth_state() { return random_string(24); }
+
+std::string eo::make_authorize_request(std::list<std::string> scopes, const std::string &state)
 {
 
     std::ostringstream out;
@@ -85,7 +87,7 @@ std::string eo::make_authorize_request(std::list<std::string> scopes)
     out << "&code_challenge=" << base64_safe(base64_encode(sha_output.data(), 32));
     out << "&code_challenge_method=S256";
 
-    out << "&state=somethingunique";
+    out << "&state=" << urlencode(state);
 
     const auto url = out.str();
     log::info("Making authorization request to: {0}", url);
@@ -94,37 +96,28 @@ std::string eo::make_authorize_request(std::list<std::string> scopes)
     return code_challenge;
 }
 
-std::string eo::handle_redirect()
+std::optional<eo::AuthenticationCode> eo::parse_redirect(const HttpRequest &request, const std::string &state)
 {
-    HttpResponse response;
-    response.body                               = "<html><body>You can close this now.</body></html>";
-    response.headers[http::field::content_type] = "text/html";
-
-    const auto request = expectHttpRequest(response);
-
-    const auto &   target   = std::string{ request.target };
-    constexpr auto code_str = std::string_view("code=");
-
-    const auto code_pos = target.find(code_str);
-    if (code_pos == target.npos) {
-        // TODO error
-        log::error("Redirect did not contain a code parameter");
-        return "error";
+    const auto &target = request.target;
+    if (target.rfind(redirect_path, 0) != 0) {
+        return std::nullopt; // e.g. the browser asking for a favicon
     }
 
-    std::string code;
-    for (int i = 0; code_pos + code_str.length() - 1 + i != target.length() - 1; i++) {
-        if (target[code_pos + code_str.length() + i] == '&') {
-            break;
-        }
+    if (get_query_parameter(target, "state") != state) {
+        log::error("Redirect did not contain the expected state parameter");
+        return std::nullopt;
+    }
 
-        code += target[code_pos + code_str.length() + i];
+    auto code = get_query_parameter(target, "code");
+    if (!code || code->empty()) {
+        log::error("Redirect did not contain a code parameter");
+        return std::nullopt;
     }
 
     return code;
 }
 
-eo::TokenRequestResult eo::make_token_request(const AuthenticationCode &auth_code, const CodeChallenge &code_challenge)
+eo::HttpRequest eo::make_token_exchange_request(const AuthenticationCode &auth_code, const CodeChallenge &code_challenge)
 {
     eo::HttpRequest request;
     request.hostname                           = eve_baseurl;
@@ -134,30 +127,36 @@ eo::TokenRequestResult eo::make_token_request(const AuthenticationCode &auth_cod
     request.headers[http::field::content_type] = "application/x-www-form-urlencoded";
     request.body = fmt::format("grant_type=authorization_code&code={0}&client_id={1}&code_verifier={2}", auth_code, std::string(client_id),
                                code_challenge);
+    return request;
+}
 
-    const auto response = makeHttpRequest(request);
-
+eo::TokenRequestResult eo::parse_token_response(const HttpResponse &response, const CodeChallenge &code_challenge)
+{
     auto j = json::parse(response.body);
 
     return TokenRequestResult{ j.at("access_token"), j.at("expires_in"), j.at("token_type"), j.at("refresh_token"), code_challenge };
 }
 
-eo::VerifyTokenRequestResult eo::verify_token(const AuthenticationCode &auth_code)
+eo::VerifyTokenRequestResult eo::verify_token(const std::string &access_token, const jwt::KeySet &keys)
 {
-    HttpRequest request;
-    request.hostname                            = "esi.evetech.net";
-    request.target                              = "/verify/";
-    request.headers["X-User-Agent"]             = client_id;
-    request.headers[http::field::authorization] = fmt::format("Bearer {0}", auth_code);
-    request.headers[http::field::accept]        = "application/json";
+    const auto decoded = jwt::decode(access_token);
+    keys.verifySignature(decoded);
+
+    const auto &claims = decoded.claims;
+    if (claims.issuer != eve_baseurl && claims.issuer != fmt::format("https://{0}", eve_baseurl)) {
+        throw std::runtime_error(fmt::format("Access token was issued by {0}", claims.issuer));
+    }
 
-    const auto response = makeHttpRequest(request);
+    if (!claims.authorizedParty.empty() && claims.authorizedParty != client_id) {
+        throw std::runtime_error(fmt::format("Access token was issued for the client {0}", claims.authorizedParty));
+    }
 
-    json j = json::parse(response.body);
-    return { j["CharacterID"], j["CharacterName"], j["CharacterOwnerHash"], j["ExpiresOn"], j["TokenType"] };
+    return { claims.characterID, claims.characterName, claims.owner, format_esi_time(claims.expiresAt), "Character" };
 }
 
-void eo::refresh_token(TokenData &token)
+bool eo::token_expired(const TokenData &token) { return token.expiresAt <= std::chrono::system_clock::now(); }
+
+eo::HttpRequest eo::make_refresh_request(const TokenData &token)
 {
     HttpRequest request;
     request.hostname                           = eve_baseurl;
@@ -166,9 +165,12 @@ void eo::refresh_token(TokenData &token)
     request.headers[http::field::content_type] = "application/x-www-form-urlencoded";
     request.body = fmt::format("grant_type=refresh_token&refresh_token={0}&client_id={1}&code_verifier={2}", token.refreshToken, client_id,
                                token.codeChallenge);
+    return request;
+}
 
-    const auto response = makeHttpRequest(request);
-    const json j        = json::parse(response.body);
+void eo::apply_refresh_response(TokenData &token, const HttpResponse &response)
+{
+    const json j = json::parse(response.body);
 
     try {
         j.at("access_token").get_to(token.accessToken);
@@ -176,21 +178,4 @@ void eo::refresh_token(TokenData &token)
     } catch (const json::out_of_range &) {
         throw std::runtime_error(fmt::format("Could not refresh token, reqeust returned {0}", j.dump(4)));
     }
-
-    const auto verifyresult = verify_token(token.accessToken);
-    token.expiresOn         = verifyresult.expiresOn;
-}
-
-bool eo::token_expired(const TokenData &token)
-{
-    const auto &expiresOn = token.expiresOn;
-    const auto  t         = std::time(nullptr);
-    const auto *utctm     = std::gmtime(&t);
-
-    std::array<char, 64> output = { 0 };
-
-    const auto       length = std::strftime(output.data(), output.size(), "%FT%TZ", utctm);
-    std::string_view timestring{ output.data(), length };
-
-    return expiresOn < timestring;
 }
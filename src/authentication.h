@@ -18,13 +18,15 @@
 #include "util.h"
 
 #include <list>
+#include <optional>
 #include <string>
 #include <string_view>
 
 namespace eo {
-constexpr std::string_view client_id    = "fd612fe6fd514fd5b4c1718ed72ef33e";
-constexpr std::string_view redirect_url = "http://localhost:8080/callback/";
-constexpr std::string_view eve_baseurl  = "login.eveonline.com";
+constexpr std::string_view client_id     = "fd612fe6fd514fd5b4c1718ed72ef33e";
+constexpr std::string_view redirect_url  = "http://localhost:8080/callback/";
+constexpr std::string_view redirect_path = "/callback/";
+constexpr std::string_view eve_baseurl   = "login.eveonline.com";
 
 struct TokenRequestResult {
     std::string access_token;
@@ -49,21 +51,41 @@ struct TokenData {
     std::string accessToken;
     std::string expiresOn;
     std::string codeChallenge;
+
+    // expiresOn parsed once, so checking for expiry is cheap
+    std::chrono::system_clock::time_point expiresAt;
 };
 
+struct HttpRequest;
+struct HttpResponse;
+
+namespace jwt {
+    class KeySet;
+}
+
 using AuthenticationCode = std::string;
 using CodeChallenge      = std::string;
 
-CodeChallenge            make_authorize_request(std::list<std::string> scopes);
-AuthenticationCode       handle_redirect();
-TokenRequestResult       make_token_request(const AuthenticationCode &auth_code, const CodeChallenge &code_challenge);
-VerifyTokenRequestResult verify_token(const AuthenticationCode &auth_code);
-void                     refresh_token(TokenData &token);
-bool                     token_expired(const TokenData &token);
+std::string   make_oauth_state();
+CodeChallenge make_authorize_request(std::list<std::string> scopes, const std::string &state);
+bool          token_expired(const TokenData &token);
+
+// Validates the access token (a jwt) locally instead of asking esi's /verify/ endpoint.
+// Throws if the token uses an unknown key, see jwt::KeySet::ensureKeyAsync
+VerifyTokenRequestResult verify_token(const std::string &access_token, const jwt::KeySet &keys);
+
+// Returns the code if the request is the sso redirect belonging to the state
+std::optional<AuthenticationCode> parse_redirect(const HttpRequest &request, const std::string &state);
+
+// Building blocks of the asynchronous login and token refresh
+HttpRequest        make_token_exchange_request(const AuthenticationCode &auth_code, const CodeChallenge &code_challenge);
+TokenRequestResult parse_token_response(const HttpResponse &response, const CodeChallenge &code_challenge);
+HttpRequest        make_refresh_request(const TokenData &token);
+void               apply_refresh_response(TokenData &token, const HttpResponse &response);
 
 inline TokenData make_token_data(const TokenRequestResult &rresult, const VerifyTokenRequestResult &vresult)
 {
-    return { rresult.refresh_token, vresult.characterName, vresult.characterID,
-             rresult.access_token,  vresult.expiresOn,     rresult.codeChallenge };
+    return { rresult.refresh_token, vresult.characterName, vresult.characterID,   rresult.access_token,
+             vresult.expiresOn,     rresult.codeChallenge, parse_esi_time(vresult.expiresOn) };
 }
 }
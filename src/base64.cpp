@@ -127,3 +127,19 @@ std::string base64_decode(std::string const &encoded_string)
 
     return ret;
 }
+
+std::string base64_url_decode(std::string const &encoded_string)
+{
+    // Undo the url safe alphabet and the stripped padding, see base64_safe
+    std::string standard = encoded_string;
+    for (auto &c : standard) {
+        if (c == '-') {
+            c = '+';
+        } else if (c == '_') {
+            c = '/';
+        }
+    }
+    standard.append((4 - standard.length() % 4) % 4, '=');
+
+    return base64_decode(standard);
+}
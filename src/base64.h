@@ -11,5 +11,6 @@
 std::string base64_encode(const std::string &);
 std::string base64_encode(unsigned char const *, unsigned int len);
 std::string base64_decode(std::string const &s);
+std::string base64_url_decode(std::string const &s);
 
 #endif /* BASE64_H_C0CE2A47_D10E_42C9_A27C_C883944E704A */
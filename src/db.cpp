@@ -17,6 +17,7 @@
 #include "db.h"
 #include "authentication.h"
 #include "logging.h"
+#include "spatialindex.h"
 
 #include <fstream>
 #include <iostream>
@@ -178,6 +179,124 @@ void eo::db::migrate_tables(sqlite3 &dbconnection, int from, int to)
         sqlite3_exec(&dbconnection, "ALTER TABLE killmail ADD COLUMN killtime DEFAULT '';", nullptr, nullptr, nullptr);
         sqlite3_exec(&dbconnection, "DELETE FROM killmail WHERE killtime = '';", nullptr, nullptr, nullptr);
     } break;
+    case 5:
+        sqlite3_exec(&dbconnection, "CREATE TABLE IF NOT EXISTS jwks(kid, alg, kty, n, e);", nullptr, nullptr, nullptr);
+        break;
+    case 6:
+        sqlite3_exec(&dbconnection, "CREATE TABLE IF NOT EXISTS stargate(id, systemid, destinationsystemid, destinationstargateid);",
+                     nullptr, nullptr, nullptr);
+        break;
+    case 7:
+        sqlite3_exec(&dbconnection,
+                     "CREATE TABLE IF NOT EXISTS systemkills(hour, systemid, shipkills, npckills, podkills);"
+                     "CREATE TABLE IF NOT EXISTS systemjumps(hour, systemid, shipjumps);"
+                     "CREATE INDEX IF NOT EXISTS systemkills_hour ON systemkills(hour);"
+                     "CREATE INDEX IF NOT EXISTS systemjumps_hour ON systemjumps(hour);",
+                     nullptr, nullptr, nullptr);
+        break;
+    case 8:
+        sqlite3_exec(&dbconnection,
+                     "CREATE TABLE IF NOT EXISTS systemkill(systemid, killmailid, killtime, victimid, victimname, shiptypeid, shipname,"
+                     " PRIMARY KEY(systemid, killmailid));"
+                     "CREATE TABLE IF NOT EXISTS killwatermark(systemid PRIMARY KEY, killmailid, checked);",
+                     nullptr, nullptr, nullptr);
+        break;
+    case 9: {
+        // The json columns of the cached systems become blobs with the layout of esi::SolarSystem
+        struct Stargate {
+            int32 stargateID;
+            int32 destinationSystemID;
+        };
+        struct System {
+            int32                 id;
+            std::vector<int32>    planets;
+            math::vec3            position;
+            std::vector<Stargate> stargates;
+            std::vector<int32>    stations;
+        };
+
+        std::vector<System> systems;
+        std::vector<int32>  invalid;
+
+        sqlite3_stmt *select;
+        sqlite3_prepare_v2(&dbconnection, "SELECT id, planets, position, stargates, stations FROM solarsystem;", -1, &select, nullptr);
+        while (sqlite3_step(select) == SQLITE_ROW) {
+            const auto id = sqlite3_column_int(select, 0);
+            try {
+                System system{ id, {}, {}, {}, {} };
+                for (const auto &planet : json::parse(column_get_string(select, 1))) {
+                    system.planets.push_back(planet.at("planet_id"));
+                }
+                const auto position = json::parse(column_get_string(select, 2));
+                system.position     = to_lightyears(position.at("x"), position.at("y"), position.at("z"));
+                for (const int32 stargateID : json::parse(column_get_string(select, 3))) {
+                    system.stargates.push_back({ stargateID, 0 });
+                }
+                if (const auto stations = json::parse(column_get_string(select, 4)); stations.is_array()) {
+                    stations.get_to(system.stations);
+                }
+                systems.push_back(std::move(system));
+            } catch (const json::exception &) {
+                invalid.push_back(id); // Gets fetched again
+            }
+        }
+        sqlite3_finalize(select);
+
+        sqlite3_exec(&dbconnection, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+        sqlite3_stmt *update;
+        sqlite3_prepare_v2(&dbconnection, "UPDATE solarsystem SET planets = ?, position = ?, stargates = ?, stations = ? WHERE id = ?;",
+                           -1, &update, nullptr);
+        for (const auto &system : systems) {
+            bind_array(update, 1, system.planets);
+            bind_blob(update, 2, &system.position[0], sizeof(system.position));
+            bind_array(update, 3, system.stargates);
+            bind_array(update, 4, system.stations);
+            sqlite3_bind_int(update, 5, system.id);
+            sqlite3_step(update);
+            sqlite3_reset(update);
+        }
+        sqlite3_finalize(update);
+
+        sqlite3_stmt *remove;
+        sqlite3_prepare_v2(&dbconnection, "DELETE FROM solarsystem WHERE id = ?;", -1, &remove, nullptr);
+        for (const auto id : invalid) {
+            sqlite3_bind_int(remove, 1, id);
+            sqlite3_step(remove);
+            sqlite3_reset(remove);
+        }
+        sqlite3_finalize(remove);
+        sqlite3_exec(&dbconnection, "END TRANSACTION;", nullptr, nullptr, nullptr);
+
+        if (!systems.empty()) {
+            log::info("Converted {0} cached systems", systems.size());
+        }
+    } break;
+    case 10:
+        // Entities are replaced when they are fetched again, keep only the latest row of each
+        sqlite3_exec(&dbconnection,
+                     "DELETE FROM solarsystem WHERE rowid NOT IN (SELECT MAX(rowid) FROM solarsystem GROUP BY id);"
+                     "DELETE FROM killmail WHERE rowid NOT IN (SELECT MAX(rowid) FROM killmail GROUP BY id);"
+                     "CREATE UNIQUE INDEX IF NOT EXISTS solarsystem_id ON solarsystem(id);"
+                     "CREATE UNIQUE INDEX IF NOT EXISTS killmail_id ON killmail(id);",
+                     nullptr, nullptr, nullptr);
+        break;
+
+    case 11:
+        // Every refresh used to append a token, keep only the latest one of each character
+        sqlite3_exec(&dbconnection,
+                     "DELETE FROM token WHERE rowid NOT IN (SELECT MAX(rowid) FROM token GROUP BY characterid);"
+                     "CREATE UNIQUE INDEX IF NOT EXISTS token_characterid ON token(characterid);",
+                     nullptr, nullptr, nullptr);
+        break;
+
+    case 12:
+        // Stargates are looked up by their system and replaced when they are resolved again
+        sqlite3_exec(&dbconnection,
+                     "DELETE FROM stargate WHERE rowid NOT IN (SELECT MAX(rowid) FROM stargate GROUP BY id);"
+                     "CREATE UNIQUE INDEX IF NOT EXISTS stargate_id ON stargate(id);"
+                     "CREATE INDEX IF NOT EXISTS stargate_systemid ON stargate(systemid);",
+                     nullptr, nullptr, nullptr);
+        break;
 
     default:
         throw std::logic_error(fmt::format("Unsupported database migration. from version {0} to version {1}", from, to));
@@ -188,7 +307,7 @@ void eo::db::migrate_tables(sqlite3 &dbconnection, int from, int to)
 
 void eo::db::store_in_db(SqliteSPtr dbconnection, const TokenData &data)
 {
-    auto stmt = make_statement(std::move(dbconnection), "INSERT INTO token VALUES(?,?,?,?,?,?)");
+    auto stmt = make_statement(std::move(dbconnection), "INSERT OR REPLACE INTO token VALUES(?,?,?,?,?,?)");
     sqlite3_bind_text(stmt.get(), 1, data.refreshToken.c_str(), data.refreshToken.length(), nullptr);
     sqlite3_bind_text(stmt.get(), 2, data.characterName.c_str(), data.characterName.length(), nullptr);
     sqlite3_bind_int(stmt.get(), 3, data.characterID);
@@ -217,10 +336,32 @@ eo::TokenData eo::db::get_latest_tokendata_by_expiredate(SqliteSPtr dbconnection
     data.accessToken   = column_get_string(stmt.get(), 3);
     data.expiresOn     = column_get_string(stmt.get(), 4);
     data.codeChallenge = column_get_string(stmt.get(), 5);
+    data.expiresAt     = parse_esi_time(data.expiresOn);
 
     return data;
 }
 
+std::vector<eo::TokenData> eo::db::get_latest_tokendata_per_character(SqliteSPtr dbconnection)
+{
+    // Sqlite takes the other columns from the row with the maximum
+    auto stmt = make_statement(std::move(dbconnection), "SELECT refreshtoken, charactername, characterid, accesstoken, MAX(expireson), "
+                                                        "codechallenge FROM token GROUP BY characterid");
+
+    std::vector<TokenData> tokens;
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        TokenData &data    = tokens.emplace_back();
+        data.refreshToken  = column_get_string(stmt.get(), 0);
+        data.characterName = column_get_string(stmt.get(), 1);
+        data.characterID   = sqlite3_column_int(stmt.get(), 2);
+        data.accessToken   = column_get_string(stmt.get(), 3);
+        data.expiresOn     = column_get_string(stmt.get(), 4);
+        data.codeChallenge = column_get_string(stmt.get(), 5);
+        data.expiresAt     = parse_esi_time(data.expiresOn);
+    }
+
+    return tokens;
+}
+
 std::string eo::db::column_get_string(sqlite3_stmt *stmt, int col)
 {
     std::string output;
@@ -229,6 +370,18 @@ std::string eo::db::column_get_string(sqlite3_stmt *stmt, int col)
     return output;
 }
 
+void eo::db::bind_blob(sqlite3_stmt *stmt, int col, const void *data, std::size_t size)
+{
+    // An empty array is bound as an empty blob instead of null
+    sqlite3_bind_blob(stmt, col, size == 0 ? "" : data, size, nullptr);
+}
+
+std::string_view eo::db::column_get_blob(sqlite3_stmt *stmt, int col)
+{
+    const auto data = static_cast<const char *>(sqlite3_column_blob(stmt, col));
+    return data ? std::string_view(data, sqlite3_column_bytes(stmt, col)) : std::string_view();
+}
+
 namespace {
 json parse_invtypes_assetfile()
 {
@@ -16,8 +16,11 @@
 
 #pragma once
 #include "util.h"
+#include <cstring>
 #include <memory>
 #include <string_view>
+#include <type_traits>
+#include <vector>
 
 extern "C" {
 struct sqlite3;
@@ -30,7 +33,7 @@ struct TokenData;
 
 namespace eo::db {
 
-constexpr const int CURRENT_VERSION = 5;
+constexpr const int CURRENT_VERSION = 13;
 
 using SqliteSPtr     = std::shared_ptr<sqlite3>;
 using SqliteStmtSPtr = std::shared_ptr<sqlite3_stmt>;
@@ -40,6 +43,30 @@ SqliteStmtSPtr make_statement(SqliteSPtr dbconnection, const std::string &stmt);
 
 std::string column_get_string(sqlite3_stmt *stmt, int col);
 
+// Trivially copyable values and arrays of them are stored as blobs in their native layout
+void             bind_blob(sqlite3_stmt *stmt, int col, const void *data, std::size_t size);
+std::string_view column_get_blob(sqlite3_stmt *stmt, int col);
+
+template<typename Container>
+void bind_array(sqlite3_stmt *stmt, int col, const Container &values)
+{
+    static_assert(std::is_trivially_copyable_v<typename Container::value_type>);
+    bind_blob(stmt, col, values.data(), values.size() * sizeof(typename Container::value_type));
+}
+
+template<typename Container>
+void column_get_array(sqlite3_stmt *stmt, int col, Container &values)
+{
+    using Value = typename Container::value_type;
+    static_assert(std::is_trivially_copyable_v<Value>);
+
+    const auto blob = column_get_blob(stmt, col);
+    values.resize(blob.size() / sizeof(Value));
+    if (!values.empty()) {
+        std::memcpy(values.data(), blob.data(), values.size() * sizeof(Value));
+    }
+}
+
 void migrate_tables(sqlite3 &dbconnection, int from, int to);
 int  get_pragma_version(sqlite3 &dbconnection);
 void set_pragma_version(sqlite3 &dbconnection, int value);
@@ -47,4 +74,6 @@ void set_pragma_version(sqlite3 &dbconnection, int value);
 // Store, Load and other helper functions
 void      store_in_db(SqliteSPtr dbconnection, const TokenData &data);
 TokenData get_latest_tokendata_by_expiredate(SqliteSPtr dbconnection);
+// The latest token of every character
+std::vector<TokenData> get_latest_tokendata_per_character(SqliteSPtr dbconnection);
 }
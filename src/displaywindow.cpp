@@ -15,6 +15,7 @@
  */
 
 #include "displaywindow.h"
+#include "headless.h"
 
 #define GLFW_INCLUDE_NONE
 #include "GLFW/glfw3.h"
@@ -22,7 +23,18 @@
 
 #include "logging.h"
 
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
 namespace {
+// Tracked here, so frames of the same window do not switch the context at all
+const eo::DisplayWindow *current_window = nullptr;
+
+bool        headless       = false;
+const auto  headless_start = std::chrono::steady_clock::now();
+std::string headless_clipboard;
+
 bool initGlfw()
 {
     static bool init = false;
@@ -34,6 +46,31 @@ bool initGlfw()
 
     return init;
 }
+
+void context_hints()
+{
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+}
+
+// Every window shares its objects (textures, programs, buffers) with this hidden one.
+// Shared resources stay valid no matter which of the visible windows got closed already
+GLFWwindow *share_window()
+{
+    static GLFWwindow *window = [] {
+        context_hints();
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        auto *hidden = glfwCreateWindow(1, 1, "eve-overlay shared context", nullptr, nullptr);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+        if (!hidden) {
+            eo::log::error("Could not create the shared context, windows will not share resources");
+        }
+        return hidden;
+    }();
+
+    return window;
+}
 }
 void terminateGlfw()
 {
@@ -44,84 +81,168 @@ void terminateGlfw()
     }
 }
 
-void eo::DisplayWindow::pollEvents() { glfwPollEvents(); }
+void eo::DisplayWindow::pollEvents()
+{
+    if (!headless) {
+        glfwPollEvents();
+    }
+}
+
+void eo::DisplayWindow::waitEvents(double timeout)
+{
+    if (headless) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(timeout));
+        return;
+    }
+    glfwWaitEventsTimeout(timeout);
+}
+
+void eo::DisplayWindow::useHeadless() { headless = true; }
 
 eo::DisplayWindow::DisplayWindow(int width, int height, std::string name, int posx, int posy)
     : mName(std::move(name))
 {
-    boost::ignore_unused(posx, posy);
+    log::info("Creating a new window {0}", mName);
 
-    log::info("Creating a new window {0}", name);
+    if (headless) {
+        mHeadless = std::make_unique<HeadlessContext>(width, height);
+        makeCurrent();
+        return;
+    }
 
     if (!initGlfw()) {
         log::error("Could not initialize glfw!");
         return; // TODO Mayebe throw an  exception here
     }
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    auto *share = share_window();
+    context_hints();
 
     glfwWindowHint(GLFW_TRANSPARENT_FRAMEBUFFER, GL_TRUE);
     glfwWindowHint(GLFW_DECORATED, GLFW_TRUE);
     glfwWindowHint(GLFW_FLOATING, GLFW_TRUE);
 
-    mWindow = glfwCreateWindow(width, height, mName.c_str(), nullptr, nullptr);
+    mWindow = glfwCreateWindow(width, height, mName.c_str(), nullptr, share);
 
     if (!mWindow) {
         log::error("Could not create a valid window");
         return;
     }
 
+    glfwSetWindowPos(mWindow, posx, posy);
     glfwSetWindowUserPointer(mWindow, this);
 
-    glfwSetKeyCallback(mWindow, [](auto *window, auto... args) {
-        static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window))->keyboardInput(args...);
-    });
-    glfwSetCharCallback(mWindow, [](auto *window, auto... args) {
-        static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window))->characterInput(args...);
-    });
-    glfwSetCursorPosCallback(
-        mWindow, [](auto *window, auto... args) { static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window))->cursorInput(args...); });
-    glfwSetCursorEnterCallback(mWindow, [](auto *window, auto... args) {
-        static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window))->cursorenterInput(args...);
-    });
-    glfwSetMouseButtonCallback(mWindow, [](auto *window, auto... args) {
-        static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window))->mousebuttonInput(args...);
+    glfwSetKeyCallback(mWindow, [](auto *window, auto... args) { inputWindow(window).keyboardInput(args...); });
+    glfwSetCharCallback(mWindow, [](auto *window, auto... args) { inputWindow(window).characterInput(args...); });
+    glfwSetCursorPosCallback(mWindow, [](auto *window, auto... args) { inputWindow(window).cursorInput(args...); });
+    glfwSetCursorEnterCallback(mWindow, [](auto *window, auto... args) { inputWindow(window).cursorenterInput(args...); });
+    glfwSetMouseButtonCallback(mWindow, [](auto *window, auto... args) { inputWindow(window).mousebuttonInput(args...); });
+    glfwSetScrollCallback(mWindow, [](auto *window, auto... args) { inputWindow(window).scrollInput(args...); });
+    glfwSetFramebufferSizeCallback(mWindow,
+                                   [](auto *window, auto... args) { inputWindow(window).framebufferResizeCallback(args...); });
+    // The contents got damaged, e.g. by another window
+    glfwSetWindowRefreshCallback(mWindow, [](auto *window) {
+        auto &self    = *static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window));
+        self.mDamaged = true;
+        self.requestFrame();
     });
-    glfwSetScrollCallback(
-        mWindow, [](auto *window, auto... args) { static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window))->scrollInput(args...); });
-    glfwSetFramebufferSizeCallback(mWindow, [](auto *window, auto... args) {
-        static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window))->framebufferResizeCallback(args...);
+    glfwSetWindowIconifyCallback(mWindow, [](auto *window, int iconified) {
+        auto &self      = *static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window));
+        self.mIconified = iconified == GLFW_TRUE;
+        self.mDamaged   = true;
+        self.requestFrame();
     });
 
-    glfwMakeContextCurrent(mWindow);
+    makeCurrent();
     gladLoadGLLoader((GLADloadproc)(glfwGetProcAddress));
+
+    // The FrameScheduler paces the frames. Waiting for the vertical blank in every swap would cost one refresh per window
+    glfwSwapInterval(0);
 }
 
-bool eo::DisplayWindow::shouldWindowClose() const { return glfwWindowShouldClose(mWindow); }
+bool eo::DisplayWindow::shouldWindowClose() const { return !mHeadless && glfwWindowShouldClose(mWindow); }
+
+bool eo::DisplayWindow::isVisible() const { return mHeadless || (!mIconified && glfwGetWindowAttrib(mWindow, GLFW_VISIBLE)); }
+
+bool eo::DisplayWindow::isCurrent() const { return current_window == this; }
+
+void eo::DisplayWindow::makeCurrent()
+{
+    if (isCurrent()) {
+        return;
+    }
+
+    if (mHeadless) {
+        mHeadless->makeCurrent();
+    } else {
+        glfwMakeContextCurrent(mWindow);
+    }
+    current_window = this;
+}
 
 void eo::DisplayWindow::frame()
 {
-    glfwMakeContextCurrent(mWindow);
-    renderContents();
-    glfwSwapBuffers(mWindow);
+    // Before rendering, so the contents can request the next frame
+    mRequestedFrames = std::max(mRequestedFrames - 1, 0);
+    mFrameDeadline   = std::numeric_limits<double>::infinity();
+
+    makeCurrent();
+    if (mViewportChanged) {
+        const auto size = getFramebufferSize();
+        glViewport(0, 0, static_cast<GLsizei>(size.x), static_cast<GLsizei>(size.y));
+        mViewportChanged = false;
+    }
+
+    {
+        const auto timer = mProfiler.time(FrameProfiler::Frame);
+        if (renderContents()) {
+            const auto swap_timer = mProfiler.time(FrameProfiler::Swap);
+            if (mHeadless) {
+                glFlush(); // Nothing to swap, the frame stays in the framebuffer object
+            } else {
+                glfwSwapBuffers(mWindow);
+            }
+            mDamaged = false;
+        }
+    }
+    mProfiler.endFrame();
+
+    mLastFrameTime = getTime();
+}
+
+void eo::DisplayWindow::requestFrame(int frames) { mRequestedFrames = std::max(mRequestedFrames, frames); }
+
+void eo::DisplayWindow::requestFrameAt(double time) { mFrameDeadline = std::min(mFrameDeadline, time); }
+
+eo::DisplayWindow &eo::DisplayWindow::inputWindow(GLFWwindow *window)
+{
+    auto &self          = *static_cast<DisplayWindow *>(glfwGetWindowUserPointer(window));
+    self.mLastInputTime = getTime();
+    self.requestFrame(input_frames);
+    return self;
 }
 
-void eo::DisplayWindow::renderContents()
+bool eo::DisplayWindow::renderContents()
 {
     glClearColor(1., .0, .0, .25);
     glClear(GL_COLOR_BUFFER_BIT);
+    return true;
 }
 
 void eo::DisplayWindow::framebufferResizeCallback(int width, int height)
 {
-    glfwMakeContextCurrent(mWindow);
-    glViewport(0, 0, width, height);
+    mViewportChanged = true;
+    mDamaged         = true;
+    requestFrame();
     onFramebufferResize(width, height);
 }
 
 eo::math::vec2 eo::DisplayWindow::getFramebufferSize() const
 {
+    if (mHeadless) {
+        return mHeadless->getSize();
+    }
+
     int x, y;
     glfwGetFramebufferSize(mWindow, &x, &y);
     return { static_cast<float>(x), static_cast<float>(y) };
@@ -129,14 +250,44 @@ eo::math::vec2 eo::DisplayWindow::getFramebufferSize() const
 
 eo::DisplayWindow::~DisplayWindow()
 {
+    // Destroying the window releases its context, a headless context releases whichever was current
+    if (isCurrent() || mHeadless) {
+        current_window = nullptr;
+    }
+
     if (mWindow) {
         glfwSetWindowUserPointer(mWindow, nullptr);
         glfwDestroyWindow(mWindow);
     }
 }
 
-void eo::DisplayWindow::setClipboard(const char *content) { glfwSetClipboardString(mWindow, content); }
+void eo::DisplayWindow::setClipboard(const char *content)
+{
+    if (mHeadless) {
+        headless_clipboard = content;
+        return;
+    }
+    glfwSetClipboardString(mWindow, content);
+}
+
+const char *eo::DisplayWindow::getClipboard() const { return mHeadless ? headless_clipboard.c_str() : glfwGetClipboardString(mWindow); }
 
-const char *eo::DisplayWindow::getClipboard() const { return glfwGetClipboardString(mWindow); }
+bool eo::DisplayWindow::isMouseButtonDown(int button) const { return !mHeadless && glfwGetMouseButton(mWindow, button) == GLFW_PRESS; }
 
-double eo::DisplayWindow::getTime() { return glfwGetTime(); }
+std::vector<eo::byte> eo::DisplayWindow::readPixels()
+{
+    if (!mHeadless) {
+        throw std::logic_error("Only headless windows can be read back");
+    }
+
+    makeCurrent();
+    return mHeadless->readPixels();
+}
+
+double eo::DisplayWindow::getTime()
+{
+    if (headless) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - headless_start).count();
+    }
+    return glfwGetTime();
+}
@@ -15,15 +15,21 @@
  */
 
 #pragma once
+#include <limits>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "./math.h"
+#include "profiler.h"
 #include "util.h"
 
 struct GLFWwindow;
 
 namespace eo {
 
+class HeadlessContext;
+
 /*
  * DisplayWindow:
  *  - Creates a window at the specified position and size
@@ -35,22 +41,46 @@ namespace eo {
 class DisplayWindow {
 public:
     static void   pollEvents();
+    // Sleeps until an event arrives or the timeout in seconds expired
+    static void   waitEvents(double timeout);
     static double getTime();
+    // Windows created afterwards render offscreen into a HeadlessContext instead of a glfw window, they never get input
+    static void   useHeadless();
 
 public:
     explicit DisplayWindow(int width, int height, std::string name, int posx, int posy);
     virtual ~DisplayWindow();
 
     [[nodiscard]] bool shouldWindowClose() const;
+    // Iconified or hidden windows are not rendered, nobody would see the frame
+    [[nodiscard]] bool isVisible() const;
+    [[nodiscard]] bool isCurrent() const;
 
     void frame();
 
+    // Frames are only rendered on request, the FrameScheduler decides when exactly
+    void requestFrame(int frames = 1);
+    // A frame at the time even without a request, e.g. for a blinking cursor
+    void requestFrameAt(double time);
+
+    [[nodiscard]] bool   wantsFrame(double now) const { return mRequestedFrames > 0 || now >= mFrameDeadline; }
+    [[nodiscard]] double getFrameDeadline() const { return mFrameDeadline; }
+    [[nodiscard]] double getLastFrameTime() const { return mLastFrameTime; }
+    [[nodiscard]] double getLastInputTime() const { return mLastInputTime; }
+
     [[nodiscard]] math::vec2  getFramebufferSize() const;
     void                      setClipboard(const char *content);
     [[nodiscard]] const char *getClipboard() const;
+    [[nodiscard]] bool        isMouseButtonDown(int button) const;
+
+    // Headless windows only: The last frame as rgba pixels, top row first
+    [[nodiscard]] std::vector<byte> readPixels();
 
 protected:
-    virtual void renderContents();
+    // Returns false if the frame would look like the last one, it is not presented then
+    virtual bool renderContents();
+    // The last frame is gone or does not fit the window anymore, e.g. after a resize. The next one has to be presented
+    [[nodiscard]] bool isDamaged() const { return mDamaged; }
 
     virtual void keyboardInput(int key, int scancode, int action, int mods) { boost::ignore_unused(key, scancode, action, mods); }
     virtual void characterInput(unsigned int codepoint) { boost::ignore_unused(codepoint); }
@@ -62,8 +92,32 @@ protected:
     virtual void onFramebufferResize(int width, int height) { boost::ignore_unused(width, height); }
     void         framebufferResizeCallback(int width, int height);
 
+    // Only switches the context if another one is current
+    void makeCurrent();
+
     GLFWwindow *mWindow = nullptr;
     std::string mName;
+
+    // Instead of mWindow
+    std::unique_ptr<HeadlessContext> mHeadless;
+
+    FrameProfiler mProfiler;
+
+private:
+    // Some reactions to input only show up one frame later, e.g. hovering a widget which moved
+    constexpr static int input_frames = 2;
+
+    // The window of a glfw callback, records the input
+    static DisplayWindow &inputWindow(GLFWwindow *window);
+
+    int    mRequestedFrames = 1;
+    double mFrameDeadline   = std::numeric_limits<double>::infinity();
+    double mLastFrameTime   = 0.;
+    double mLastInputTime   = 0.;
+    bool   mIconified       = false;
+    bool   mDamaged         = true;
+    // Applied with the next frame, so resizing does not switch contexts while the events are polled
+    bool mViewportChanged = false;
 };
 
 }
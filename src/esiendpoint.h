@@ -0,0 +1,163 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "util.h"
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/container/small_vector.hpp>
+#include <nlohmann/json_fwd.hpp>
+
+namespace eo::esi {
+
+// Where the value of a member comes from
+struct FromValue {};    // The field of the response
+struct FromOptional {}; // The field of the response, a default value if it is missing
+struct FromJson {};     // The field of the response kept as raw json
+struct FromRequest {};  // Not part of the response, e.g. the hash of a killmail
+
+// The field of the response, converted into a typed member, e.g. the planet ids out of the planet objects
+template<typename M>
+struct FromConverter {
+    void (*convert)(const nlohmann::json &, M &);
+};
+
+/*
+ * Maps one member of an entity to a field of the esi response and a column of its table.
+ * The source is part of the type, so the parse and the bind code get picked at compile time.
+ */
+template<typename T, typename M, typename Source>
+struct Field {
+    using Entity = T;
+    using Member = M;
+    using From   = Source;
+
+    const char *key;    // nullptr if the member is not part of the response
+    M T::*      member;
+    const char *column; // nullptr if the member is not stored in the database
+    const char *object; // nullptr or the object the field is nested in, e.g. zkb
+    Source      from;
+};
+
+template<typename T, typename M>
+constexpr Field<T, M, FromValue> value(const char *key, M T::*member, const char *column = nullptr)
+{
+    return { key, member, column, nullptr, {} };
+}
+
+template<typename T, typename M>
+constexpr Field<T, M, FromValue> nested(const char *object, const char *key, M T::*member)
+{
+    return { key, member, nullptr, object, {} };
+}
+
+template<typename T, typename M>
+constexpr Field<T, M, FromOptional> optional_value(const char *key, M T::*member, const char *column = nullptr)
+{
+    return { key, member, column, nullptr, {} };
+}
+
+template<typename T>
+constexpr Field<T, std::string, FromJson> raw_json(const char *key, std::string T::*member, const char *column = nullptr)
+{
+    return { key, member, column, nullptr, {} };
+}
+
+template<typename T, typename M>
+constexpr Field<T, M, FromConverter<M>>
+converted(const char *key, M T::*member, void (*convert)(const nlohmann::json &, M &), const char *column = nullptr)
+{
+    return { key, member, column, nullptr, { convert } };
+}
+
+template<typename T, typename M>
+constexpr Field<T, M, FromRequest> from_request(M T::*member, const char *column)
+{
+    return { nullptr, member, column, nullptr, {} };
+}
+
+/*
+ * Describes one esi endpoint, specialized once per entity:
+ *  - host, route: The request, the route is formatted with the id and the extra arguments of the request
+ *  - table, key_column: The database table, an empty table if the entity is only cached in memory
+ *  - id: The member holding the id the entity is requested with
+ *  - cache_bytes: The memory budget of the cache in front of the database
+ *  - fields: Tuple of the fields above
+ */
+template<typename T>
+struct Endpoint;
+
+// Hooks an endpoint can hide if its entity needs more than the id to be requested
+struct EndpointDefaults {
+    constexpr static std::size_t cache_bytes = 0;
+
+    // Fills the members which are not part of the response
+    template<typename T, typename... Args>
+    static void complete(T &, const Args &...)
+    {
+    }
+
+    // Whether a cached entity is the one which was requested
+    template<typename T, typename... Args>
+    static bool matches(const T &, const Args &...)
+    {
+        return true;
+    }
+};
+
+template<typename T, typename Func>
+constexpr void for_each_field(Func &&func)
+{
+    std::apply([&func](const auto &... fields) { (func(fields), ...); }, Endpoint<T>::fields);
+}
+
+// Heap memory of a member
+inline std::size_t heap_bytes(const std::string &s) { return s.capacity(); }
+
+template<typename V>
+std::size_t heap_bytes(const std::vector<V> &v)
+{
+    return v.capacity() * sizeof(V);
+}
+
+template<typename V, std::size_t N>
+std::size_t heap_bytes(const boost::container::small_vector<V, N> &v)
+{
+    return v.capacity() > N ? v.capacity() * sizeof(V) : 0;
+}
+
+template<typename M>
+std::size_t heap_bytes(const M &)
+{
+    return 0;
+}
+
+// Estimated memory of an entity, its members count with their heap memory
+struct EntityWeight {
+    std::size_t operator()(const std::string &s) const { return sizeof(s) + s.capacity(); }
+
+    template<typename T>
+    std::size_t operator()(const T &entity) const
+    {
+        std::size_t bytes = sizeof(T);
+        for_each_field<T>([&](const auto &field) { bytes += heap_bytes(entity.*field.member); });
+        return bytes;
+    }
+};
+}
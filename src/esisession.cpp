@@ -18,6 +18,7 @@
 #include "logging.h"
 #include "requests.h"
 
+#include <algorithm>
 #include <fmt/core.h>
 #include <nlohmann/json.hpp>
 #include <sqlite3.h>
@@ -25,6 +26,219 @@
 using namespace eo::esi;
 using json = nlohmann::json;
 
+namespace {
+// The parse, bind and column read code of the esi::Endpoint descriptors
+template<typename T, typename M, typename Source>
+const json &field_object(const json &j, const Field<T, M, Source> &field)
+{
+    return field.object ? j.at(field.object) : j;
+}
+
+template<typename T, typename M>
+void parse_field(const json &j, T &entity, const Field<T, M, FromValue> &field)
+{
+    field_object(j, field).at(field.key).get_to(entity.*field.member);
+}
+
+template<typename T, typename M>
+void parse_field(const json &j, T &entity, const Field<T, M, FromOptional> &field)
+{
+    entity.*field.member = field_object(j, field).value(field.key, M{});
+}
+
+template<typename T, typename M>
+void parse_field(const json &j, T &entity, const Field<T, M, FromJson> &field)
+{
+    entity.*field.member = field_object(j, field).at(field.key).dump();
+}
+
+template<typename T, typename M>
+void parse_field(const json &, T &, const Field<T, M, FromRequest> &)
+{
+}
+
+// Converters handle missing fields, esi leaves out e.g. the stargates of wormhole systems
+template<typename T, typename M>
+void parse_field(const json &j, T &entity, const Field<T, M, FromConverter<M>> &field)
+{
+    const auto &object = field_object(j, field);
+    const auto  it     = object.find(field.key);
+    field.from.convert(it != object.end() ? *it : json(), entity.*field.member);
+}
+
+template<typename T>
+T parse_entity(const json &j)
+{
+    T entity{};
+    for_each_field<T>([&](const auto &field) { parse_field(j, entity, field); });
+    return entity;
+}
+
+template<typename T>
+std::vector<T> parse_entities(const std::string &body)
+{
+    const auto     j = json::parse(body);
+    std::vector<T> entities;
+    entities.reserve(j.size());
+    for (const auto &item : j) {
+        entities.push_back(parse_entity<T>(item));
+    }
+    return entities;
+}
+
+template<typename T, typename... Args>
+eo::HttpRequest make_request(eo::int32 id, const Args &... args)
+{
+    eo::HttpRequest request;
+    request.hostname = Endpoint<T>::host;
+    request.target   = fmt::format(Endpoint<T>::route, id, args...);
+    return request;
+}
+
+void bind_column(sqlite3_stmt *stmt, int index, eo::int32 value) { sqlite3_bind_int(stmt, index, value); }
+void bind_column(sqlite3_stmt *stmt, int index, double value) { sqlite3_bind_double(stmt, index, value); }
+void bind_column(sqlite3_stmt *stmt, int index, const std::string &value)
+{
+    sqlite3_bind_text(stmt, index, value.c_str(), value.length(), nullptr);
+}
+
+void read_column(sqlite3_stmt *stmt, int index, eo::int32 &value) { value = sqlite3_column_int(stmt, index); }
+void read_column(sqlite3_stmt *stmt, int index, bool &value) { value = sqlite3_column_int(stmt, index) != 0; }
+void read_column(sqlite3_stmt *stmt, int index, float &value) { value = static_cast<float>(sqlite3_column_double(stmt, index)); }
+void read_column(sqlite3_stmt *stmt, int index, double &value) { value = sqlite3_column_double(stmt, index); }
+void read_column(sqlite3_stmt *stmt, int index, std::string &value) { value = eo::db::column_get_string(stmt, index); }
+
+void bind_column(sqlite3_stmt *stmt, int index, const eo::math::vec3 &value) { eo::db::bind_blob(stmt, index, &value[0], sizeof(value)); }
+void read_column(sqlite3_stmt *stmt, int index, eo::math::vec3 &value)
+{
+    if (const auto blob = eo::db::column_get_blob(stmt, index); blob.size() == sizeof(value)) {
+        std::memcpy(&value[0], blob.data(), sizeof(value));
+    }
+}
+
+template<typename Container>
+auto bind_column(sqlite3_stmt *stmt, int index, const Container &values) -> decltype(values.data(), void())
+{
+    eo::db::bind_array(stmt, index, values);
+}
+
+template<typename Container>
+auto read_column(sqlite3_stmt *stmt, int index, Container &values) -> decltype(values.data(), void())
+{
+    eo::db::column_get_array(stmt, index, values);
+}
+
+// Calls func with the fields stored in the database and their column index
+template<typename T, typename Func>
+void for_each_column(Func &&func)
+{
+    int index = 0;
+    for_each_field<T>([&](const auto &field) {
+        if (field.column) {
+            func(field, index++);
+        }
+    });
+}
+
+template<typename T>
+std::string column_list()
+{
+    std::string columns;
+    for_each_column<T>([&](const auto &field, int index) {
+        columns += index == 0 ? "" : ", ";
+        columns += field.column;
+    });
+    return columns;
+}
+
+template<typename T>
+const std::string &insert_statement()
+{
+    static const auto statement = [] {
+        std::string values;
+        for_each_column<T>([&](const auto &, int index) { values += index == 0 ? "?" : ",?"; });
+        // A killmail is fetched again when the stored one has another hash
+        return fmt::format("INSERT OR REPLACE INTO {0}({1}) VALUES({2});", Endpoint<T>::table, column_list<T>(), values);
+    }();
+    return statement;
+}
+
+template<typename T>
+const std::string &select_statement()
+{
+    static const auto statement
+        = fmt::format("SELECT {0} FROM {1} WHERE {2} = ? LIMIT 1;", column_list<T>(), Endpoint<T>::table, Endpoint<T>::key_column);
+    return statement;
+}
+
+template<typename T>
+std::optional<T> load_entity(const eo::db::SqliteSPtr &dbconnection, eo::int32 id)
+{
+    auto stmt = eo::db::make_statement(dbconnection, select_statement<T>());
+    sqlite3_bind_int(stmt.get(), 1, id);
+    if (sqlite3_step(stmt.get()) != SQLITE_ROW) {
+        return std::nullopt;
+    }
+
+    T entity{};
+    for_each_column<T>([&](const auto &field, int index) { read_column(stmt.get(), index, entity.*field.member); });
+    return entity;
+}
+
+template<typename T>
+void store_entity(const eo::db::SqliteSPtr &dbconnection, const T &entity)
+{
+    auto stmt = eo::db::make_statement(dbconnection, insert_statement<T>());
+    for_each_column<T>([&](const auto &field, int index) { bind_column(stmt.get(), index + 1, entity.*field.member); });
+    sqlite3_step(stmt.get());
+}
+
+SolarSystem make_solar_system(const eo::StaticUniverse &universe, const eo::StaticUniverse::System &record)
+{
+    SolarSystem system;
+    system.systemID        = record.systemID;
+    system.constellationID = record.constellationID;
+    system.name            = universe.string(record.name);
+    system.securityClass   = universe.string(record.securityClass);
+    system.securityStatus  = record.securityStatus;
+    system.starID          = record.starID;
+    system.position        = eo::to_lightyears(record.x, record.y, record.z);
+
+    for (auto [it, last] = universe.stargates(record); it != last; ++it) {
+        system.stargates.push_back({ it->stargateID, it->destinationSystemID });
+    }
+
+    const auto [firstplanet, lastplanet] = universe.planets(record);
+    system.planets.assign(firstplanet, lastplanet);
+
+    const auto [firststation, laststation] = universe.stations(record);
+    system.stations.assign(firststation, laststation);
+
+    return system;
+}
+}
+
+void eo::esi::position_from_json(const json &j, math::vec3 &position)
+{
+    position = to_lightyears(j.at("x"), j.at("y"), j.at("z"));
+}
+
+void eo::esi::planets_from_json(const json &j, std::vector<int32> &planets)
+{
+    planets.clear();
+    for (const auto &planet : j) {
+        planets.push_back(planet.at("planet_id"));
+    }
+}
+
+void eo::esi::stargates_from_json(const json &j, Stargates &stargates)
+{
+    stargates.clear();
+    for (const int32 stargateID : j) {
+        stargates.push_back({ stargateID, 0 });
+    }
+}
+
 eo::EsiSession::EsiSession(const db::SqliteSPtr &mDbConnection, std::shared_ptr<IOState> iostate)
     : mDbConnection(mDbConnection)
     , mIOState(std::move(iostate))
@@ -36,419 +250,461 @@ eo::EsiSession::EsiSession(const db::SqliteSPtr &mDbConnection, std::shared_ptr<
         throw std::logic_error("EsiSession requires a valid iostate");
     }
 
-    TokenData token;
-    // TODO Quite the common case, should not be handled by exception
-    try {
-        token = db::get_latest_tokendata_by_expiredate(mDbConnection);
-        if (token_expired(token)) {
-            refresh_token(token);
-            db::store_in_db(mDbConnection, token);
-        }
-    } catch (const std::runtime_error &re) {
-        log::error("{0}", re.what());
-        log::info("Trying to retrieve a new auth token");
-        const auto cc = make_authorize_request({ "esi-location.read_location.v1" });
-        const auto ac = handle_redirect();
-        const auto tr = make_token_request(ac, cc);
-        const auto vr = verify_token(tr.access_token);
-        token         = make_token_data(tr, vr);
-        db::store_in_db(mDbConnection, token);
-    }
+    mKeys = std::make_shared<jwt::KeySet>(mDbConnection);
 
-    mCurrentToken = std::move(token);
-}
-
-CharacterLocation eo::EsiSession::getCharacterLocation()
-{
-    if (token_expired(mCurrentToken)) {
-        refresh_token(mCurrentToken);
-        db::store_in_db(mDbConnection, mCurrentToken);
+    mStaticUniverse = StaticUniverse::open();
+    if (!mStaticUniverse) {
+        log::info("No static universe snapshot found, systems are fetched from esi");
     }
 
-    HttpRequest request;
-    request.hostname                            = "esi.evetech.net";
-    request.target                              = fmt::format("/v1/characters/{0}/location/", mCurrentToken.characterID);
-    request.headers[http::field::authorization] = fmt::format("Bearer {0}", mCurrentToken.accessToken);
-    const auto response                         = makeHttpRequest(request);
-    const auto j                                = json::parse(response.body);
-
-    CharacterLocation location{};
-    try {
-        j.at("solar_system_id").get_to(location.solarSystemID);
-    } catch (const json::out_of_range &e) {
-        log::error("Missing solar system id for location retrieval");
-        log::error("{0}", response.body);
-        throw e;
+    // Expired tokens get refreshed in the background by the token managers
+    for (auto &token : db::get_latest_tokendata_per_character(mDbConnection)) {
+        addCharacter(std::move(token));
     }
 
-    // TODO Quite the common case, should not be handled by exception
-    try {
-        j.at("station_id").get_to(location.stationID);
-        j.at("structure_id").get_to(location.structureID);
-    } catch (const json::out_of_range &e) {
-        // Did not contain any staion or structure information
+    if (mCharacters.empty()) {
+        log::info("Could not find a token in the database, trying to retrieve a new auth token");
+        login();
     }
+}
 
-    return location;
+eo::EsiSession::~EsiSession()
+{
+    if (mRedirectListener) {
+        mRedirectListener->close();
+    }
 }
 
-void eo::EsiSession::getCharacterLocationAsync(std::function<void(const CharacterLocation &)> callback)
+void eo::EsiSession::login()
 {
-    if (token_expired(mCurrentToken)) {
-        refresh_token(mCurrentToken);
-        db::store_in_db(mDbConnection, mCurrentToken);
+    if (mRedirectListener) {
+        mRedirectListener->close(); // Only the latest attempt counts
     }
 
-    HttpRequest request;
-    request.hostname                            = "esi.evetech.net";
-    request.target                              = fmt::format("/v1/characters/{0}/location/", mCurrentToken.characterID);
-    request.headers[http::field::authorization] = fmt::format("Bearer {0}", mCurrentToken.accessToken);
+    const auto state         = make_oauth_state();
+    const auto codeChallenge = make_authorize_request({ "esi-location.read_location.v1" }, state);
+    mLoginState              = LoginState::WaitingForLogin;
 
-    mIOState->makeAsyncHttpRequest(request, [callback = std::move(callback)](auto &&response, auto &&) {
-        const auto        j = json::parse(response.body);
-        CharacterLocation location{};
-        try {
-            j.at("solar_system_id").get_to(location.solarSystemID);
-        } catch (const json::out_of_range &e) {
-            log::error("Missing solar system id for location retrieval");
-            log::error("{0}", response.body);
-            throw e;
+    const auto handler = [this, state, codeChallenge](const HttpRequest &request, HttpResponse &response) {
+        response.headers[http::field::content_type] = "text/html";
+
+        const auto code = parse_redirect(request, state);
+        if (!code) {
+            response.statusCode = 400;
+            response.body       = "<html><body>Unexpected request, the overlay is still waiting for the login.</body></html>";
+            return false;
+        }
+
+        response.body = "<html><body>You can close this now.</body></html>";
+        exchangeAuthorizationCode(*code, codeChallenge);
+        return true;
+    };
+
+    const auto finished = [this](bool accepted) {
+        mRedirectListener.reset();
+        if (!accepted) {
+            log::error("Login did not finish, retry it from the overlay");
+            mLoginState = LoginState::LoginFailed;
         }
+    };
+
+    mRedirectListener = mIOState->expectAsyncHttpRequest(handler, finished, login_timeout);
+}
 
-        // TODO Quite the common case, should not be handled by exception
+void eo::EsiSession::exchangeAuthorizationCode(const AuthenticationCode &code, const CodeChallenge &codeChallenge)
+{
+    mIOState->makeAsyncHttpRequest(make_token_exchange_request(code, codeChallenge), [this, codeChallenge](auto &&response, auto &&) {
+        TokenRequestResult tr;
+        std::string        kid;
         try {
-            j.at("station_id").get_to(location.stationID);
-            j.at("structure_id").get_to(location.structureID);
-        } catch (const json::out_of_range &e) {
-            // Did not contain any staion or structure information
+            tr  = parse_token_response(response, codeChallenge);
+            kid = jwt::decode(tr.access_token).kid;
+        } catch (const std::exception &e) {
+            log::error("Could not retrieve the auth token: {0}", e.what());
+            mLoginState = LoginState::LoginFailed;
+            return;
         }
 
-        callback(location);
+        mKeys->ensureKeyAsync(kid, *mIOState, [this, tr = std::move(tr)] {
+            TokenData token;
+            try {
+                const auto vr = verify_token(tr.access_token, *mKeys);
+                token         = make_token_data(tr, vr);
+            } catch (const std::exception &e) {
+                log::error("Could not verify the auth token: {0}", e.what());
+                mLoginState = LoginState::LoginFailed;
+                return;
+            }
+
+            log::info("Logged in as {0}", token.characterName);
+            mLoginState = LoginState::Idle;
+
+            if (const auto character = mCharacters.find(token.characterID); character != end(mCharacters)) {
+                character->second->setToken(std::move(token));
+            } else {
+                db::store_in_db(mDbConnection, token);
+                addCharacter(std::move(token));
+            }
+        });
     });
 }
 
-SolarSystem eo::EsiSession::resolveSolarSystem(int32 solarSystemID)
+void eo::EsiSession::addCharacter(TokenData token)
 {
-    SolarSystem system;
-    auto        stmt = db::make_statement(mDbConnection, "SELECT COUNT(*) FROM solarsystem WHERE id = ?;");
-    sqlite3_bind_int(stmt.get(), 1, solarSystemID);
-    sqlite3_step(stmt.get());
-    if (const auto results = sqlite3_column_int(stmt.get(), 0); results == 1) {
-        auto select = db::make_statement(mDbConnection, "SELECT * FROM solarsystem WHERE id = ? LIMIT 1;");
-        sqlite3_bind_int(select.get(), 1, solarSystemID);
-        sqlite3_step(select.get());
-
-        system.systemID        = solarSystemID;
-        system.constellationID = sqlite3_column_int(select.get(), 1);
-        system.name            = db::column_get_string(select.get(), 2);
-        system.planetsJson     = db::column_get_string(select.get(), 3);
-        system.positionJson    = db::column_get_string(select.get(), 4);
-        system.securityClass   = db::column_get_string(select.get(), 5);
-        system.securityStatus  = sqlite3_column_double(select.get(), 6);
-        system.starID          = sqlite3_column_int(select.get(), 7);
-        system.stargatesJson   = db::column_get_string(select.get(), 8);
-        system.stationsJson    = db::column_get_string(select.get(), 9);
-        return system;
-
-    } else if (results == 0) {
-        HttpRequest request;
-        request.hostname = "esi.evetech.net";
-        request.target   = fmt::format("/v4/universe/systems/{0}/", solarSystemID);
+    const auto characterID   = token.characterID;
+    mCharacters[characterID] = std::make_unique<TokenManager>(mDbConnection, mIOState, mKeys, std::move(token));
+
+    for (const auto &listener : mCharacterListeners) {
+        listener(characterID);
+    }
+}
+
+std::vector<eo::int32> eo::EsiSession::getCharacterIDs() const
+{
+    std::vector<int32> ids;
+    ids.reserve(mCharacters.size());
+    for (const auto &[id, tokenmanager] : mCharacters) {
+        ids.push_back(id);
+    }
+    return ids;
+}
 
-        const auto response = makeHttpRequest(request);
-        const auto j        = json::parse(response.body);
+const eo::TokenData *eo::EsiSession::getCharacter(int32 characterID) const
+{
+    const auto character = mCharacters.find(characterID);
+    return character != end(mCharacters) ? &character->second->getToken() : nullptr;
+}
 
-        j.at("constellation_id").get_to(system.constellationID);
-        j.at("name").get_to(system.name);
-        system.planetsJson  = j.at("planets").dump();
-        system.positionJson = j.at("position").dump();
-        j.at("security_class").get_to(system.securityClass);
-        j.at("security_status").get_to(system.securityStatus);
-        j.at("star_id").get_to(system.starID);
-        system.stargatesJson = j.at("stargates").dump();
-        system.stationsJson  = j.at("stations").dump();
-        j.at("system_id").get_to(system.systemID);
+void eo::EsiSession::addCharacterListener(CharacterCallback callback) { mCharacterListeners.push_back(std::move(callback)); }
 
-        assert(solarSystemID == system.systemID);
-    } else {
-        throw std::runtime_error(fmt::format("Found {0} solar systems with the id {1} in the database", results, solarSystemID));
+void eo::EsiSession::getCharacterLocationAsync(int32                                          characterID,
+                                               std::function<void(const CharacterLocation &)> callback,
+                                               CancellationToken                              token)
+{
+    const auto character = mCharacters.find(characterID);
+    if (character == end(mCharacters)) {
+        log::error("Character {0} is not logged in", characterID);
+        return;
     }
 
-    // Store the system in the database
-    stmt = db::make_statement(mDbConnection, "INSERT INTO solarsystem VALUES(?,?,?,?,?,?,?,?,?,?)");
-    sqlite3_bind_int(stmt.get(), 1, system.systemID);
-    sqlite3_bind_int(stmt.get(), 2, system.constellationID);
-    sqlite3_bind_text(stmt.get(), 3, system.name.c_str(), -1, nullptr);
-    sqlite3_bind_text(stmt.get(), 4, system.planetsJson.c_str(), -1, nullptr);
-    sqlite3_bind_text(stmt.get(), 5, system.positionJson.c_str(), -1, nullptr);
-    sqlite3_bind_text(stmt.get(), 6, system.securityClass.c_str(), -1, nullptr);
-    sqlite3_bind_double(stmt.get(), 7, system.securityStatus);
-    sqlite3_bind_int(stmt.get(), 8, system.starID);
-    sqlite3_bind_text(stmt.get(), 9, system.stargatesJson.c_str(), -1, nullptr);
-    sqlite3_bind_text(stmt.get(), 10, system.stationsJson.c_str(), -1, nullptr);
-    sqlite3_step(stmt.get());
+    // Waits for a running token refresh instead of blocking on its own
+    character->second->withToken([this, callback = std::move(callback), cancellation = std::move(token)](const TokenData &token) mutable {
+        if (cancellation.isCancelled()) {
+            return;
+        }
 
-    return system;
+        auto request                                = make_request<CharacterLocation>(token.characterID);
+        request.headers[http::field::authorization] = fmt::format("Bearer {0}", token.accessToken);
+
+        mIOState->makeAsyncHttpRequest(
+            request,
+            [callback = std::move(callback)](auto &&response, auto &&) {
+                if (response.statusCode != 200) {
+                    log::error("Location retrieval failed with status {0}", response.statusCode);
+                    return;
+                }
+
+                CharacterLocation location{};
+                try {
+                    location = parse_entity<CharacterLocation>(json::parse(response.body));
+                } catch (const json::exception &e) {
+                    log::error("Could not parse the character location: {0}", e.what());
+                    log::error("{0}", response.body);
+                    return;
+                }
+                location.expires = get_cache_expiry(response);
+
+                callback(location);
+            },
+            RequestPriority::High, std::move(cancellation));
+    });
 }
 
-void eo::EsiSession::resolveSolarSystemAsync(int32 solarSystemID, std::function<void(const esi::SolarSystem &)> callback)
+void eo::EsiSession::resolveSolarSystemAsync(int32                                         solarSystemID,
+                                             std::function<void(const esi::SolarSystem &)> callback,
+                                             RequestPriority                               priority,
+                                             CancellationToken                             token)
 {
-    auto stmt = db::make_statement(mDbConnection, "SELECT COUNT(*) FROM solarsystem WHERE id = ?;");
-    sqlite3_bind_int(stmt.get(), 1, solarSystemID);
-    sqlite3_step(stmt.get());
-    if (const auto results = sqlite3_column_int(stmt.get(), 0); results == 1) {
-        SolarSystem system;
-        auto        select = db::make_statement(mDbConnection, "SELECT * FROM solarsystem WHERE id = ? LIMIT 1;");
-        sqlite3_bind_int(select.get(), 1, solarSystemID);
-        sqlite3_step(select.get());
-
-        system.systemID        = solarSystemID;
-        system.constellationID = sqlite3_column_int(select.get(), 1);
-        system.name            = db::column_get_string(select.get(), 2);
-        system.planetsJson     = db::column_get_string(select.get(), 3);
-        system.positionJson    = db::column_get_string(select.get(), 4);
-        system.securityClass   = db::column_get_string(select.get(), 5);
-        system.securityStatus  = sqlite3_column_double(select.get(), 6);
-        system.starID          = sqlite3_column_int(select.get(), 7);
-        system.stargatesJson   = db::column_get_string(select.get(), 8);
-        system.stationsJson    = db::column_get_string(select.get(), 9);
-        callback(system);
+    if (token.isCancelled()) {
         return;
+    }
 
-    } else if (results == 0) {
-        HttpRequest request;
-        request.hostname = "esi.evetech.net";
-        request.target   = fmt::format("/v4/universe/systems/{0}/", solarSystemID);
-
-        mIOState->makeAsyncHttpRequest(request, [this, solarSystemID, callback = std::move(callback)](auto &&response, auto &&) {
-            SolarSystem system;
-            const auto  j = json::parse(response.body);
-
-            j.at("constellation_id").get_to(system.constellationID);
-            j.at("name").get_to(system.name);
-            system.planetsJson  = j.at("planets").dump();
-            system.positionJson = j.at("position").dump();
-            j.at("security_class").get_to(system.securityClass);
-            j.at("security_status").get_to(system.securityStatus);
-            j.at("star_id").get_to(system.starID);
-            system.stargatesJson = j.at("stargates").dump();
-            system.stationsJson  = j.at("stations").dump();
-            j.at("system_id").get_to(system.systemID);
-
-            assert(solarSystemID == system.systemID);
-            callback(system);
+    // Static data, no need for the database or a request
+    if (mStaticUniverse) {
+        if (const auto record = mStaticUniverse->findSystem(solarSystemID)) {
+            auto &cache = std::get<EntityStore<SolarSystem>>(mEntities).cache;
+            if (const auto cached = cache.get(solarSystemID)) {
+                callback(*cached);
+                return;
+            }
 
-            // Store the system in the database
-            auto stmt = db::make_statement(mDbConnection, "INSERT INTO solarsystem VALUES(?,?,?,?,?,?,?,?,?,?)");
-            sqlite3_bind_int(stmt.get(), 1, system.systemID);
-            sqlite3_bind_int(stmt.get(), 2, system.constellationID);
-            sqlite3_bind_text(stmt.get(), 3, system.name.c_str(), -1, nullptr);
-            sqlite3_bind_text(stmt.get(), 4, system.planetsJson.c_str(), -1, nullptr);
-            sqlite3_bind_text(stmt.get(), 5, system.positionJson.c_str(), -1, nullptr);
-            sqlite3_bind_text(stmt.get(), 6, system.securityClass.c_str(), -1, nullptr);
-            sqlite3_bind_double(stmt.get(), 7, system.securityStatus);
-            sqlite3_bind_int(stmt.get(), 8, system.starID);
-            sqlite3_bind_text(stmt.get(), 9, system.stargatesJson.c_str(), -1, nullptr);
-            sqlite3_bind_text(stmt.get(), 10, system.stationsJson.c_str(), -1, nullptr);
-            sqlite3_step(stmt.get());
-        });
-    } else {
-        throw std::runtime_error(fmt::format("Found {0} solar systems with the id {1} in the database", results, solarSystemID));
+            auto system = make_solar_system(*mStaticUniverse, *record);
+            cache.put(solarSystemID, system);
+            callback(system);
+            return;
+        }
     }
+
+    resolveEntityAsync(solarSystemID, std::move(callback), priority, std::move(token));
 }
 
-Killmail eo::EsiSession::resolveKillmail(int32 killmailid, const std::string &killmailhash)
+template<typename T, typename... RouteArgs>
+void eo::EsiSession::resolveEntityAsync(int32                          id,
+                                        std::function<void(const T &)> callback,
+                                        RequestPriority                priority,
+                                        CancellationToken              token,
+                                        const RouteArgs &... routeArgs)
 {
-    auto stmt = db::make_statement(mDbConnection, "SELECT COUNT(*) FROM killmail WHERE id = ? AND hash = ?;");
-    sqlite3_bind_int(stmt.get(), 1, killmailid);
-    sqlite3_bind_text(stmt.get(), 2, killmailhash.c_str(), -1, nullptr);
-    sqlite3_step(stmt.get());
-    if (const auto results = sqlite3_column_int(stmt.get(), 0); results == 1) {
-        Killmail km;
-        auto     select
-            = db::make_statement(mDbConnection, "SELECT systemid, attackers, victim, killtime FROM killmail WHERE id = ? AND hash = ?");
-        sqlite3_bind_int(select.get(), 1, killmailid);
-        sqlite3_bind_text(select.get(), 2, killmailhash.c_str(), -1, nullptr);
-        sqlite3_step(select.get());
-        km.killmailID    = killmailid;
-        km.killmailHash  = killmailhash;
-        km.systemID      = sqlite3_column_int(select.get(), 0);
-        km.attackersJson = db::column_get_string(select.get(), 1);
-        km.victimJson    = db::column_get_string(select.get(), 2);
-        km.killTime      = db::column_get_string(select.get(), 3);
-        return km;
-    } else if (results == 0) {
-        Killmail    km;
-        HttpRequest req;
-        req.hostname = "esi.evetech.net";
-        req.target   = fmt::format("/v1/killmails/{0}/{1}/", killmailid, killmailhash);
-
-        const auto response = makeHttpRequest(req);
-        const auto j        = json::parse(response.body);
-        km.killmailID       = killmailid;
-        km.killmailHash     = killmailhash;
-        j.at("solar_system_id").get_to(km.systemID);
-        km.attackersJson = j.at("attackers").dump();
-        km.victimJson    = j.at("victim").dump();
-        km.killTime      = j.at("killmail_time");
-        stmt             = db::make_statement(mDbConnection, "INSERT INTO killmail VALUES(?,?,?,?,?,?)");
-        sqlite3_bind_int(stmt.get(), 1, km.killmailID);
-        sqlite3_bind_text(stmt.get(), 2, km.killmailHash.c_str(), -1, nullptr);
-        sqlite3_bind_int(stmt.get(), 3, km.systemID);
-        sqlite3_bind_text(stmt.get(), 4, km.attackersJson.c_str(), -1, nullptr);
-        sqlite3_bind_text(stmt.get(), 5, km.victimJson.c_str(), -1, nullptr);
-        sqlite3_bind_text(stmt.get(), 6, km.killTime.c_str(), -1, nullptr);
-        sqlite3_step(stmt.get());
-        return km;
-    } else {
-        throw std::runtime_error(fmt::format("Found {0} killmaiml with the id {1} in the database", results, killmailid));
-    }
-}
-
-void eo::EsiSession::resolveKillmailAsync(int32 killmailid, const std::string &killmailhash, std::function<void(const Killmail &)> callback)
-{
-    auto stmt = db::make_statement(mDbConnection, "SELECT COUNT(*) FROM killmail WHERE id = ? AND hash = ?;");
-    sqlite3_bind_int(stmt.get(), 1, killmailid);
-    sqlite3_bind_text(stmt.get(), 2, killmailhash.c_str(), -1, nullptr);
-    sqlite3_step(stmt.get());
-    if (const auto results = sqlite3_column_int(stmt.get(), 0); results == 1) {
-        Killmail km;
-        auto     select
-            = db::make_statement(mDbConnection, "SELECT systemid, attackers, victim, killtime FROM killmail WHERE id = ? AND hash = ?");
-        sqlite3_bind_int(select.get(), 1, killmailid);
-        sqlite3_bind_text(select.get(), 2, killmailhash.c_str(), -1, nullptr);
-        sqlite3_step(select.get());
-        km.killmailID    = killmailid;
-        km.killmailHash  = killmailhash;
-        km.systemID      = sqlite3_column_int(select.get(), 0);
-        km.attackersJson = db::column_get_string(select.get(), 1);
-        km.victimJson    = db::column_get_string(select.get(), 2);
-        km.killTime      = db::column_get_string(select.get(), 3);
-        callback(km);
-    } else if (results == 0) {
-        HttpRequest req;
-        req.hostname = "esi.evetech.net";
-        req.target   = fmt::format("/v1/killmails/{0}/{1}/", killmailid, killmailhash);
+    using Descriptor = Endpoint<T>;
+    auto &store      = std::get<EntityStore<T>>(mEntities);
 
-        mIOState->makeAsyncHttpRequest(
-            req, [this, killmailhash = killmailhash, killmailid, callback = std::move(callback)](auto &&response, auto &&) {
-                Killmail   km;
-                const auto j    = json::parse(response.body);
-                km.killmailID   = killmailid;
-                km.killmailHash = killmailhash;
-                j.at("solar_system_id").get_to(km.systemID);
-                km.attackersJson = j.at("attackers").dump();
-                km.victimJson    = j.at("victim").dump();
-                km.killTime      = j.at("killmail_time");
-                callback(km);
-                auto stmt = db::make_statement(mDbConnection, "INSERT INTO killmail VALUES(?,?,?,?,?,?)");
-                sqlite3_bind_int(stmt.get(), 1, km.killmailID);
-                sqlite3_bind_text(stmt.get(), 2, km.killmailHash.c_str(), -1, nullptr);
-                sqlite3_bind_int(stmt.get(), 3, km.systemID);
-                sqlite3_bind_text(stmt.get(), 4, km.attackersJson.c_str(), -1, nullptr);
-                sqlite3_bind_text(stmt.get(), 5, km.victimJson.c_str(), -1, nullptr);
-                sqlite3_bind_text(stmt.get(), 6, km.killTime.c_str(), -1, nullptr);
-                sqlite3_step(stmt.get());
-            });
-    } else {
-        throw std::runtime_error(fmt::format("Found {0} killmaiml with the id {1} in the database", results, killmailid));
+    if (token.isCancelled()) {
+        return;
+    }
+
+    if (const auto cached = store.cache.get(id); cached && Descriptor::matches(*cached, routeArgs...)) {
+        callback(*cached);
+        return;
+    }
+
+    if constexpr (!Descriptor::table.empty()) {
+        if (auto stored = load_entity<T>(mDbConnection, id); stored && Descriptor::matches(*stored, routeArgs...)) {
+            entityLoaded(*stored, false);
+            store.cache.put(id, *stored);
+            callback(*stored);
+            return;
+        }
     }
+
+    if (!store.pending.add(id, std::move(callback), token)) {
+        // Somebody already requested it, maybe only the prefetcher
+        if (priority == RequestPriority::High) {
+            mIOState->promoteRequest(store.pending.requestToken(id));
+        }
+        return;
+    }
+
+    mIOState->makeAsyncHttpRequest(
+        make_request<T>(id, routeArgs...),
+        [this, id, routeArgs...](auto &&response, auto &&) {
+            auto &store = std::get<EntityStore<T>>(mEntities);
+            if (response.statusCode != 200) {
+                log::error("Could not resolve {0} {1}, status {2}", Descriptor::name, id, response.statusCode);
+                store.pending.discard(id);
+                return;
+            }
+
+            T entity;
+            try {
+                entity = parse_entity<T>(json::parse(response.body));
+            } catch (const json::exception &e) {
+                log::error("Could not resolve {0} {1}: {2}", Descriptor::name, id, e.what());
+                store.pending.discard(id);
+                return;
+            }
+            entity.*Descriptor::id = id;
+            Descriptor::complete(entity, routeArgs...);
+
+            if constexpr (!Descriptor::table.empty()) {
+                store_entity(mDbConnection, entity);
+            }
+
+            entityLoaded(entity, true);
+            store.cache.put(id, entity);
+            store.pending.resolve(id, entity);
+        },
+        priority, store.pending.requestToken(id));
 }
 
-std::vector<ZkbKill> eo::EsiSession::getKillsInSystem(int32 solarsystemid, int limit)
+void eo::EsiSession::entityLoaded(esi::SolarSystem &system, bool requested)
 {
-    HttpRequest req;
-    req.hostname = "zkillboard.com";
-    req.target   = fmt::format("/api/kills/solarSystemID/{0}/", solarsystemid);
+    cacheStargatesAsync(system);
+    if (requested) {
+        mSpatialIndexOutdated = true;
+    }
+}
 
-    const auto response = makeHttpRequest(req);
-    const auto j        = json::parse(response.body);
+void eo::EsiSession::cacheStargatesAsync(esi::SolarSystem &system)
+{
+    std::map<int32, int32> destinations;
+    auto                   stmt = db::make_statement(mDbConnection, "SELECT id, destinationsystemid FROM stargate WHERE systemid = ?;");
+    sqlite3_bind_int(stmt.get(), 1, system.systemID);
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        destinations[sqlite3_column_int(stmt.get(), 0)] = sqlite3_column_int(stmt.get(), 1);
+    }
 
-    std::vector<ZkbKill> kills;
-    kills.reserve(limit);
-    int c = 0;
-    for (auto &&item : j) {
-        if (++c == limit) {
-            break;
+    for (auto &stargate : system.stargates) {
+        if (const auto destination = destinations.find(stargate.stargateID); destination != end(destinations)) {
+            stargate.destinationSystemID = destination->second;
+            continue;
+        }
+        const auto stargateID = stargate.stargateID;
+        if (!mPendingStargates.insert(stargateID).second) {
+            continue;
         }
 
-        ZkbKill k;
-        item.at("killmail_id").get_to(k.killmailID);
-        const auto &zkbdata = item.at("zkb");
-        zkbdata.at("hash").get_to(k.killmailHash);
-        zkbdata.at("fittedValue").get_to(k.fittedValue);
-        zkbdata.at("totalValue").get_to(k.totalValue);
-        zkbdata.at("points").get_to(k.points);
-        zkbdata.at("npc").get_to(k.npc);
-        zkbdata.at("solo").get_to(k.solo);
-        zkbdata.at("awox").get_to(k.awox);
+        HttpRequest request;
+        request.hostname = "esi.evetech.net";
+        request.target   = fmt::format("/v1/universe/stargates/{0}/", stargateID);
+
+        // Only needed for routes, the system itself is more important
+        mIOState->makeAsyncHttpRequest(
+            request,
+            [this, stargateID](auto &&response, auto &&) {
+                mPendingStargates.erase(stargateID);
+
+                int32 systemID, destinationSystemID, destinationStargateID;
+                try {
+                    const auto j = json::parse(response.body);
+                    j.at("system_id").get_to(systemID);
+                    j.at("destination").at("system_id").get_to(destinationSystemID);
+                    j.at("destination").at("stargate_id").get_to(destinationStargateID);
+                } catch (const json::exception &e) {
+                    log::error("Could not resolve stargate {0}: {1}", stargateID, e.what());
+                    return;
+                }
+
+                auto stmt = db::make_statement(mDbConnection, "INSERT OR REPLACE INTO stargate VALUES(?,?,?,?)");
+                sqlite3_bind_int(stmt.get(), 1, stargateID);
+                sqlite3_bind_int(stmt.get(), 2, systemID);
+                sqlite3_bind_int(stmt.get(), 3, destinationSystemID);
+                sqlite3_bind_int(stmt.get(), 4, destinationStargateID);
+                sqlite3_step(stmt.get());
+
+                // Loaded again with the destination next time
+                std::get<EntityStore<SolarSystem>>(mEntities).cache.erase(systemID);
 
-        kills.push_back(std::move(k));
+                // Only a system the graph does not know yet needs a full rebuild
+                if (!mUniverseOutdated && !mUniverse.connect(systemID, destinationSystemID)) {
+                    mUniverseOutdated = true;
+                }
+            },
+            RequestPriority::Low);
     }
+}
 
-    return kills;
+const eo::UniverseGraph &eo::EsiSession::getUniverse()
+{
+    if (mUniverseOutdated) {
+        mUniverse         = mStaticUniverse ? mStaticUniverse->makeGraph() : load_universe_graph(mDbConnection);
+        mUniverseOutdated = false;
+    }
+    return mUniverse;
 }
 
-void eo::EsiSession::getKillsInSystemAsync(int32 solarsystemid, int limit, std::function<void(const std::vector<esi::ZkbKill> &)> callback)
+const eo::SpatialIndex &eo::EsiSession::getSpatialIndex()
 {
-    HttpRequest req;
-    req.hostname = "zkillboard.com";
-    req.target   = fmt::format("/api/kills/solarSystemID/{0}/", solarsystemid);
+    if (mSpatialIndexOutdated) {
+        mSpatialIndex         = mStaticUniverse ? mStaticUniverse->makeSpatialIndex() : load_spatial_index(mDbConnection);
+        mSpatialIndexOutdated = false;
+    }
+    return mSpatialIndex;
+}
 
-    mIOState->makeAsyncHttpRequest(req, [limit, callback = std::move(callback)](auto &&response, auto &&) {
-        const auto j = json::parse(response.body);
+void eo::EsiSession::resolveKillmailAsync(int32                                 killmailid,
+                                          const std::string &                   killmailhash,
+                                          std::function<void(const Killmail &)> callback,
+                                          RequestPriority                       priority,
+                                          CancellationToken                     token)
+{
+    resolveEntityAsync(killmailid, std::move(callback), priority, std::move(token), killmailhash);
+}
 
-        std::vector<ZkbKill> kills;
-        kills.reserve(limit);
-        int c = 0;
-        for (auto &&item : j) {
-            if (++c == limit) {
-                break;
-            }
+void eo::EsiSession::getKillsInSystemAsync(int32                                                  solarsystemid,
+                                           int                                                    limit,
+                                           std::function<void(const std::vector<esi::ZkbKill> &)> callback,
+                                           RequestPriority                                        priority,
+                                           CancellationToken                                      token)
+{
+    if (token.isCancelled()) {
+        return;
+    }
 
-            ZkbKill k;
-            item.at("killmail_id").get_to(k.killmailID);
-            const auto &zkbdata = item.at("zkb");
-            zkbdata.at("hash").get_to(k.killmailHash);
-            zkbdata.at("fittedValue").get_to(k.fittedValue);
-            zkbdata.at("totalValue").get_to(k.totalValue);
-            zkbdata.at("points").get_to(k.points);
-            zkbdata.at("npc").get_to(k.npc);
-            zkbdata.at("solo").get_to(k.solo);
-            zkbdata.at("awox").get_to(k.awox);
-
-            kills.push_back(std::move(k));
+    // Callers might want different amounts of kills, everyone gets the first few of the full list
+    const auto first = [limit, callback = std::move(callback)](const std::vector<ZkbKill> &kills) {
+        if (static_cast<int>(kills.size()) <= limit) {
+            callback(kills);
+        } else {
+            callback(std::vector<ZkbKill>(begin(kills), begin(kills) + limit));
         }
-        callback(kills);
-    });
+    };
+
+    if (const auto cached = mKillLists.get(solarsystemid); cached && std::chrono::steady_clock::now() - cached->fetched < kill_list_ttl) {
+        first(cached->kills);
+        return;
+    }
+
+    if (!mPendingKills.add(solarsystemid, first, token)) {
+        if (priority == RequestPriority::High) {
+            mIOState->promoteRequest(mPendingKills.requestToken(solarsystemid));
+        }
+        return;
+    }
+
+    mIOState->makeAsyncHttpRequest(
+        make_request<ZkbKill>(solarsystemid),
+        [this, solarsystemid](auto &&response, auto &&) {
+            std::vector<ZkbKill> kills;
+            try {
+                kills = parse_entities<ZkbKill>(response.body);
+            } catch (const json::exception &e) {
+                log::error("Could not get the kills in system {0}: {1}", solarsystemid, e.what());
+                mPendingKills.discard(solarsystemid);
+                return;
+            }
+
+            mKillLists.put(solarsystemid, { kills, std::chrono::steady_clock::now() });
+            mPendingKills.resolve(solarsystemid, kills);
+        },
+        priority, mPendingKills.requestToken(solarsystemid));
 }
 
-void eo::EsiSession::convertCharacterIDAsync(int32 characterID, std::function<void(const esi::Character &)> callback)
+void eo::EsiSession::getNewKillsInSystemAsync(int32                                                  solarsystemid,
+                                              int32                                                  afterKillmailID,
+                                              std::chrono::hours                                     past,
+                                              std::function<void(const std::vector<esi::ZkbKill> &)> callback,
+                                              RequestPriority                                        priority,
+                                              CancellationToken                                      token)
 {
+    // zkillboard only takes whole hours up to a week
+    const auto hours = std::clamp<std::chrono::hours::rep>(past.count(), 1, 24 * 7);
+
     HttpRequest req;
-    req.hostname = "esi.evetech.net";
-    req.target   = fmt::format("/v4/characters/{0}/", characterID);
+    req.hostname = "zkillboard.com";
+    req.target   = fmt::format("/api/kills/solarSystemID/{0}/pastSeconds/{1}/", solarsystemid, hours * 3600);
+
+    mIOState->makeAsyncHttpRequest(
+        req,
+        [solarsystemid, afterKillmailID, callback = std::move(callback)](auto &&response, auto &&) {
+            std::vector<ZkbKill> kills;
+            try {
+                kills = parse_entities<ZkbKill>(response.body);
+            } catch (const json::exception &e) {
+                log::error("Could not get the new kills in system {0}: {1}", solarsystemid, e.what());
+                return;
+            }
 
-    mIOState->makeAsyncHttpRequest(std::move(req), [characterID, callback = std::move(callback)](auto &&resp, auto &&) {
-        const auto     j = json::parse(resp.body);
-        esi::Character character;
-        try {
-            j.at("alliance_id").get_to(character.allianceID);
-        } catch (const json::out_of_range &) {
-            character.allianceID = 0;
-        }
-        j.at("corporation_id").get_to(character.corpID);
-        j.at("name").get_to(character.name);
-        j.at("birthday").get_to(character.birthday);
-        j.at("security_status").get_to(character.secStatus);
-        character.characterID = characterID;
+            kills.erase(std::remove_if(begin(kills), end(kills), [afterKillmailID](auto &&k) { return k.killmailID <= afterKillmailID; }),
+                        end(kills));
+            callback(kills);
+        },
+        priority, std::move(token));
+}
 
-        callback(character);
-    });
+void eo::EsiSession::convertCharacterIDAsync(int32                                       characterID,
+                                             std::function<void(const esi::Character &)> callback,
+                                             RequestPriority                             priority,
+                                             CancellationToken                           token)
+{
+    resolveEntityAsync(characterID, std::move(callback), priority, std::move(token));
 }
 
 std::string eo::EsiSession::getTypeName(int32 invtypeid)
 {
+    if (const auto cached = mTypeNames.get(invtypeid)) {
+        return *cached;
+    }
+
     auto stmt = db::make_statement(mDbConnection, "SELECT COUNT(*) FROM invTypes WHERE typeID = ?;");
     sqlite3_bind_int(stmt.get(), 1, invtypeid);
     sqlite3_step(stmt.get());
@@ -459,5 +715,45 @@ std::string eo::EsiSession::getTypeName(int32 invtypeid)
     stmt = db::make_statement(mDbConnection, "SELECT typeName FROM invTypes WHERE typeid = ? LIMIT 1;");
     sqlite3_bind_int(stmt.get(), 1, invtypeid);
     sqlite3_step(stmt.get());
+    auto name = db::column_get_string(stmt.get(), 0);
+    mTypeNames.put(invtypeid, name);
+    return name;
+}
+
+std::string eo::EsiSession::getSystemName(int32 solarsystemid)
+{
+    if (mStaticUniverse) {
+        if (const auto record = mStaticUniverse->findSystem(solarsystemid)) {
+            return std::string(mStaticUniverse->string(record->name));
+        }
+    }
+
+    auto stmt = db::make_statement(mDbConnection, "SELECT name FROM solarsystem WHERE id = ? LIMIT 1;");
+    sqlite3_bind_int(stmt.get(), 1, solarsystemid);
+    if (sqlite3_step(stmt.get()) != SQLITE_ROW) {
+        return {};
+    }
     return db::column_get_string(stmt.get(), 0);
 }
+
+eo::EsiSession::CacheReport eo::EsiSession::getCacheStats() const
+{
+    return { std::get<EntityStore<SolarSystem>>(mEntities).cache.stats(), std::get<EntityStore<Killmail>>(mEntities).cache.stats(),
+             std::get<EntityStore<Character>>(mEntities).cache.stats(), mTypeNames.stats(), mKillLists.stats() };
+}
+
+eo::int32 eo::EsiSession::findSystemID(const std::string &name)
+{
+    if (mStaticUniverse) {
+        if (const auto record = mStaticUniverse->findSystem(std::string_view(name))) {
+            return record->systemID;
+        }
+    }
+
+    auto stmt = db::make_statement(mDbConnection, "SELECT id FROM solarsystem WHERE name = ? COLLATE NOCASE LIMIT 1;");
+    sqlite3_bind_text(stmt.get(), 1, name.c_str(), name.length(), nullptr);
+    if (sqlite3_step(stmt.get()) != SQLITE_ROW) {
+        return 0;
+    }
+    return sqlite3_column_int(stmt.get(), 0);
+}
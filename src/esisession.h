@@ -17,8 +17,17 @@
 #pragma once
 #include "authentication.h"
 #include "db.h"
+#include "esiendpoint.h"
+#include "lrucache.h"
+#include "math.h"
+#include "pendingrequests.h"
 #include "requests.h"
+#include "staticuniverse.h"
+#include "tokenmanager.h"
+#include "universe.h"
 
+#include <map>
+#include <set>
 #include <vector>
 
 namespace eo {
@@ -31,21 +40,39 @@ namespace esi {
         int32 solarSystemID;
         int32 stationID;
         int32 structureID;
+
+        // When esi serves a new location, not set if the response had no Expires header
+        std::optional<std::chrono::steady_clock::time_point> expires;
+
+        [[nodiscard]] bool isDocked() const { return stationID != 0 || structureID != 0; }
+    };
+
+    struct Stargate {
+        int32 stargateID;
+        int32 destinationSystemID; // 0 until the stargate is cached
     };
 
+    // Most systems have less than five stargates
+    using Stargates = boost::container::small_vector<Stargate, 4>;
+
     struct SolarSystem {
-        int32       systemID;
-        int32       constellationID;
-        std::string name;
-        std::string planetsJson;
-        std::string positionJson;
-        std::string securityClass;
-        float       securityStatus;
-        int32       starID;
-        std::string stargatesJson;
-        std::string stationsJson;
+        int32              systemID;
+        int32              constellationID;
+        int32              starID;
+        float              securityStatus;
+        math::vec3         position; // ly
+        std::string        name;
+        std::string        securityClass;
+        Stargates          stargates;
+        std::vector<int32> planets;
+        std::vector<int32> stations;
     };
 
+    // Conversions of the esi responses into the typed members
+    void position_from_json(const nlohmann::json &j, math::vec3 &position);
+    void planets_from_json(const nlohmann::json &j, std::vector<int32> &planets);
+    void stargates_from_json(const nlohmann::json &j, Stargates &stargates);
+
     struct Killmail {
         int32       killmailID;
         std::string killmailHash;
@@ -74,45 +101,253 @@ namespace esi {
         std::string name;
         float       secStatus;
     };
+
+    template<>
+    struct Endpoint<CharacterLocation> : EndpointDefaults {
+        constexpr static std::string_view name  = "character location";
+        constexpr static std::string_view host  = "esi.evetech.net";
+        constexpr static std::string_view route = "/v1/characters/{0}/location/";
+        constexpr static std::string_view table = "";
+
+        constexpr static auto fields = std::make_tuple(value("solar_system_id", &CharacterLocation::solarSystemID),
+                                                       optional_value("station_id", &CharacterLocation::stationID),
+                                                       optional_value("structure_id", &CharacterLocation::structureID));
+    };
+
+    template<>
+    struct Endpoint<SolarSystem> : EndpointDefaults {
+        constexpr static std::string_view name        = "system";
+        constexpr static std::string_view host        = "esi.evetech.net";
+        constexpr static std::string_view route       = "/v4/universe/systems/{0}/";
+        constexpr static std::string_view table       = "solarsystem";
+        constexpr static std::string_view key_column  = "id";
+        constexpr static auto             id          = &SolarSystem::systemID;
+        constexpr static std::size_t      cache_bytes = 2 * 1024 * 1024;
+
+        constexpr static auto fields = std::make_tuple(value("system_id", &SolarSystem::systemID, "id"),
+                                                       value("constellation_id", &SolarSystem::constellationID, "constellationid"),
+                                                       value("name", &SolarSystem::name, "name"),
+                                                       converted("planets", &SolarSystem::planets, &planets_from_json, "planets"),
+                                                       converted("position", &SolarSystem::position, &position_from_json, "position"),
+                                                       value("security_class", &SolarSystem::securityClass, "secclass"),
+                                                       value("security_status", &SolarSystem::securityStatus, "secstatus"),
+                                                       value("star_id", &SolarSystem::starID, "starid"),
+                                                       converted("stargates", &SolarSystem::stargates, &stargates_from_json, "stargates"),
+                                                       optional_value("stations", &SolarSystem::stations, "stations"));
+    };
+
+    template<>
+    struct Endpoint<Killmail> : EndpointDefaults {
+        constexpr static std::string_view name        = "killmail";
+        constexpr static std::string_view host        = "esi.evetech.net";
+        constexpr static std::string_view route       = "/v1/killmails/{0}/{1}/";
+        constexpr static std::string_view table       = "killmail";
+        constexpr static std::string_view key_column  = "id";
+        constexpr static auto             id          = &Killmail::killmailID;
+        constexpr static std::size_t      cache_bytes = 8 * 1024 * 1024;
+
+        constexpr static auto fields = std::make_tuple(from_request(&Killmail::killmailID, "id"),
+                                                       from_request(&Killmail::killmailHash, "hash"),
+                                                       value("solar_system_id", &Killmail::systemID, "systemid"),
+                                                       raw_json("attackers", &Killmail::attackersJson, "attackers"),
+                                                       raw_json("victim", &Killmail::victimJson, "victim"),
+                                                       value("killmail_time", &Killmail::killTime, "killtime"));
+
+        static void complete(Killmail &km, const std::string &hash) { km.killmailHash = hash; }
+        static bool matches(const Killmail &km, const std::string &hash) { return km.killmailHash == hash; }
+    };
+
+    template<>
+    struct Endpoint<ZkbKill> : EndpointDefaults {
+        constexpr static std::string_view name  = "kill list";
+        constexpr static std::string_view host  = "zkillboard.com";
+        constexpr static std::string_view route = "/api/kills/solarSystemID/{0}/";
+        constexpr static std::string_view table = "";
+
+        constexpr static auto fields = std::make_tuple(value("killmail_id", &ZkbKill::killmailID),
+                                                       nested("zkb", "hash", &ZkbKill::killmailHash),
+                                                       nested("zkb", "fittedValue", &ZkbKill::fittedValue),
+                                                       nested("zkb", "totalValue", &ZkbKill::totalValue),
+                                                       nested("zkb", "points", &ZkbKill::points),
+                                                       nested("zkb", "npc", &ZkbKill::npc),
+                                                       nested("zkb", "solo", &ZkbKill::solo),
+                                                       nested("zkb", "awox", &ZkbKill::awox));
+    };
+
+    template<>
+    struct Endpoint<Character> : EndpointDefaults {
+        constexpr static std::string_view name        = "character";
+        constexpr static std::string_view host        = "esi.evetech.net";
+        constexpr static std::string_view route       = "/v4/characters/{0}/";
+        constexpr static std::string_view table       = "";
+        constexpr static auto             id          = &Character::characterID;
+        constexpr static std::size_t      cache_bytes = 1024 * 1024;
+
+        constexpr static auto fields = std::make_tuple(optional_value("alliance_id", &Character::allianceID),
+                                                       value("corporation_id", &Character::corpID),
+                                                       value("name", &Character::name),
+                                                       value("birthday", &Character::birthday),
+                                                       value("security_status", &Character::secStatus));
+    };
 }
 
 /*
  * Handle esi request which require authentication
+ *  - Holds the tokens of all logged in characters
+ *  - The io state, database and in flight requests are shared between the characters
  */
 class EsiSession {
 public:
-    // Loads the token or make the authentication routine
-    // TODO No mutly character support here
-    explicit EsiSession(const db::SqliteSPtr &dbconnection, std::shared_ptr<IOState> iostate);
+    enum class LoginState { Idle, WaitingForLogin, LoginFailed };
+
+    using CharacterCallback = std::function<void(int32 characterID)>;
+
+    constexpr static auto login_timeout = std::chrono::minutes(5);
+
+    // zkillboard caches the kill lists for some minutes as well
+    constexpr static auto        kill_list_ttl     = std::chrono::minutes(2);
+    constexpr static std::size_t cached_kill_lists = 64;
+
+    // The entities of the endpoints bring their own budget
+    constexpr static std::size_t type_name_cache_bytes = 256 * 1024;
+
+    struct CacheReport {
+        CacheStats systems;
+        CacheStats killmails;
+        CacheStats characters;
+        CacheStats typeNames;
+        CacheStats killLists;
+    };
 
-    // Looks up in the database if no entry then does and http request
-    [[deprecated]] esi::CharacterLocation getCharacterLocation();
+    // Loads the tokens of all known characters or starts the authentication routine in the background
+    explicit EsiSession(const db::SqliteSPtr &dbconnection, std::shared_ptr<IOState> iostate);
+    ~EsiSession();
 
-    void getCharacterLocationAsync(std::function<void(const esi::CharacterLocation &)> callback);
+    // Opens the sso login in the browser and waits for the redirect without blocking.
+    // The logged in character gets added or its token replaced
+    void                     login();
+    [[nodiscard]] LoginState getLoginState() const { return mLoginState; }
 
-    [[deprecated]] esi::SolarSystem resolveSolarSystem(int32 soalarSystemID);
+    [[nodiscard]] std::vector<int32> getCharacterIDs() const;
+    // nullptr if the character is not logged in
+    [[nodiscard]] const TokenData *getCharacter(int32 characterID) const;
+    // Gets called for every character which is added after the call
+    void addCharacterListener(CharacterCallback callback);
 
-    void resolveSolarSystemAsync(int32 soalarSystemID, std::function<void(const esi::SolarSystem &)> callback);
+    // The *Async methods drop the callback of a cancelled token, a request is cancelled once no caller waits for it anymore
+    void getCharacterLocationAsync(int32                                               characterID,
+                                   std::function<void(const esi::CharacterLocation &)> callback,
+                                   CancellationToken                                   token = {});
 
-    [[deprecated]] esi::Killmail resolveKillmail(int32 killmailid, const std::string &killmailhash);
+    // Calls back right away if the system is part of the static universe or cached
+    void resolveSolarSystemAsync(int32                                         soalarSystemID,
+                                 std::function<void(const esi::SolarSystem &)> callback,
+                                 RequestPriority                               priority = RequestPriority::High,
+                                 CancellationToken                             token    = {});
 
-    void resolveKillmailAsync(int32 killmailid, const std::string &killmailhash, std::function<void(const esi::Killmail &)> callback);
+    void resolveKillmailAsync(int32                                      killmailid,
+                              const std::string &                        killmailhash,
+                              std::function<void(const esi::Killmail &)> callback,
+                              RequestPriority                            priority = RequestPriority::High,
+                              CancellationToken                          token    = {});
 
-    [[deprecated]] std::vector<esi::ZkbKill> getKillsInSystem(int32 solarsystemid, int limit);
+    // Calls back right away if the kill list was fetched in the last kill_list_ttl
+    void getKillsInSystemAsync(int32                                                  solarsystemid,
+                               int                                                    limit,
+                               std::function<void(const std::vector<esi::ZkbKill> &)> callback,
+                               RequestPriority                                        priority = RequestPriority::High,
+                               CancellationToken                                      token    = {});
 
-    void getKillsInSystemAsync(int32 solarsystemid, int limit, std::function<void(const std::vector<esi::ZkbKill> &)> callback);
+    // Only the kills with a higher id than afterKillmailID from the last hours, not cached or coalesced
+    void getNewKillsInSystemAsync(int32                                                  solarsystemid,
+                                  int32                                                  afterKillmailID,
+                                  std::chrono::hours                                     past,
+                                  std::function<void(const std::vector<esi::ZkbKill> &)> callback,
+                                  RequestPriority                                        priority = RequestPriority::High,
+                                  CancellationToken                                      token    = {});
 
-    void convertCharacterIDAsync(int32 characterid, std::function<void(const esi::Character &)> callback);
+    void convertCharacterIDAsync(int32                                       characterid,
+                                 std::function<void(const esi::Character &)> callback,
+                                 RequestPriority                             priority = RequestPriority::High,
+                                 CancellationToken                           token    = {});
 
     std::string getTypeName(int32 invtypeid);
+    // Empty if the system is not cached
+    std::string getSystemName(int32 solarsystemid);
+    // 0 if there is no cached system with the name
+    int32 findSystemID(const std::string &name);
+
+    // The stargate network of the static universe.
+    // Without a snapshot the one of all cached systems, rebuilt when new stargates got cached
+    const UniverseGraph &getUniverse();
+    // Positions of the static universe or of all cached systems
+    const SpatialIndex &getSpatialIndex();
 
+    [[nodiscard]] CacheReport    getCacheStats() const;
     [[nodiscard]] db::SqliteSPtr getDbConnection() const { return mDbConnection; }
     IOState &                    getIOState() { return *mIOState; }
 
 private:
-    // Make sure this is alwasys valid
-    // Invariant: Valid token which might be expired
-    TokenData mCurrentToken;
+    void exchangeAuthorizationCode(const AuthenticationCode &code, const CodeChallenge &codeChallenge);
+    void addCharacter(TokenData token);
+    // Fills in the cached stargate destinations and fetches the ones which are not cached yet
+    void cacheStargatesAsync(esi::SolarSystem &system);
+
+    // Memory cache, database and request of an entity described by an esi::Endpoint
+    template<typename T, typename... RouteArgs>
+    void resolveEntityAsync(int32                          id,
+                            std::function<void(const T &)> callback,
+                            RequestPriority                priority,
+                            CancellationToken              token,
+                            const RouteArgs &... routeArgs);
+
+    // Called for every entity loaded from the database or esi
+    template<typename T>
+    void entityLoaded(T &, bool /*requested*/)
+    {
+    }
+    void entityLoaded(esi::SolarSystem &system, bool requested);
+
+    std::map<int32, std::unique_ptr<TokenManager>> mCharacters;
+    std::vector<CharacterCallback>                 mCharacterListeners;
+    std::shared_ptr<jwt::KeySet>                   mKeys;
+
+    LoginState                    mLoginState = LoginState::Idle;
+    std::shared_ptr<HttpListener> mRedirectListener;
+
+    // Requests for the same entity are only made once, no matter how many characters want it
+    PendingRequests<int32, std::vector<esi::ZkbKill>> mPendingKills;
+    std::set<int32>                                   mPendingStargates;
+
+    struct CachedKills {
+        std::vector<esi::ZkbKill>             kills;
+        std::chrono::steady_clock::time_point fetched;
+    };
+    struct KillListWeight {
+        std::size_t operator()(const CachedKills &c) const { return sizeof(c) + c.kills.capacity() * sizeof(esi::ZkbKill); }
+    };
+    LruCache<int32, CachedKills, KillListWeight> mKillLists{ cached_kill_lists };
+
+    // The coalesced requests and the cache in front of the database of every entity.
+    // The caches are written through on every database read or request, so hot entities never touch the database
+    constexpr static auto unbounded = std::numeric_limits<std::size_t>::max();
+
+    template<typename T>
+    struct EntityStore {
+        PendingRequests<int32, T>             pending;
+        LruCache<int32, T, esi::EntityWeight> cache{ unbounded, esi::Endpoint<T>::cache_bytes };
+    };
+    std::tuple<EntityStore<esi::SolarSystem>, EntityStore<esi::Killmail>, EntityStore<esi::Character>> mEntities;
+
+    LruCache<int32, std::string, esi::EntityWeight> mTypeNames{ unbounded, type_name_cache_bytes };
+
+    // nullptr if there is no snapshot, then systems are fetched from esi and cached
+    std::unique_ptr<StaticUniverse> mStaticUniverse;
+
+    UniverseGraph mUniverse;
+    bool          mUniverseOutdated = true;
+    SpatialIndex  mSpatialIndex;
+    bool          mSpatialIndexOutdated = true;
 
     // We keep a connection alive
     db::SqliteSPtr mDbConnection;
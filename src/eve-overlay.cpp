@@ -18,9 +18,14 @@
 #include "base64.h"
 #include "db.h"
 #include "esisession.h"
+#include "framescheduler.h"
 #include "imguiwindow.h"
+#include "killhistory.h"
+#include "locationpoller.h"
 #include "logging.h"
+#include "prefetcher.h"
 #include "requests.h"
+#include "systemactivity.h"
 #include "systeminfowindow.h"
 #include <iostream>
 
@@ -32,17 +37,17 @@ using json = nlohmann::json;
 int main()
 {
     eo::scope_exit exit([] { terminateGlfw(); });
-    auto           iostate = std::make_shared<eo::IOState>();
-    auto           conn    = eo::db::make_database_connection();
-    auto           session = std::make_shared<eo::EsiSession>(conn, iostate);
-
-    eo::SystemInfoWindow window(session);
-
-    while (!window.shouldWindowClose()) {
-        window.pollEvents();
-        window.frame();
-        iostate->pollIoC();
-    }
+    auto           iostate  = std::make_shared<eo::IOState>();
+    auto           conn     = eo::db::make_database_connection();
+    auto           session  = std::make_shared<eo::EsiSession>(conn, iostate);
+    auto           poller   = std::make_shared<eo::LocationPoller>(session);
+    auto           activity = std::make_shared<eo::SystemActivity>(conn, iostate);
+    auto           history  = std::make_shared<eo::KillHistory>(conn, session, iostate);
+    eo::Prefetcher prefetcher(session, *poller);
+
+    eo::FrameScheduler scheduler(iostate);
+    scheduler.openWindow<eo::SystemInfoWindow>(session, poller, activity, history);
+    scheduler.run();
 
     return 0;
 }
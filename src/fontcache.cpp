@@ -0,0 +1,191 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fontcache.h"
+#include "logging.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+
+namespace {
+// FNV-1a, only has to tell different fonts apart
+constexpr eo::uint64 fnv_offset = 14695981039346656037ull;
+constexpr eo::uint64 fnv_prime  = 1099511628211ull;
+
+eo::uint64 hash_bytes(eo::uint64 hash, const void *data, std::size_t size)
+{
+    const auto *bytes = static_cast<const eo::byte *>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * fnv_prime;
+    }
+    return hash;
+}
+
+template<typename T>
+eo::uint64 hash_value(eo::uint64 hash, const T &value)
+{
+    return hash_bytes(hash, &value, sizeof(value));
+}
+
+template<typename T>
+void write_records(std::ofstream &ofs, const std::vector<T> &records)
+{
+    ofs.write(reinterpret_cast<const char *>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(T)));
+}
+}
+
+eo::uint64 eo::FontAtlasCache::key(const std::vector<FontSource> &sources)
+{
+    auto hash = hash_value(fnv_offset, version);
+    hash      = hash_bytes(hash, IMGUI_VERSION, std::strlen(IMGUI_VERSION));
+
+    for (const auto &source : sources) {
+        std::ifstream ifs(source.path, std::ios::binary);
+        if (!ifs) {
+            throw std::logic_error(fmt::format("Could not load/find font file: {0}", source.path));
+        }
+        const std::string contents{ std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+
+        hash = hash_bytes(hash, contents.data(), contents.size());
+        hash = hash_value(hash, source.size);
+        hash = hash_value(hash, source.merge);
+        hash = hash_value(hash, source.pixelSnap);
+        for (const auto *range = source.ranges; range && *range; ++range) {
+            hash = hash_value(hash, *range);
+        }
+    }
+
+    return hash;
+}
+
+std::unique_ptr<eo::FontAtlasCache> eo::FontAtlasCache::open(const std::string &path, uint64 key)
+{
+    std::unique_ptr<FontAtlasCache> cache{ new FontAtlasCache(path) };
+    if (!cache->mFile || cache->mFile.size() < sizeof(Header)) {
+        return nullptr;
+    }
+
+    const auto *data   = cache->mFile.data();
+    const auto *header = reinterpret_cast<const Header *>(data);
+    cache->mHeader     = header;
+    if (std::memcmp(header->magic, "EOFA", 4) != 0 || header->version != version || header->key != key) {
+        log::info("The font atlas cache is outdated, rebuilding it");
+        return nullptr;
+    }
+
+    const auto pixel_bytes = static_cast<std::size_t>(header->width) * header->height * 4;
+    if (cache->mFile.size() != sizeof(Header) + header->fontCount * sizeof(Font) + header->glyphCount * sizeof(Glyph) + pixel_bytes) {
+        log::error("{0} is truncated or corrupt", path);
+        return nullptr;
+    }
+
+    cache->mFonts  = reinterpret_cast<const Font *>(data + sizeof(Header));
+    cache->mGlyphs = reinterpret_cast<const Glyph *>(cache->mFonts + header->fontCount);
+    cache->mPixels = reinterpret_cast<const byte *>(cache->mGlyphs + header->glyphCount);
+
+    for (uint32 i = 0; i < header->fontCount; ++i) {
+        const auto &font = cache->mFonts[i];
+        if (font.firstGlyph + font.glyphCount > header->glyphCount) {
+            log::error("{0} is truncated or corrupt", path);
+            return nullptr;
+        }
+    }
+
+    return cache;
+}
+
+void eo::FontAtlasCache::store(const std::string &path, uint64 key, ImFontAtlas &atlas)
+{
+    byte *pixels;
+    int   width, height;
+    atlas.GetTexDataAsRGBA32(&pixels, &width, &height);
+
+    Header             header{ { 'E', 'O', 'F', 'A' }, version, key, static_cast<uint32>(width), static_cast<uint32>(height), 0, 0,
+                   atlas.TexUvWhitePixel.x, atlas.TexUvWhitePixel.y };
+    std::vector<Font>  fonts;
+    std::vector<Glyph> glyphs;
+
+    for (const ImFont *font : atlas.Fonts) {
+        fonts.push_back({ font->FontSize, font->Ascent, font->Descent, static_cast<uint32>(font->FallbackChar),
+                          static_cast<uint32>(glyphs.size()), static_cast<uint32>(font->Glyphs.Size) });
+
+        for (const auto &glyph : font->Glyphs) {
+            glyphs.push_back({ static_cast<uint32>(glyph.Codepoint), glyph.AdvanceX, glyph.X0, glyph.Y0, glyph.X1, glyph.Y1, glyph.U0,
+                               glyph.V0, glyph.U1, glyph.V1 });
+        }
+    }
+
+    header.fontCount  = static_cast<uint32>(fonts.size());
+    header.glyphCount = static_cast<uint32>(glyphs.size());
+
+    // Written next to it and moved, a crash while writing must not leave a corrupt cache behind
+    const auto    tmppath = path + ".tmp";
+    std::ofstream ofs(tmppath, std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    write_records(ofs, fonts);
+    write_records(ofs, glyphs);
+    ofs.write(reinterpret_cast<const char *>(pixels), static_cast<std::streamsize>(width) * height * 4);
+    ofs.close();
+
+    if (!ofs || std::rename(tmppath.c_str(), path.c_str()) != 0) {
+        log::error("Could not write the font atlas cache {0}", path);
+        std::remove(tmppath.c_str());
+    }
+}
+
+void eo::FontAtlasCache::restore(ImFontAtlas &atlas) const
+{
+    for (uint32 i = 0; i < mHeader->fontCount; ++i) {
+        const auto &cached = mFonts[i];
+
+        // The atlas deletes its fonts with IM_DELETE
+        auto *font           = IM_NEW(ImFont);
+        font->FontSize       = cached.size;
+        font->Ascent         = cached.ascent;
+        font->Descent        = cached.descent;
+        font->FallbackChar   = static_cast<ImWchar>(cached.fallbackChar);
+        font->ContainerAtlas = &atlas;
+
+        for (uint32 g = cached.firstGlyph; g < cached.firstGlyph + cached.glyphCount; ++g) {
+            const auto &cachedglyph = mGlyphs[g];
+
+            ImFontGlyph glyph{};
+            glyph.Codepoint = static_cast<ImWchar>(cachedglyph.codepoint);
+            glyph.AdvanceX  = cachedglyph.advanceX;
+            glyph.X0        = cachedglyph.x0;
+            glyph.Y0        = cachedglyph.y0;
+            glyph.X1        = cachedglyph.x1;
+            glyph.Y1        = cachedglyph.y1;
+            glyph.U0        = cachedglyph.u0;
+            glyph.V0        = cachedglyph.v0;
+            glyph.U1        = cachedglyph.u1;
+            glyph.V1        = cachedglyph.v1;
+            font->Glyphs.push_back(glyph);
+        }
+
+        font->BuildLookupTable();
+        atlas.Fonts.push_back(font);
+    }
+
+    atlas.TexWidth        = static_cast<int>(mHeader->width);
+    atlas.TexHeight       = static_cast<int>(mHeader->height);
+    atlas.TexUvScale      = ImVec2(1.f / atlas.TexWidth, 1.f / atlas.TexHeight);
+    atlas.TexUvWhitePixel = ImVec2(mHeader->whitePixelU, mHeader->whitePixelV);
+}
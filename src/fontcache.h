@@ -0,0 +1,103 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "util.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "imgui.h"
+
+namespace eo {
+
+// A font file and how it gets rasterized into the atlas
+struct FontSource {
+    std::string    path;
+    float          size;
+    const ImWchar *ranges    = nullptr; // The default ranges of imgui if nullptr
+    bool           merge     = false;   // Into the previous font
+    bool           pixelSnap = false;
+};
+
+/*
+ * The rasterized font atlas of a previous launch, stored in the data folder.
+ * Holds the pixels and glyph tables as they were built and is mapped into memory as is.
+ * Keyed by the contents of the font files and how they get rasterized, a different key means rebuilding.
+ */
+class FontAtlasCache {
+public:
+    constexpr static uint32 version = 1;
+
+    struct Header {
+        char   magic[4];
+        uint32 version;
+        uint64 key;
+        uint32 width, height;
+        uint32 fontCount;
+        uint32 glyphCount;
+        float  whitePixelU, whitePixelV;
+    };
+
+    struct Font {
+        float  size;
+        float  ascent, descent;
+        uint32 fallbackChar;
+        uint32 firstGlyph, glyphCount;
+    };
+
+    struct Glyph {
+        uint32 codepoint;
+        float  advanceX;
+        float  x0, y0, x1, y1;
+        float  u0, v0, u1, v1;
+    };
+
+    // Hashes the font files, throws if one of them does not exist
+    static uint64 key(const std::vector<FontSource> &sources);
+
+    // nullptr if there is no cache or it was built for another key
+    static std::unique_ptr<FontAtlasCache> open(const std::string &path, uint64 key);
+    // The atlas has to be built and still hold its rgba pixels
+    static void store(const std::string &path, uint64 key, ImFontAtlas &atlas);
+
+    FontAtlasCache(const FontAtlasCache &) = delete;
+    FontAtlasCache &operator=(const FontAtlasCache &) = delete;
+
+    // Recreates the fonts in an empty atlas without rasterizing anything, the texture is up to the caller
+    void restore(ImFontAtlas &atlas) const;
+
+    [[nodiscard]] const byte *pixels() const { return mPixels; } // rgba
+    [[nodiscard]] int         width() const { return static_cast<int>(mHeader->width); }
+    [[nodiscard]] int         height() const { return static_cast<int>(mHeader->height); }
+
+private:
+    explicit FontAtlasCache(const std::string &path)
+        : mFile(path)
+    {
+    }
+
+    MappedFile mFile;
+
+    const Header *mHeader = nullptr;
+    const Font *  mFonts  = nullptr;
+    const Glyph * mGlyphs = nullptr;
+    const byte *  mPixels = nullptr;
+};
+
+static_assert(sizeof(FontAtlasCache::Header) == 40);
+}
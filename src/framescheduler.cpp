@@ -0,0 +1,95 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "framescheduler.h"
+
+#include <algorithm>
+
+namespace {
+double seconds(std::chrono::milliseconds duration) { return std::chrono::duration<double>(duration).count(); }
+}
+
+eo::FrameScheduler::FrameScheduler(std::shared_ptr<IOState> iostate, FrameLimits limits)
+    : mIOState(std::move(iostate))
+    , mLimits(limits)
+{
+}
+
+void eo::FrameScheduler::run()
+{
+    while (!mWindows.empty()) {
+        step();
+    }
+}
+
+void eo::FrameScheduler::step()
+{
+    const auto before = DisplayWindow::getTime();
+    DisplayWindow::waitEvents(std::max(nextWakeup(before) - before, 0.));
+
+    // Whatever the handlers changed has to be shown
+    if (mIOState->pollIoC() > 0) {
+        for (auto &window : mWindows) {
+            window->requestFrame();
+        }
+    }
+
+    mWindows.erase(std::remove_if(begin(mWindows), end(mWindows), [](auto &window) { return window->shouldWindowClose(); }),
+                   end(mWindows));
+
+    const auto now = DisplayWindow::getTime();
+    mDue.clear();
+    for (auto &window : mWindows) {
+        if (window->isVisible() && nextFrame(*window, now) <= now) {
+            mDue.push_back(window.get());
+        }
+    }
+
+    // The context of the last frame is still current, rendering its window first saves one switch
+    std::stable_partition(begin(mDue), end(mDue), [](auto *window) { return window->isCurrent(); });
+    for (auto *window : mDue) {
+        window->frame();
+    }
+}
+
+double eo::FrameScheduler::frameInterval(const DisplayWindow &window, double now) const
+{
+    const bool active = now - window.getLastInputTime() < seconds(mLimits.activePeriod);
+    return 1. / (active ? mLimits.activeFps : mLimits.idleFps);
+}
+
+double eo::FrameScheduler::nextFrame(const DisplayWindow &window, double now) const
+{
+    const auto last     = window.getLastFrameTime();
+    const auto earliest = last + frameInterval(window, now);
+    if (window.wantsFrame(now)) {
+        return earliest;
+    }
+    return std::max(std::min(window.getFrameDeadline(), last + seconds(mLimits.refreshInterval)), earliest);
+}
+
+double eo::FrameScheduler::nextWakeup(double now) const
+{
+    const bool busy   = mIOState->getRequestsInFlight() > 0 || mIOState->getQueuedRequests() > 0;
+    auto       wakeup = now + seconds(busy ? mLimits.busyIoInterval : mLimits.idleIoInterval);
+    for (const auto &window : mWindows) {
+        // Restoring a window is an event, it does not need a wakeup until then
+        if (window->isVisible()) {
+            wakeup = std::min(wakeup, nextFrame(*window, now));
+        }
+    }
+    return wakeup;
+}
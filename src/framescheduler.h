@@ -0,0 +1,73 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "displaywindow.h"
+#include "requests.h"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace eo {
+
+// Maximum frame rates and how often the io is polled
+struct FrameLimits {
+    double                    activeFps       = 60.;
+    double                    idleFps         = 10.;
+    std::chrono::milliseconds activePeriod    = std::chrono::seconds(1); // After the last input
+    std::chrono::milliseconds busyIoInterval  = std::chrono::milliseconds(5);
+    std::chrono::milliseconds idleIoInterval  = std::chrono::milliseconds(100); // Timers and the login listener
+    std::chrono::milliseconds refreshInterval = std::chrono::seconds(1);        // Keeps times and refreshes of the ui going
+};
+
+/*
+ * Owns the windows and runs the main loop without busy polling:
+ *  - Sleeps until input arrives, a window wants a frame or the io has to be polled
+ *  - Windows only render when they requested a frame, after input or when io handlers ran
+ *  - Frames are limited per window, to the active fps shortly after its input and to the idle fps otherwise
+ *  - Iconified and hidden windows are skipped, closed ones get destroyed
+ * The io runs on this thread as well, it is polled often while requests are in flight and rarely otherwise.
+ */
+class FrameScheduler {
+public:
+    explicit FrameScheduler(std::shared_ptr<IOState> iostate, FrameLimits limits = {});
+
+    template<typename Window, typename... Args>
+    Window &openWindow(Args &&... args)
+    {
+        auto  window = std::make_unique<Window>(std::forward<Args>(args)...);
+        auto &opened = *window;
+        mWindows.push_back(std::move(window));
+        return opened;
+    }
+
+    // Until every window is closed
+    void run();
+    // Waits once and renders the windows which are due
+    void step();
+
+private:
+    [[nodiscard]] double frameInterval(const DisplayWindow &window, double now) const;
+    [[nodiscard]] double nextFrame(const DisplayWindow &window, double now) const;
+    [[nodiscard]] double nextWakeup(double now) const;
+
+    std::shared_ptr<IOState>                    mIOState;
+    FrameLimits                                 mLimits;
+    std::vector<std::unique_ptr<DisplayWindow>> mWindows;
+    std::vector<DisplayWindow *>                mDue; // Reused by every step
+};
+}
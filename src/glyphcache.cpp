@@ -0,0 +1,232 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "glyphcache.h"
+#include "logging.h"
+
+#include "glad/glad.h"
+#include "imgui_internal.h"
+
+#include <algorithm>
+#include <cmath>
+
+// imgui compiles its copy of stb_truetype static, so this unit needs its own
+#define STBTT_STATIC
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "imstb_truetype.h"
+
+namespace {
+// Room for a full width cjk glyph and its bearing at the font size
+int slot_size(float font_size) { return static_cast<int>(std::ceil(font_size * 1.5f)); }
+}
+
+struct eo::GlyphCache::Source {
+    explicit Source(const std::string &path)
+        : file(path)
+    {
+    }
+
+    MappedFile     file;
+    stbtt_fontinfo info{};
+};
+
+int eo::GlyphCache::reservedHeight(float fontSize) { return slot_rows * slot_size(fontSize); }
+
+eo::GlyphCache::GlyphCache(ImFontAtlas &atlas, uint texture, const std::vector<std::string> &fontPaths)
+    : mFont(*atlas.Fonts[0])
+    , mTexture(texture)
+    , mTextureWidth(atlas.TexWidth)
+    , mTextureHeight(atlas.TexHeight + reservedHeight(mFont.FontSize))
+    , mSlotSize(slot_size(mFont.FontSize))
+    , mFirstRow(atlas.TexHeight)
+    , mColumns(static_cast<std::size_t>(atlas.TexWidth / mSlotSize))
+    , mSlots(mColumns * slot_rows)
+{
+    // The v coordinates of the prebuilt glyphs are relative to the prebuilt height
+    const float vscale = static_cast<float>(atlas.TexHeight) / mTextureHeight;
+    for (ImFont *font : atlas.Fonts) {
+        for (auto &glyph : font->Glyphs) {
+            glyph.V0 *= vscale;
+            glyph.V1 *= vscale;
+        }
+    }
+    atlas.TexUvWhitePixel.y *= vscale;
+    atlas.TexHeight  = mTextureHeight;
+    atlas.TexUvScale = ImVec2(1.f / mTextureWidth, 1.f / mTextureHeight);
+
+    // Mapped, only the pages of the glyphs which are actually used get read
+    for (const auto &path : fontPaths) {
+        auto source = std::make_unique<Source>(path);
+        if (!source->file) {
+            continue;
+        }
+
+        const int offset = stbtt_GetFontOffsetForIndex(source->file.data(), 0);
+        if (offset < 0 || !stbtt_InitFont(&source->info, source->file.data(), offset)) {
+            log::error("Could not load the font {0} for missing glyphs", path);
+            continue;
+        }
+
+        mSources.push_back(std::move(source));
+    }
+}
+
+eo::GlyphCache::~GlyphCache() = default;
+
+void eo::GlyphCache::require(std::string_view text)
+{
+    const char *it       = text.data();
+    const char *text_end = text.data() + text.size();
+    while (it < text_end) {
+        uint codepoint = 0;
+        it += ImTextCharFromUtf8(&codepoint, it, text_end);
+
+        // ImWchar only holds the basic multilingual plane
+        if (codepoint > 0 && codepoint < 0x10000) {
+            use(static_cast<ImWchar>(codepoint));
+        }
+    }
+
+    rebuildLookup();
+}
+
+void eo::GlyphCache::newFrame()
+{
+    ++mFrame;
+
+    for (const ImWchar codepoint : mQueued) {
+        use(codepoint);
+    }
+    mQueued.clear();
+
+    rebuildLookup();
+}
+
+void eo::GlyphCache::use(ImWchar codepoint)
+{
+    const auto cached = mCached.find(codepoint);
+    if (cached != end(mCached)) {
+        mSlots[cached->second].lastUse = mFrame;
+        return;
+    }
+
+    if (codepoint < 0x80 || mUnavailable.count(codepoint) > 0 || mFont.FindGlyphNoFallback(codepoint)) {
+        return;
+    }
+
+    if (!rasterize(codepoint)) {
+        mUnavailable.insert(codepoint);
+    }
+}
+
+void eo::GlyphCache::rebuildLookup()
+{
+    if (mDirty) {
+        mFont.BuildLookupTable();
+        mDirty = false;
+    }
+}
+
+bool eo::GlyphCache::rasterize(ImWchar codepoint)
+{
+    const auto source = std::find_if(begin(mSources), end(mSources),
+                                     [&](const auto &source) { return stbtt_FindGlyphIndex(&source->info, codepoint) != 0; });
+    if (source == end(mSources)) {
+        return false;
+    }
+
+    // Least recently used, but never one required in this frame. The fallback glyph is shown until a slot gets free
+    const auto slot = std::min_element(begin(mSlots), end(mSlots), [](const Slot &a, const Slot &b) { return a.lastUse < b.lastUse; });
+    if (slot == end(mSlots) || slot->lastUse == mFrame) {
+        return true;
+    }
+    evict(*slot);
+
+    const auto &info  = (*source)->info;
+    const int   glyph = stbtt_FindGlyphIndex(&info, codepoint);
+    const float scale = stbtt_ScaleForPixelHeight(&info, mFont.FontSize);
+
+    int advance, bearing, x0, y0, x1, y1;
+    stbtt_GetGlyphHMetrics(&info, glyph, &advance, &bearing);
+    stbtt_GetGlyphBitmapBox(&info, glyph, scale, scale, &x0, &y0, &x1, &y1);
+
+    // Clipped to the slot, one row and column stay empty to not bleed into the neighbours
+    const int width  = std::clamp(x1 - x0, 0, mSlotSize - 1);
+    const int height = std::clamp(y1 - y0, 0, mSlotSize - 1);
+
+    std::vector<byte> alpha(static_cast<std::size_t>(mSlotSize) * mSlotSize);
+    stbtt_MakeGlyphBitmap(&info, alpha.data(), width, height, mSlotSize, scale, scale, glyph);
+
+    // White with the coverage as alpha like the prebuilt atlas, the whole slot to clear the previous glyph
+    std::vector<uint32> rgba(alpha.size());
+    std::transform(begin(alpha), end(alpha), begin(rgba), [](byte a) { return 0x00FFFFFFu | (static_cast<uint32>(a) << 24u); });
+
+    const auto index = static_cast<std::size_t>(slot - begin(mSlots));
+    const int  slotx = static_cast<int>(index % mColumns) * mSlotSize;
+    const int  sloty = mFirstRow + static_cast<int>(index / mColumns) * mSlotSize;
+
+    glBindTexture(GL_TEXTURE_2D, mTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, slotx, sloty, mSlotSize, mSlotSize, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+
+    // Positioned on the baseline of the atlas font like the prebuilt glyphs
+    const float top = std::round(mFont.Ascent);
+    removeTabGlyph();
+    mFont.Glyphs.push_back({});
+    auto &added     = mFont.Glyphs.back();
+    added.Codepoint = codepoint;
+    added.AdvanceX  = advance * scale;
+    added.X0        = static_cast<float>(x0);
+    added.Y0        = y0 + top;
+    added.X1        = static_cast<float>(x0 + width);
+    added.Y1        = y0 + top + height;
+    added.U0        = static_cast<float>(slotx) / mTextureWidth;
+    added.V0        = static_cast<float>(sloty) / mTextureHeight;
+    added.U1        = static_cast<float>(slotx + width) / mTextureWidth;
+    added.V1        = static_cast<float>(sloty + height) / mTextureHeight;
+
+    slot->codepoint = codepoint;
+    slot->lastUse   = mFrame;
+    mCached.emplace(codepoint, index);
+    mDirty = true;
+    return true;
+}
+
+void eo::GlyphCache::evict(Slot &slot)
+{
+    if (slot.codepoint == 0) {
+        return;
+    }
+
+    removeTabGlyph();
+    auto &     glyphs = mFont.Glyphs;
+    const auto it
+        = std::find_if(glyphs.begin(), glyphs.end(), [&](const ImFontGlyph &glyph) { return glyph.Codepoint == slot.codepoint; });
+    if (it != glyphs.end()) {
+        glyphs.erase(it);
+    }
+
+    mCached.erase(slot.codepoint);
+    slot   = {};
+    mDirty = true;
+}
+
+void eo::GlyphCache::removeTabGlyph()
+{
+    // BuildLookupTable appends a tab glyph unless the last one is a tab already, it gets recreated
+    if (!mFont.Glyphs.empty() && mFont.Glyphs.back().Codepoint == '\t') {
+        mFont.Glyphs.pop_back();
+    }
+}
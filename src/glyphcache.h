@@ -0,0 +1,95 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "util.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "imgui.h"
+
+namespace eo {
+
+/*
+ * Glyphs which are not part of the prebuilt font atlas, e.g. cyrillic or cjk pilot names:
+ *  - Rasterized from the font files the first time they are required
+ *  - Packed into fixed size slots in a strip reserved below the prebuilt atlas and uploaded with glTexSubImage2D
+ *  - If every slot is taken the least recently used glyph gets evicted
+ * The glyphs are added to the default font of the atlas, so imgui renders them like any other glyph.
+ */
+class GlyphCache {
+public:
+    // Rows of slots reserved below the prebuilt atlas
+    constexpr static int slot_rows = 8;
+
+    // The rows the texture has to be taller than the prebuilt atlas
+    static int reservedHeight(float fontSize);
+
+    // The texture is reservedHeight() taller than the prebuilt atlas, the atlas gets adjusted to the full texture.
+    // The fonts are searched in order for a glyph, those which do not exist are skipped
+    GlyphCache(ImFontAtlas &atlas, uint texture, const std::vector<std::string> &fontPaths);
+    ~GlyphCache();
+
+    GlyphCache(const GlyphCache &) = delete;
+    GlyphCache &operator=(const GlyphCache &) = delete;
+
+    // Rasterizes the missing glyphs of the utf8 text, needs a current context
+    void require(std::string_view text);
+    // For input callbacks which run without a current context, rasterized in the next frame
+    void queue(ImWchar codepoint) { mQueued.push_back(codepoint); }
+
+    // Glyphs required in the current frame are never evicted
+    void newFrame();
+
+    [[nodiscard]] std::size_t size() const { return mCached.size(); }
+
+private:
+    struct Source;
+
+    struct Slot {
+        ImWchar codepoint = 0; // 0 if the slot is free
+        uint64  lastUse   = 0;
+    };
+
+    void use(ImWchar codepoint);
+    void rebuildLookup();
+    // Returns false if none of the fonts has the glyph
+    bool rasterize(ImWchar codepoint);
+    void evict(Slot &slot);
+    void removeTabGlyph();
+
+    ImFont &    mFont;
+    uint        mTexture;
+    int         mTextureWidth, mTextureHeight;
+    int         mSlotSize;
+    int         mFirstRow; // Of the reserved strip
+    std::size_t mColumns;
+
+    std::vector<std::unique_ptr<Source>> mSources;
+    std::vector<Slot>                    mSlots;
+    std::unordered_map<ImWchar, std::size_t> mCached; // The slot of every cached codepoint
+    std::unordered_set<ImWchar>          mUnavailable;
+    std::vector<ImWchar>                 mQueued;
+
+    uint64 mFrame = 1;
+    bool   mDirty = false; // The lookup tables of the font are outdated
+};
+}
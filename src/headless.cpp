@@ -0,0 +1,165 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "headless.h"
+#include "logging.h"
+
+#include "glad/glad.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+EGLDisplay headless_display()
+{
+    static EGLDisplay display = [] {
+        const auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (!get_platform_display) {
+            throw std::runtime_error("EGL does not support platform displays");
+        }
+
+        auto * surfaceless = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        EGLint major, minor;
+        if (surfaceless == EGL_NO_DISPLAY || !eglInitialize(surfaceless, &major, &minor)) {
+            throw std::runtime_error("Could not initialize the surfaceless EGL display");
+        }
+
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            throw std::runtime_error("EGL does not support desktop OpenGL");
+        }
+
+        eo::log::info("Rendering headless with EGL {0}.{1} by {2}", major, minor, eglQueryString(surfaceless, EGL_VENDOR));
+        return surfaceless;
+    }();
+
+    return display;
+}
+
+EGLContext create_context(EGLContext share)
+{
+    const auto display = headless_display();
+
+    // Nothing gets drawn to an EGL surface, the config only has to be able to do OpenGL
+    const EGLint config_attributes[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig    config;
+    EGLint       configs = 0;
+    if (!eglChooseConfig(display, config_attributes, &config, 1, &configs) || configs == 0) {
+        throw std::runtime_error("No EGL config supports OpenGL");
+    }
+
+    const EGLint context_attributes[] = { EGL_CONTEXT_MAJOR_VERSION,       3, EGL_CONTEXT_MINOR_VERSION,
+                                          3, EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                          EGL_NONE };
+
+    auto *context = eglCreateContext(display, config, share, context_attributes);
+    if (context == EGL_NO_CONTEXT) {
+        throw std::runtime_error(fmt::format("Could not create a headless OpenGL 3.3 context: EGL error {0:#x}", eglGetError()));
+    }
+    return context;
+}
+
+// Like the hidden window, it is never current but keeps the shared objects alive
+EGLContext share_context()
+{
+    static EGLContext context = create_context(EGL_NO_CONTEXT);
+    return context;
+}
+}
+
+eo::HeadlessContext::HeadlessContext(int width, int height)
+    : mContext(create_context(share_context()))
+    , mWidth(width)
+    , mHeight(height)
+{
+    makeCurrent();
+
+    // The destructor does not run if the constructor throws
+    try {
+        static bool loaded = gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress));
+        if (!loaded) {
+            throw std::runtime_error("Could not load the OpenGL functions");
+        }
+
+        glGenRenderbuffers(1, &mColorbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, mColorbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+        // Framebuffer objects are not shared, this context is the only one using it
+        glGenFramebuffers(1, &mFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mColorbuffer);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            throw std::runtime_error("The headless framebuffer is incomplete");
+        }
+    } catch (...) {
+        release();
+        throw;
+    }
+
+    // Without a surface the viewport starts out empty
+    glViewport(0, 0, width, height);
+}
+
+eo::HeadlessContext::~HeadlessContext() { release(); }
+
+void eo::HeadlessContext::release()
+{
+    makeCurrent();
+    // Only created once the gl functions are loaded
+    if (mFramebuffer) {
+        glDeleteFramebuffers(1, &mFramebuffer);
+    }
+    if (mColorbuffer) {
+        glDeleteRenderbuffers(1, &mColorbuffer);
+    }
+
+    const auto display = headless_display();
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(display, mContext);
+}
+
+void eo::HeadlessContext::makeCurrent()
+{
+    if (!eglMakeCurrent(headless_display(), EGL_NO_SURFACE, EGL_NO_SURFACE, mContext)) {
+        log::error("Could not make the headless context current: EGL error {0:#x}", eglGetError());
+    }
+}
+
+std::vector<eo::byte> eo::HeadlessContext::readPixels() const
+{
+    const auto        row = static_cast<std::size_t>(mWidth) * 4;
+    std::vector<byte> pixels(row * mHeight);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, mWidth, mHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    // OpenGL starts with the bottom row
+    std::vector<byte> flipped(row);
+    for (int y = 0; y < mHeight / 2; ++y) {
+        auto *top    = pixels.data() + y * row;
+        auto *bottom = pixels.data() + (mHeight - 1 - y) * row;
+        std::memcpy(flipped.data(), top, row);
+        std::memcpy(top, bottom, row);
+        std::memcpy(bottom, flipped.data(), row);
+    }
+
+    return pixels;
+}
@@ -0,0 +1,57 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#include <vector>
+
+#include "./math.h"
+#include "util.h"
+
+namespace eo {
+
+/*
+ * An OpenGL 3.3 core context without a window, e.g. for benchmarks on a server:
+ *  - Created on the surfaceless platform of mesa through EGL, llvmpipe renders if there is no gpu
+ *  - Renders into a framebuffer object of the given size which stays bound and can be read back
+ *  - Shares its objects with every other headless context, like the windows share theirs
+ * Loads the gl functions with the first context.
+ */
+class HeadlessContext {
+public:
+    explicit HeadlessContext(int width, int height);
+    ~HeadlessContext();
+
+    HeadlessContext(const HeadlessContext &) = delete;
+    HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+    void makeCurrent();
+
+    // Has to be current: The rgba pixels of the framebuffer, top row first
+    [[nodiscard]] std::vector<byte> readPixels() const;
+
+    [[nodiscard]] math::vec2 getSize() const { return { static_cast<float>(mWidth), static_cast<float>(mHeight) }; }
+
+private:
+    // Deletes the framebuffer objects and the context
+    void release();
+
+    void *mContext     = nullptr; // EGLContext
+    uint  mFramebuffer = 0;
+    uint  mColorbuffer = 0;
+    int   mWidth, mHeight;
+};
+}
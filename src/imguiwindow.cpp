@@ -15,6 +15,8 @@
  */
 
 #include "imguiwindow.h"
+#include "fontcache.h"
+#include "glyphcache.h"
 #include "logging.h"
 
 #define GLFW_INCLUDE_NONE
@@ -27,6 +29,51 @@
 namespace {
 constexpr float font_size = 16.f;
 
+constexpr const char *font_cache_file = "fontatlas.bin";
+constexpr ImWchar     icons_ranges[]  = { ICON_MIN_FK, ICON_MAX_FK, 0 };
+
+// Searched in order for glyphs outside of the prebuilt atlas, e.g. cyrillic names are covered by noto mono,
+// cjk by a system font if one is installed
+const std::vector<std::string> glyph_fonts = {
+    "assets/NotoMono-Regular.ttf",
+    "/usr/share/fonts/opentype/noto/NotoSansCJK-Regular.ttc",
+    "/usr/share/fonts/noto-cjk/NotoSansCJK-Regular.ttc",
+    "/usr/share/fonts/google-noto-cjk/NotoSansCJK-Regular.ttc",
+    "/usr/share/fonts/truetype/droid/DroidSansFallbackFull.ttf",
+};
+
+// Enough for a few hundred widgets, the stream buffers grow if a frame needs more
+constexpr std::size_t initial_vertex_bytes = 1 << 20;
+constexpr std::size_t initial_index_bytes  = 1 << 18;
+
+constexpr GLenum index_type = sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+// Everything the output of a frame depends on, except for the contents of the font texture.
+// Glyphs only get replaced in the texture if no frame shows them anymore
+eo::uint64 hash_draw_data(const ImDrawData &draw_data, eo::math::vec2 display_size)
+{
+    auto hash = eo::fast_hash(&display_size, sizeof(display_size));
+    for (int n = 0; n < draw_data.CmdListsCount; n++) {
+        const ImDrawList *cmd_list = draw_data.CmdLists[n];
+
+        hash = eo::fast_hash(cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert), hash);
+        hash = eo::fast_hash(cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx), hash);
+
+        // Field by field, the padding of ImDrawCmd is not initialized
+        for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++) {
+            const ImDrawCmd &cmd     = cmd_list->CmdBuffer[cmd_i];
+            const ImVec4     clip    = cmd.ClipRect;
+            const void *     texture = cmd.TextureId;
+            const auto       count   = static_cast<eo::uint64>(cmd.ElemCount);
+
+            hash = eo::fast_hash(&clip, sizeof(clip), hash);
+            hash = eo::fast_hash(&texture, sizeof(texture), hash);
+            hash = eo::fast_hash(&count, sizeof(count), hash);
+        }
+    }
+    return hash;
+}
+
 const char *vertex_shader = R"glsl(
 #version 330 core
 layout(location = 0) in vec2 Position;
@@ -77,73 +124,56 @@ void glcheck(int line)
 }
 #define GLCHECK glcheck(__LINE__);
 
-eo::ImguiWindow::ImguiWindow(int width, int height, std::string name, int xpos, int ypos)
-    : DisplayWindow(width, height, std::move(name), xpos, ypos)
+std::shared_ptr<eo::ImguiResources> eo::ImguiResources::get()
 {
-    mContext = ImGui::CreateContext(); // TODO Pass a shared font atlas
-    ImGui::SetCurrentContext(mContext);
-    ImGui::StyleColorsDark();
-    auto &io = ImGui::GetIO();
-
-    ImGui::GetStyle().WindowRounding = 0.f;
-
-    if (!io.Fonts->AddFontFromFileTTF("assets/NotoMono-Regular.ttf", font_size)) {
-        throw std::logic_error("Could not load/find font file: NotoMono-Regular.ttf");
-    }
+    static std::weak_ptr<ImguiResources> shared;
 
-    const ImWchar icons_ranges[] = { ICON_MIN_FK, ICON_MAX_FK, 0 };
-    ImFontConfig  icons_config;
-    icons_config.PixelSnapH = true;
-    icons_config.MergeMode  = true;
-
-    if (!io.Fonts->AddFontFromFileTTF("assets/" FONT_ICON_FILE_NAME_FK, font_size, &icons_config, icons_ranges)) {
-        throw std::logic_error("Could not load/find font file: ForkAwesome");
+    auto resources = shared.lock();
+    if (!resources) {
+        resources = std::make_shared<ImguiResources>();
+        shared    = resources;
     }
+    return resources;
+}
 
-    io.Fonts->Build();
-
-    const auto display_size    = getFramebufferSize();
-    io.DisplaySize.x           = display_size.x;
-    io.DisplaySize.y           = display_size.y;
-    io.DisplayFramebufferScale = { 1, 1 };
-
-    glGenBuffers(1, &mVbo);
-    glGenBuffers(1, &mIbo);
-    glGenVertexArrays(1, &mVao);
-
-    glBindVertexArray(mVao);
-    glBindBuffer(GL_ARRAY_BUFFER, mVbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIbo);
-
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid *)offsetof(ImDrawVert, pos));
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid *)offsetof(ImDrawVert, uv));
-    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid *)offsetof(ImDrawVert, col));
-
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-
-    glBindVertexArray(0);
-
-    GLCHECK
-
-    {
-        uint32 *pixels;
-        int     width, height;
-        io.Fonts->GetTexDataAsRGBA32(reinterpret_cast<byte **>(&pixels), &width, &height);
-
-        glGenTextures(1, &mFontTexture);
-        glBindTexture(GL_TEXTURE_2D, mFontTexture);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+eo::ImguiResources::ImguiResources()
+    : mFontAtlas(std::make_unique<ImFontAtlas>())
+{
+    const std::vector<FontSource> sources = {
+        { "assets/NotoMono-Regular.ttf", font_size },
+        { "assets/" FONT_ICON_FILE_NAME_FK, font_size, icons_ranges, true, true },
+    };
+    const auto cache_path = get_exe_dir() + data_folder + font_cache_file;
+    const auto cache_key  = FontAtlasCache::key(sources);
+
+    if (const auto cache = FontAtlasCache::open(cache_path, cache_key)) {
+        cache->restore(*mFontAtlas);
+        uploadFontTexture(cache->pixels(), cache->width(), cache->height());
+        log::info("Loaded the font atlas from {0}", cache_path);
+    } else {
+        for (const auto &source : sources) {
+            ImFontConfig config;
+            config.MergeMode  = source.merge;
+            config.PixelSnapH = source.pixelSnap;
+
+            if (!mFontAtlas->AddFontFromFileTTF(source.path.c_str(), source.size, &config, source.ranges)) {
+                throw std::logic_error(fmt::format("Could not load/find font file: {0}", source.path));
+            }
+        }
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        mFontAtlas->Build();
+        FontAtlasCache::store(cache_path, cache_key, *mFontAtlas);
 
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-        io.Fonts->TexID = reinterpret_cast<void *>(mFontTexture);
+        byte *pixels;
+        int   width, height;
+        mFontAtlas->GetTexDataAsRGBA32(&pixels, &width, &height);
+        uploadFontTexture(pixels, width, height);
     }
+
+    // Uploaded, the windows only need the glyph tables
+    mFontAtlas->ClearTexData();
+    mFontAtlas->TexID = reinterpret_cast<void *>(mFontTexture);
+    mGlyphCache       = std::make_unique<GlyphCache>(*mFontAtlas, mFontTexture, glyph_fonts);
     GLCHECK
 
     {
@@ -162,8 +192,88 @@ eo::ImguiWindow::ImguiWindow(int width, int height, std::string name, int xpos,
 
         glDeleteShader(vertexShader);
         glDeleteShader(fragmentShader);
+
+        // Uniform values are state of the program, so tex is shared as well
+        mProjectionLocation = glGetUniformLocation(mShaderProgram, "projection");
+        glUseProgram(mShaderProgram);
+        glUniform1i(glGetUniformLocation(mShaderProgram, "tex"), 0);
     }
     GLCHECK
+}
+
+void eo::ImguiResources::uploadFontTexture(const byte *pixels, int width, int height)
+{
+    // The glyph cache gets a strip below the prebuilt atlas
+    const int reserved = GlyphCache::reservedHeight(font_size);
+
+    glGenTextures(1, &mFontTexture);
+    glBindTexture(GL_TEXTURE_2D, mFontTexture);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height + reserved, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    const std::vector<uint32> empty(static_cast<std::size_t>(width) * reserved, 0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, height, width, reserved, GL_RGBA, GL_UNSIGNED_BYTE, empty.data());
+}
+
+eo::ImguiResources::~ImguiResources()
+{
+    // Called by the last window with its context current, any context of the share group will do
+    glDeleteTextures(1, &mFontTexture);
+    glDeleteProgram(mShaderProgram);
+
+    GLCHECK
+}
+
+eo::ImguiWindow::ImguiWindow(int width, int height, std::string name, int xpos, int ypos)
+    : DisplayWindow(width, height, std::move(name), xpos, ypos)
+    , mResources(ImguiResources::get())
+    , mVertices(initial_vertex_bytes)
+    , mIndices(initial_index_bytes)
+{
+    mContext = ImGui::CreateContext(&mResources->getFontAtlas());
+    ImGui::SetCurrentContext(mContext);
+    ImGui::StyleColorsDark();
+    auto &io = ImGui::GetIO();
+
+    ImGui::GetStyle().WindowRounding = 0.f;
+
+    const auto display_size    = getFramebufferSize();
+    io.DisplaySize.x           = display_size.x;
+    io.DisplaySize.y           = display_size.y;
+    io.DisplayFramebufferScale = { 1, 1 };
+
+    // Vertex arrays are not shared, every window needs its own. The context belongs to this window, so it stays bound
+    glGenVertexArrays(1, &mVao);
+    glBindVertexArray(mVao);
+    bindStreamBuffers();
+
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+
+    glUseProgram(mResources->getShaderProgram());
+
+    GLCHECK
+
+    // Nothing else renders with this context, the state only has to be set once
+    glClearColor(0., 0., 0., 0.);
+    glEnable(GL_BLEND);
+    glBlendEquation(GL_FUNC_ADD);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_DEPTH_TEST);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glBindSampler(0, 0);
+    glBindTexture(GL_TEXTURE_2D, mResources->getFontTexture());
+
+    GLCHECK
 
     io.KeyMap[ImGuiKey_Tab]        = GLFW_KEY_TAB;
     io.KeyMap[ImGuiKey_LeftArrow]  = GLFW_KEY_LEFT;
@@ -200,89 +310,167 @@ eo::ImguiWindow::ImguiWindow(int width, int height, std::string name, int xpos,
     io.ClipboardUserData = this;
 }
 
-void eo::ImguiWindow::renderContents()
+bool eo::ImguiWindow::renderContents()
 {
-    glClearColor(0., 0., 0., 0.);
-    glClear(GL_COLOR_BUFFER_BIT);
-
     ImGui::SetCurrentContext(mContext);
     auto &io = ImGui::GetIO();
 
     const auto display_size = getFramebufferSize();
-    io.DisplaySize.x        = display_size.x;
-    io.DisplaySize.y        = display_size.y;
-    io.DeltaTime            = getTime() - mLastFrame;
-
-    // TODO Might be wanky either: glfwSetInputMode(window, GLFW_STICKY_MOUSE_BUTTONS, GLFW_TRUE);
-    // or use the callbacks
-    io.MouseDown[0] = glfwGetMouseButton(mWindow, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
-    io.MouseDown[1] = glfwGetMouseButton(mWindow, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
-    io.MouseDown[2] = glfwGetMouseButton(mWindow, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS;
-
-    ImGui::NewFrame();
-    ImGui::SetNextWindowSize(ImVec2(display_size.x, display_size.y));
-    ImGui::SetNextWindowPos({ 0.f, 0.f });
-    ImGui::Begin(mName.c_str(), nullptr, ImGuiWindowFlags_NoDecoration & ~ImGuiWindowFlags_NoScrollbar);
-    renderImguiContents();
-    ImGui::End();
-    ImGui::EndFrame();
-    ImGui::Render();
+
+    {
+        const auto timer = mProfiler.time(FrameProfiler::NewFrame);
+        io.DisplaySize.x = display_size.x;
+        io.DisplaySize.y = display_size.y;
+        io.DeltaTime     = getTime() - mLastFrame;
+        mLastFrame       = getTime();
+
+        // Frames only run on demand, a click might start and end between two of them
+        for (int button = 0; button < static_cast<int>(mMousePressed.size()); ++button) {
+            io.MouseDown[button]  = mMousePressed[button] || isMouseButtonDown(button);
+            mMousePressed[button] = false;
+        }
+
+        mResources->getGlyphCache().newFrame();
+        ImGui::NewFrame();
+    }
+
+    {
+        const auto timer = mProfiler.time(FrameProfiler::Contents);
+        ImGui::SetNextWindowSize(ImVec2(display_size.x, display_size.y));
+        ImGui::SetNextWindowPos({ 0.f, 0.f });
+        ImGui::Begin(mName.c_str(), nullptr, ImGuiWindowFlags_NoDecoration & ~ImGuiWindowFlags_NoScrollbar);
+        renderImguiContents();
+        ImGui::End();
+    }
+
+    // Building the panel is not part of Contents, but its geometry goes through the later phases like any other window
+    if (mProfiler.isEnabled()) {
+        mProfiler.renderPanel();
+    }
+
+    {
+        const auto timer = mProfiler.time(FrameProfiler::Layout);
+        ImGui::EndFrame();
+        ImGui::Render();
+    }
+
+    if (io.WantTextInput) {
+        requestFrameAt(getTime() + cursor_blink_interval);
+    }
 
     auto       draw_data  = ImGui::GetDrawData();
     const auto projection = math::ortho(0.f, display_size.x, display_size.y, 0.f, 1.f, -1.f);
 
     draw_data->ScaleClipRects(io.DisplayFramebufferScale);
 
-    glEnable(GL_BLEND);
-    glBlendEquation(GL_FUNC_ADD);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_SCISSOR_TEST);
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    // Input often leaves the output as it was, e.g. moving the mouse over text. Nothing gets uploaded, drawn or swapped then,
+    // which also saves the compositor from blending the transparent window again
+    uint64 draw_hash;
+    {
+        const auto timer = mProfiler.time(FrameProfiler::Hash);
+        draw_hash        = hash_draw_data(*draw_data, display_size);
+    }
+    if (draw_hash == mDrawHash && !isDamaged()) {
+        return false;
+    }
+    mDrawHash = draw_hash;
 
-    glUseProgram(mShaderProgram);
-    glUniformMatrix4fv(glGetUniformLocation(mShaderProgram, "projection"), 1, GL_FALSE, &projection[0][0]);
-    glUniform1i(glGetUniformLocation(mShaderProgram, "tex"), 0);
-    glBindSampler(0, 0);
-    glBindTexture(GL_TEXTURE_2D, mFontTexture);
+    const bool profiling = mProfiler.isEnabled();
+    if (profiling) {
+        mGpuTimer.begin();
+    }
 
-    glBindVertexArray(mVao);
-    glBindBuffer(GL_ARRAY_BUFFER, mVbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIbo);
+    glClear(GL_COLOR_BUFFER_BIT);
 
-    GLCHECK
+    // The program is shared, the other windows overwrite the projection
+    glUniformMatrix4fv(mResources->getProjectionLocation(), 1, GL_FALSE, &projection[0][0]);
 
-    for (int n = 0; n < draw_data->CmdListsCount; n++) {
-        const ImDrawList *cmd_list          = draw_data->CmdLists[n];
-        const ImDrawIdx * idx_buffer_offset = nullptr;
+    std::size_t vertex_offset, index_offset;
+    {
+        const auto timer = mProfiler.time(FrameProfiler::Upload);
 
-        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert), (const GLvoid *)cmd_list->VtxBuffer.Data,
-                     GL_STREAM_DRAW);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx),
-                     (const GLvoid *)cmd_list->IdxBuffer.Data, GL_STREAM_DRAW);
+        // The draw lists are packed back to back into one range of the stream buffers
+        vertex_offset = mVertices.begin(draw_data->TotalVtxCount * sizeof(ImDrawVert), sizeof(ImDrawVert));
+        index_offset  = mIndices.begin(draw_data->TotalIdxCount * sizeof(ImDrawIdx), sizeof(ImDrawIdx));
+        bindStreamBuffers();
 
-        for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++) {
-            const ImDrawCmd *pcmd = &cmd_list->CmdBuffer[cmd_i];
-            if (pcmd->UserCallback) {
-                pcmd->UserCallback(cmd_list, pcmd);
-            } else {
-                glScissor((int)pcmd->ClipRect.x, (int)(display_size.y - pcmd->ClipRect.w), (int)(pcmd->ClipRect.z - pcmd->ClipRect.x),
-                          (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
-                glDrawElements(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
-                               idx_buffer_offset);
+        auto vertex_write = vertex_offset, index_write = index_offset;
+        for (int n = 0; n < draw_data->CmdListsCount; n++) {
+            const ImDrawList *cmd_list = draw_data->CmdLists[n];
+
+            mVertices.write(vertex_write, cmd_list->VtxBuffer.Data, cmd_list->VtxBuffer.Size * sizeof(ImDrawVert));
+            mIndices.write(index_write, cmd_list->IdxBuffer.Data, cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx));
+            vertex_write += cmd_list->VtxBuffer.Size * sizeof(ImDrawVert);
+            index_write += cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx);
+        }
+    }
+
+    GLCHECK
+
+    {
+        const auto timer = mProfiler.time(FrameProfiler::Draw);
+        glEnable(GL_SCISSOR_TEST);
+
+        // The indices of a draw list start at zero, the base vertex moves them to the vertices of the list
+        auto base_vertex = static_cast<GLint>(vertex_offset / sizeof(ImDrawVert));
+        auto index_byte  = index_offset;
+        for (int n = 0; n < draw_data->CmdListsCount; n++) {
+            const ImDrawList *cmd_list = draw_data->CmdLists[n];
+
+            for (int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++) {
+                const ImDrawCmd *pcmd = &cmd_list->CmdBuffer[cmd_i];
+                if (pcmd->UserCallback) {
+                    pcmd->UserCallback(cmd_list, pcmd);
+                } else {
+                    glScissor((int)pcmd->ClipRect.x, (int)(display_size.y - pcmd->ClipRect.w),
+                              (int)(pcmd->ClipRect.z - pcmd->ClipRect.x), (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
+                    glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount, index_type,
+                                             reinterpret_cast<const GLvoid *>(index_byte), base_vertex);
+                }
+                index_byte += pcmd->ElemCount * sizeof(ImDrawIdx);
             }
-            idx_buffer_offset += pcmd->ElemCount;
+            base_vertex += cmd_list->VtxBuffer.Size;
         }
+
+        // glClear is affected by the scissor test as well
+        glDisable(GL_SCISSOR_TEST);
+
+        mVertices.end();
+        mIndices.end();
     }
 
-    glDisable(GL_SCISSOR_TEST);
-    glDisable(GL_BLEND);
-    glBindVertexArray(0);
+    if (profiling) {
+        mGpuTimer.end();
+        mGpuTimer.collect(mProfiler, FrameProfiler::Gpu);
+    }
 
     GLCHECK
 
-    mLastFrame = getTime();
+    return true;
+}
+
+void eo::ImguiWindow::bindStreamBuffers()
+{
+    if (mBoundVertices != mVertices.getBuffer()) {
+        mBoundVertices = mVertices.getBuffer();
+        glBindBuffer(GL_ARRAY_BUFFER, mBoundVertices);
+
+        // The attributes capture the buffer bound to GL_ARRAY_BUFFER
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid *)offsetof(ImDrawVert, pos));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert), (GLvoid *)offsetof(ImDrawVert, uv));
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert), (GLvoid *)offsetof(ImDrawVert, col));
+    }
+
+    if (mBoundIndices != mIndices.getBuffer()) {
+        mBoundIndices = mIndices.getBuffer();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mBoundIndices);
+    }
+}
+
+const char *eo::ImguiWindow::dynamicText(const std::string &text)
+{
+    mResources->getGlyphCache().require(text);
+    return text.c_str();
 }
 
 void eo::ImguiWindow::keyboardInput(int key, int scancode, int action, int mods)
@@ -295,6 +483,11 @@ void eo::ImguiWindow::keyboardInput(int key, int scancode, int action, int mods)
         return;
     }
 
+    if (key == GLFW_KEY_F12 && action == GLFW_PRESS) {
+        mProfiler.setEnabled(!mProfiler.isEnabled());
+        return;
+    }
+
     ImGui::SetCurrentContext(mContext);
     auto &io = ImGui::GetIO();
     if (action == GLFW_PRESS) {
@@ -309,11 +502,20 @@ void eo::ImguiWindow::keyboardInput(int key, int scancode, int action, int mods)
     io.KeySuper = mods & GLFW_MOD_SUPER;
 }
 
+void eo::ImguiWindow::mousebuttonInput(int button, int action, int mods)
+{
+    boost::ignore_unused(mods);
+    if (action == GLFW_PRESS && button >= 0 && button < static_cast<int>(mMousePressed.size())) {
+        mMousePressed[button] = true;
+    }
+}
+
 void eo::ImguiWindow::characterInput(uint codepoint)
 {
     ImGui::SetCurrentContext(mContext);
     auto &io = ImGui::GetIO();
     if (codepoint > 0 && codepoint < 0x10000) {
+        mResources->getGlyphCache().queue(static_cast<ImWchar>(codepoint));
         io.AddInputCharacter(static_cast<unsigned short>(codepoint));
     }
 }
@@ -340,12 +542,9 @@ eo::ImguiWindow::~ImguiWindow()
         ImGui::DestroyContext(mContext);
     }
 
-    glfwMakeContextCurrent(mWindow);
-    glDeleteTextures(1, &mFontTexture);
-    glDeleteBuffers(1, &mVbo);
-    glDeleteBuffers(1, &mIbo);
+    // The stream buffers and the shared resources get released with this context current as well
+    makeCurrent();
     glDeleteVertexArrays(1, &mVao);
-    glDeleteProgram(mShaderProgram);
 
     GLCHECK
 }
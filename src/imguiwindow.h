@@ -16,29 +16,91 @@
 
 #pragma once
 #include "displaywindow.h"
+#include "streambuffer.h"
+
+#include <array>
+#include <memory>
 
 struct ImGuiContext;
+struct ImFontAtlas;
 
 namespace eo {
+class GlyphCache;
+
+/*
+ * Everything the imgui windows have in common: the font atlas, its texture and the shader program.
+ * Created with the first window, the gl objects live in the context all windows share.
+ */
+class ImguiResources {
+public:
+    // Needs a current context, creates the resources if no window holds them anymore
+    static std::shared_ptr<ImguiResources> get();
+
+    ImguiResources();
+    ~ImguiResources();
+
+    ImguiResources(const ImguiResources &) = delete;
+    ImguiResources &operator=(const ImguiResources &) = delete;
+
+    [[nodiscard]] ImFontAtlas &getFontAtlas() { return *mFontAtlas; }
+    [[nodiscard]] GlyphCache & getGlyphCache() { return *mGlyphCache; }
+    [[nodiscard]] uint         getFontTexture() const { return mFontTexture; }
+    [[nodiscard]] uint         getShaderProgram() const { return mShaderProgram; }
+    [[nodiscard]] int          getProjectionLocation() const { return mProjectionLocation; }
+
+private:
+    void uploadFontTexture(const byte *pixels, int width, int height);
+
+    std::unique_ptr<ImFontAtlas> mFontAtlas;
+    std::unique_ptr<GlyphCache>  mGlyphCache;
+    uint                         mFontTexture{};
+    uint                         mShaderProgram{};
+    int                          mProjectionLocation = -1;
+};
+
 class ImguiWindow : public DisplayWindow {
 public:
     explicit ImguiWindow(int width, int height, std::string name, int xpos, int ypos);
     ~ImguiWindow() override;
 
 protected:
-    void         renderContents() override;
+    bool         renderContents() override;
     virtual void renderImguiContents();
 
+    // For text which might need glyphs outside of the prebuilt atlas, e.g. pilot names. Returns text.c_str()
+    const char *dynamicText(const std::string &text);
+
     void keyboardInput(int key, int scancode, int action, int mods) override;
     void characterInput(unsigned int codepoint) override;
     void cursorInput(double xpos, double ypos) override;
+    void mousebuttonInput(int button, int action, int mods) override;
     void scrollInput(double xoffset, double yoffset) override;
 
 private:
+    // Binds the stream buffers to the vertex array, they get replaced if a frame outgrows them
+    void bindStreamBuffers();
+
+    // Roughly the phases of the text cursor of imgui
+    constexpr static double cursor_blink_interval = 0.4;
+
+    // Released last, the imgui context uses its font atlas
+    std::shared_ptr<ImguiResources> mResources;
+
     ImGuiContext *mContext = nullptr;
-    uint          mVbo{}, mIbo{}, mVao{}, mFontTexture{};
-    uint          mShaderProgram;
+    uint          mVao{};
+
+    // The geometry of all draw lists of a frame, the buffer objects currently bound to mVao
+    StreamBuffer mVertices, mIndices;
+    uint         mBoundVertices{}, mBoundIndices{};
+
+    // Times the upload and draws of the frame while the profiler is enabled
+    GpuTimer mGpuTimer;
 
     double mLastFrame = 0.0;
+    // Of the last frame which was presented
+    uint64 mDrawHash = 0;
+
+    // Left, right and middle button pressed since the last frame
+    std::array<bool, 3> mMousePressed{};
 };
 }
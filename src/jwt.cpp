@@ -0,0 +1,225 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jwt.h"
+#include "base64.h"
+#include "logging.h"
+#include "requests.h"
+
+#include <nlohmann/json.hpp>
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <sqlite3.h>
+#include <vector>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+#else
+#include <openssl/rsa.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace {
+std::shared_ptr<EVP_PKEY> make_rsa_key(const std::string &modulus, const std::string &exponent)
+{
+    const auto n = base64_url_decode(modulus);
+    const auto e = base64_url_decode(exponent);
+
+    BIGNUM *bn = BN_bin2bn(reinterpret_cast<const unsigned char *>(n.data()), n.length(), nullptr);
+    BIGNUM *be = BN_bin2bn(reinterpret_cast<const unsigned char *>(e.data()), e.length(), nullptr);
+
+    EVP_PKEY *pkey = nullptr;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM_BLD *builder = OSSL_PARAM_BLD_new();
+    OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_N, bn);
+    OSSL_PARAM_BLD_push_BN(builder, OSSL_PKEY_PARAM_RSA_E, be);
+    OSSL_PARAM *  params = OSSL_PARAM_BLD_to_param(builder);
+    EVP_PKEY_CTX *ctx    = EVP_PKEY_CTX_new_from_name(nullptr, "RSA", nullptr);
+
+    if (EVP_PKEY_fromdata_init(ctx) <= 0 || EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) <= 0) {
+        pkey = nullptr;
+    }
+
+    EVP_PKEY_CTX_free(ctx);
+    OSSL_PARAM_free(params);
+    OSSL_PARAM_BLD_free(builder);
+    BN_free(bn);
+    BN_free(be);
+#else
+    // The rsa struct takes ownership of the bignums
+    RSA *rsa = RSA_new();
+    RSA_set0_key(rsa, bn, be, nullptr);
+    pkey = EVP_PKEY_new();
+    EVP_PKEY_assign_RSA(pkey, rsa);
+#endif
+
+    if (!pkey) {
+        throw std::runtime_error("Could not create a rsa key from the jwks entry");
+    }
+
+    return std::shared_ptr<EVP_PKEY>{ pkey, [](auto *ptr) { EVP_PKEY_free(ptr); } };
+}
+}
+
+eo::jwt::DecodedToken eo::jwt::decode(const std::string &token)
+{
+    const auto first  = token.find('.');
+    const auto second = token.find('.', first + 1);
+    if (first == token.npos || second == token.npos) {
+        throw std::runtime_error("Access token is not a jwt");
+    }
+
+    DecodedToken decoded;
+    decoded.signingInput = token.substr(0, second);
+    decoded.signature    = base64_url_decode(token.substr(second + 1));
+
+    try {
+        const auto header = json::parse(base64_url_decode(token.substr(0, first)));
+        header.at("alg").get_to(decoded.alg);
+        header.at("kid").get_to(decoded.kid);
+
+        const auto payload = json::parse(base64_url_decode(token.substr(first + 1, second - first - 1)));
+
+        // The subject looks like this: CHARACTER:EVE:<id>
+        const auto  subject   = payload.at("sub").get<std::string>();
+        const auto &character = subject.substr(subject.find_last_of(':') + 1);
+        decoded.claims.characterID = std::stoi(character);
+
+        payload.at("name").get_to(decoded.claims.characterName);
+        payload.at("owner").get_to(decoded.claims.owner);
+        payload.at("iss").get_to(decoded.claims.issuer);
+        decoded.claims.authorizedParty = payload.value("azp", "");
+        decoded.claims.expiresAt       = std::chrono::system_clock::from_time_t(payload.at("exp").get<std::time_t>());
+    } catch (const std::exception &e) {
+        throw std::runtime_error(fmt::format("Could not decode the access token: {0}", e.what()));
+    }
+
+    return decoded;
+}
+
+eo::jwt::KeySet::KeySet(db::SqliteSPtr dbconnection)
+    : mDbConnection(std::move(dbconnection))
+{
+    loadFromDb();
+}
+
+bool eo::jwt::KeySet::hasKey(const std::string &kid) const { return mKeys.find(kid) != end(mKeys); }
+
+void eo::jwt::KeySet::verifySignature(const DecodedToken &token) const
+{
+    if (token.alg != "RS256") {
+        throw std::runtime_error(fmt::format("Unsupported jwt algorithm {0}", token.alg));
+    }
+
+    const auto key = mKeys.find(token.kid);
+    if (key == end(mKeys)) {
+        throw std::runtime_error(fmt::format("Unknown jwt key id {0}", token.kid));
+    }
+
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx{ EVP_MD_CTX_new(), &EVP_MD_CTX_free };
+
+    const bool valid
+        = EVP_DigestVerifyInit(ctx.get(), nullptr, EVP_sha256(), nullptr, key->second.get()) == 1
+          && EVP_DigestVerifyUpdate(ctx.get(), token.signingInput.data(), token.signingInput.length()) == 1
+          && EVP_DigestVerifyFinal(ctx.get(), reinterpret_cast<const unsigned char *>(token.signature.data()), token.signature.length())
+                 == 1;
+
+    if (!valid) {
+        throw std::runtime_error("Access token signature is invalid");
+    }
+}
+
+void eo::jwt::KeySet::fetchAsync(IOState &iostate, std::function<void()> callback)
+{
+    HttpRequest request;
+    request.hostname = jwks_hostname;
+    request.target   = jwks_target;
+
+    iostate.makeAsyncHttpRequest(request, [this, callback = std::move(callback)](auto &&response, auto &&) {
+        try {
+            storeJwks(response.body);
+        } catch (const std::exception &e) {
+            log::error("Could not fetch the sso signing keys: {0}", e.what());
+        }
+        callback();
+    });
+}
+
+void eo::jwt::KeySet::ensureKeyAsync(const std::string &kid, IOState &iostate, std::function<void()> callback)
+{
+    if (hasKey(kid)) {
+        callback();
+        return;
+    }
+
+    log::info("Access token is signed with an unknown key {0}, fetching the sso keys", kid);
+    fetchAsync(iostate, std::move(callback));
+}
+
+void eo::jwt::KeySet::loadFromDb()
+{
+    auto stmt = db::make_statement(mDbConnection, "SELECT kid, n, e FROM jwks;");
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        const auto kid = db::column_get_string(stmt.get(), 0);
+        try {
+            mKeys[kid] = make_rsa_key(db::column_get_string(stmt.get(), 1), db::column_get_string(stmt.get(), 2));
+        } catch (const std::runtime_error &re) {
+            log::error("{0}", re.what());
+        }
+    }
+}
+
+void eo::jwt::KeySet::storeJwks(const std::string &body)
+{
+    struct Jwk {
+        std::string kid, n, e;
+    };
+
+    const auto       j = json::parse(body);
+    std::vector<Jwk> jwks;
+    decltype(mKeys)  keys;
+
+    for (const auto &key : j.at("keys")) {
+        if (key.value("kty", "") != "RSA" || key.value("alg", "") != "RS256") {
+            continue; // We only verify RS256 signatures
+        }
+
+        auto &jwk = jwks.emplace_back();
+        key.at("kid").get_to(jwk.kid);
+        key.at("n").get_to(jwk.n);
+        key.at("e").get_to(jwk.e);
+        keys[jwk.kid] = make_rsa_key(jwk.n, jwk.e);
+    }
+
+    sqlite3_exec(mDbConnection.get(), "BEGIN TRANSACTION; DELETE FROM jwks;", nullptr, nullptr, nullptr);
+    auto insert = db::make_statement(mDbConnection, "INSERT INTO jwks VALUES(?,?,?,?,?)");
+    for (const auto &jwk : jwks) {
+        sqlite3_bind_text(insert.get(), 1, jwk.kid.c_str(), jwk.kid.length(), nullptr);
+        sqlite3_bind_text(insert.get(), 2, "RS256", -1, nullptr);
+        sqlite3_bind_text(insert.get(), 3, "RSA", -1, nullptr);
+        sqlite3_bind_text(insert.get(), 4, jwk.n.c_str(), jwk.n.length(), nullptr);
+        sqlite3_bind_text(insert.get(), 5, jwk.e.c_str(), jwk.e.length(), nullptr);
+        sqlite3_step(insert.get());
+        sqlite3_reset(insert.get());
+    }
+    insert.reset();
+    sqlite3_exec(mDbConnection.get(), "END TRANSACTION;", nullptr, nullptr, nullptr);
+
+    log::info("Fetched {0} sso signing keys", keys.size());
+    mKeys = std::move(keys);
+}
@@ -0,0 +1,86 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "db.h"
+#include "util.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+
+extern "C" {
+struct evp_pkey_st;
+}
+
+namespace eo {
+class IOState;
+}
+
+namespace eo::jwt {
+
+constexpr std::string_view jwks_hostname = "login.eveonline.com";
+constexpr std::string_view jwks_target   = "/oauth/jwks";
+
+// The claims of an eve sso access token we care about
+struct Claims {
+    int32                                 characterID = 0;
+    std::string                           characterName;
+    std::string                           owner;
+    std::string                           issuer;
+    std::string                           authorizedParty;
+    std::chrono::system_clock::time_point expiresAt;
+};
+
+struct DecodedToken {
+    std::string alg;
+    std::string kid;
+    Claims      claims;
+
+    // header.payload, the part covered by the signature
+    std::string signingInput;
+    std::string signature;
+};
+
+// Splits and decodes the token, does not validate anything
+DecodedToken decode(const std::string &token);
+
+/*
+ * The signing keys of the sso, cached in the database.
+ * Only fetched again if a token is signed with an unknown key id.
+ */
+class KeySet {
+public:
+    explicit KeySet(db::SqliteSPtr dbconnection);
+
+    [[nodiscard]] bool hasKey(const std::string &kid) const;
+
+    // Throws if the key is unknown or the signature does not match
+    void verifySignature(const DecodedToken &token) const;
+
+    void fetchAsync(IOState &iostate, std::function<void()> callback);
+
+    // Calls back right away if the key is known, otherwise after fetching the keys
+    void ensureKeyAsync(const std::string &kid, IOState &iostate, std::function<void()> callback);
+
+private:
+    void loadFromDb();
+    void storeJwks(const std::string &body);
+
+    std::map<std::string, std::shared_ptr<evp_pkey_st>> mKeys;
+    db::SqliteSPtr                                      mDbConnection;
+};
+}
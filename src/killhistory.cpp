@@ -0,0 +1,351 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "killhistory.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <nlohmann/json.hpp>
+#include <sqlite3.h>
+
+using json = nlohmann::json;
+
+eo::KillHistory::KillHistory(db::SqliteSPtr              dbconnection,
+                             std::shared_ptr<EsiSession> session,
+                             std::shared_ptr<IOState>    iostate,
+                             int                         killmailsInFlight,
+                             int                         victimsInFlight)
+    : mKillmailStage{ killmailsInFlight }
+    , mVictimStage{ victimsInFlight }
+    , mDbConnection(std::move(dbconnection))
+    , mEsiSession(std::move(session))
+    , mIOState(std::move(iostate))
+{
+    // Older watermarks are useless, zkillboard does not look back further
+    const auto oldest = format_esi_time(std::chrono::system_clock::now() - history_keep);
+
+    auto kills = db::make_statement(mDbConnection, "DELETE FROM systemkill WHERE killtime < ?;");
+    sqlite3_bind_text(kills.get(), 1, oldest.c_str(), oldest.length(), nullptr);
+    sqlite3_step(kills.get());
+
+    auto watermarks = db::make_statement(mDbConnection, "DELETE FROM killwatermark WHERE checked < ?;");
+    sqlite3_bind_text(watermarks.get(), 1, oldest.c_str(), oldest.length(), nullptr);
+    sqlite3_step(watermarks.get());
+}
+
+const std::vector<eo::KillHistory::Kill> &eo::KillHistory::get(int32 systemID) { return load(systemID).kills; }
+
+void eo::KillHistory::refresh(int32 systemID, RequestPriority priority, CancellationToken token)
+{
+    auto &history = load(systemID);
+
+    const auto now = std::chrono::system_clock::now();
+    if (now - history.watermark.checked < refresh_interval
+        || std::chrono::steady_clock::now() - history.requested < refresh_interval) {
+        return;
+    }
+    history.requested = std::chrono::steady_clock::now();
+
+    // Asking again right away is fine if the refresh gets cancelled before zkillboard answered
+    const auto handler = token.onCancel([this, systemID, requested = history.requested, alive = std::weak_ptr<void>(mAlive)] {
+        if (alive.expired()) {
+            return;
+        }
+        if (auto &history = load(systemID); history.requested == requested && history.unresolved == 0) {
+            history.requested = {};
+        }
+    });
+    // The session drops the callback once zkillboard answered or the request failed, the handler is not needed after that
+    const auto answered = Token(nullptr, [token, handler](void *) { token.removeHandler(handler); });
+
+    auto merged = [this, systemID, priority, token, answered](const std::vector<esi::ZkbKill> &kills) {
+        merge(systemID, kills, priority, token);
+    };
+
+    const auto past = std::chrono::ceil<std::chrono::hours>(now - history.watermark.checked);
+    if (history.watermark.killmailID == 0 || past > history_keep) {
+        mEsiSession->getKillsInSystemAsync(systemID, history_length, std::move(merged), priority, token);
+    } else {
+        mEsiSession->getNewKillsInSystemAsync(systemID, history.watermark.killmailID, past, std::move(merged), priority, token);
+    }
+}
+
+eo::KillHistory::SystemHistory &eo::KillHistory::load(int32 systemID)
+{
+    const auto [it, inserted] = mHistories.try_emplace(systemID);
+    auto &history             = it->second;
+    if (!inserted) {
+        return history;
+    }
+
+    auto select = db::make_statement(mDbConnection,
+                                     "SELECT killmailid, killtime, victimid, victimname, shiptypeid, shipname FROM systemkill "
+                                     "WHERE systemid = ? ORDER BY killtime DESC LIMIT ?;");
+    sqlite3_bind_int(select.get(), 1, systemID);
+    sqlite3_bind_int(select.get(), 2, history_length);
+    while (sqlite3_step(select.get()) == SQLITE_ROW) {
+        auto &kill      = history.kills.emplace_back();
+        kill.killmailID = sqlite3_column_int(select.get(), 0);
+        kill.killTime   = db::column_get_string(select.get(), 1);
+        kill.victimID   = sqlite3_column_int(select.get(), 2);
+        kill.victimName = db::column_get_string(select.get(), 3);
+        kill.shipTypeID = sqlite3_column_int(select.get(), 4);
+        kill.shipName   = db::column_get_string(select.get(), 5);
+    }
+
+    auto watermark = db::make_statement(mDbConnection, "SELECT killmailid, checked FROM killwatermark WHERE systemid = ?;");
+    sqlite3_bind_int(watermark.get(), 1, systemID);
+    if (sqlite3_step(watermark.get()) == SQLITE_ROW) {
+        history.watermark.killmailID = sqlite3_column_int(watermark.get(), 0);
+        history.watermark.checked    = parse_esi_time(db::column_get_string(watermark.get(), 1));
+    }
+
+    return history;
+}
+
+void eo::KillHistory::merge(int32 systemID, std::vector<esi::ZkbKill> kills, RequestPriority priority, const CancellationToken &token)
+{
+    auto &history = load(systemID);
+
+    // Everything at or below the watermark is already resolved and stored
+    const auto seen = history.watermark.killmailID;
+    kills.erase(std::remove_if(begin(kills), end(kills), [seen](auto &&k) { return k.killmailID <= seen; }), end(kills));
+
+    // Newest first, killmail ids grow with time
+    std::sort(begin(kills), end(kills), [](auto &&a, auto &&b) { return a.killmailID > b.killmailID; });
+    if (kills.size() > history_length) {
+        kills.resize(history_length);
+    }
+
+    history.merged.killmailID = kills.empty() ? seen : kills.front().killmailID;
+    history.merged.checked    = std::chrono::system_clock::now();
+
+    log::info("Got {0} new kills in system {1}", kills.size(), systemID);
+    if (kills.empty()) {
+        history.watermark = history.merged;
+        storeWatermark(systemID, history.watermark);
+        return;
+    }
+
+    if (history.unresolved == 0) {
+        history.failed = 0;
+    }
+    history.unresolved += kills.size();
+    history.firstRow  = false;
+    history.cancelled = false;
+    history.mergedAt  = std::chrono::steady_clock::now();
+
+    // Queued kills of a cancelled refresh are dropped right away instead of waiting for their turn.
+    // The items share the removal of the handler, it goes with the last kill of the merge
+    const auto handler = token.onCancel([this, alive = std::weak_ptr<void>(mAlive)] {
+        if (!alive.expired()) {
+            schedulePump();
+        }
+    });
+    const auto batch = Token(nullptr, [token, handler](void *) { token.removeHandler(handler); });
+
+    std::vector<QueuedKillmail> queued;
+    queued.reserve(kills.size());
+    for (auto &kill : kills) {
+        auto item   = makeItem(systemID, kill.killmailID, token);
+        item->batch = batch;
+        queued.push_back({ systemID, std::move(kill), priority, token, std::move(item) });
+    }
+
+    // Kills the user is looking at skip the prefetched ones
+    if (priority == RequestPriority::High) {
+        mKillmailQueue.insert(begin(mKillmailQueue), std::make_move_iterator(begin(queued)), std::make_move_iterator(end(queued)));
+    } else {
+        mKillmailQueue.insert(end(mKillmailQueue), std::make_move_iterator(begin(queued)), std::make_move_iterator(end(queued)));
+    }
+
+    pump();
+}
+
+void eo::KillHistory::insert(int32 systemID, Kill kill)
+{
+    auto stmt = db::make_statement(mDbConnection, "INSERT OR IGNORE INTO systemkill VALUES(?,?,?,?,?,?,?)");
+    sqlite3_bind_int(stmt.get(), 1, systemID);
+    sqlite3_bind_int(stmt.get(), 2, kill.killmailID);
+    sqlite3_bind_text(stmt.get(), 3, kill.killTime.c_str(), kill.killTime.length(), nullptr);
+    sqlite3_bind_int(stmt.get(), 4, kill.victimID);
+    sqlite3_bind_text(stmt.get(), 5, kill.victimName.c_str(), kill.victimName.length(), nullptr);
+    sqlite3_bind_int(stmt.get(), 6, kill.shipTypeID);
+    sqlite3_bind_text(stmt.get(), 7, kill.shipName.c_str(), kill.shipName.length(), nullptr);
+    sqlite3_step(stmt.get());
+
+    auto &kills = load(systemID).kills;
+    if (std::any_of(begin(kills), end(kills), [&kill](auto &&k) { return k.killmailID == kill.killmailID; })) {
+        return;
+    }
+
+    // Kills resolve in any order, keep the history sorted by time
+    const auto position = std::upper_bound(begin(kills), end(kills), kill, [](auto &&a, auto &&b) { return a.killTime > b.killTime; });
+    kills.insert(position, std::move(kill));
+    if (kills.size() > history_length) {
+        kills.pop_back();
+    }
+
+    if (auto &history = load(systemID); !history.firstRow) {
+        history.firstRow = true;
+        log::info("First new kill of system {0} after {1} ms", systemID,
+                  std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - history.mergedAt).count());
+    }
+}
+
+void eo::KillHistory::storeWatermark(int32 systemID, const Watermark &watermark)
+{
+    const auto checked = format_esi_time(watermark.checked);
+
+    auto stmt = db::make_statement(mDbConnection, "INSERT OR REPLACE INTO killwatermark VALUES(?,?,?)");
+    sqlite3_bind_int(stmt.get(), 1, systemID);
+    sqlite3_bind_int(stmt.get(), 2, watermark.killmailID);
+    sqlite3_bind_text(stmt.get(), 3, checked.c_str(), checked.length(), nullptr);
+    sqlite3_step(stmt.get());
+}
+
+eo::KillHistory::Token eo::KillHistory::acquire(Stage &stage)
+{
+    ++stage.inFlight;
+    return Token(nullptr, [this, &stage, alive = std::weak_ptr<void>(mAlive)](void *) {
+        if (alive.expired()) {
+            return; // The session outlives us with callbacks still pending
+        }
+        --stage.inFlight;
+        schedulePump();
+    });
+}
+
+eo::KillHistory::ItemToken eo::KillHistory::makeItem(int32 systemID, int32 killmailID, CancellationToken token)
+{
+    auto created        = std::make_unique<Item>();
+    created->killmailID = killmailID;
+    return ItemToken(created.release(), [this, systemID, token = std::move(token), alive = std::weak_ptr<void>(mAlive)](Item *item) {
+        const std::unique_ptr<Item> owned(item);
+        if (alive.expired()) {
+            return;
+        }
+
+        auto &history = load(systemID);
+        history.cancelled |= token.isCancelled();
+        if (!item->resolved && !token.isCancelled()) {
+            history.failed = history.failed == 0 ? item->killmailID : std::min(history.failed, item->killmailID);
+        }
+        if (--history.unresolved > 0) {
+            return;
+        }
+
+        if (history.cancelled) {
+            // Some kills above the old watermark are missing, the next refresh asks for them again
+            log::info("Cancelled resolving the new kills of system {0}", systemID);
+            history.requested = {};
+            return;
+        }
+
+        if (history.failed != 0) {
+            // Everything below the oldest failed kill is stored. The check time stays, so the next refresh
+            // asks zkillboard for the same hours again and retries the failed kill after the refresh_interval
+            log::error("Could not resolve all new kills of system {0}, the oldest missing one is {1}", systemID, history.failed);
+            history.watermark.killmailID = std::max(history.watermark.killmailID, history.failed - 1);
+            storeWatermark(systemID, history.watermark);
+            return;
+        }
+
+        history.watermark = history.merged;
+        storeWatermark(systemID, history.watermark);
+        log::info("Resolved the new kills of system {0} in {1} ms", systemID,
+                  std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - history.mergedAt).count());
+    });
+}
+
+void eo::KillHistory::schedulePump()
+{
+    // Slots are released while the session still works on its pending requests, so never start requests from there
+    if (mPumpScheduled) {
+        return;
+    }
+    mPumpScheduled = true;
+    net::post(*mIOState->getIoC(), [this] {
+        mPumpScheduled = false;
+        pump();
+    });
+}
+
+void eo::KillHistory::pump()
+{
+    const auto cancelled = [](auto &&queued) { return queued.token.isCancelled(); };
+    mVictimQueue.erase(std::remove_if(begin(mVictimQueue), end(mVictimQueue), cancelled), end(mVictimQueue));
+    mKillmailQueue.erase(std::remove_if(begin(mKillmailQueue), end(mKillmailQueue), cancelled), end(mKillmailQueue));
+
+    // Victims first, they finish a row
+    while (mVictimStage.inFlight < mVictimStage.limit && !mVictimQueue.empty()) {
+        auto queued = std::move(mVictimQueue.front());
+        mVictimQueue.pop_front();
+        resolveVictim(std::move(queued));
+    }
+
+    while (mKillmailStage.inFlight < mKillmailStage.limit && !mKillmailQueue.empty()) {
+        auto queued = std::move(mKillmailQueue.front());
+        mKillmailQueue.pop_front();
+        resolveKillmail(std::move(queued));
+    }
+}
+
+void eo::KillHistory::resolveKillmail(QueuedKillmail queued)
+{
+    // The callback takes queued, copy what the call needs first
+    const auto killmailID = queued.kill.killmailID;
+    const auto hash       = queued.kill.killmailHash;
+    const auto priority   = queued.priority;
+    const auto token      = queued.token;
+    mEsiSession->resolveKillmailAsync(
+        killmailID, hash,
+        [this, queued = std::move(queued), slot = acquire(mKillmailStage)](const esi::Killmail &killmail) {
+            Kill kill;
+            kill.killmailID = killmail.killmailID;
+            kill.killTime   = killmail.killTime;
+            try {
+                const auto victim = json::parse(killmail.victimJson);
+                victim.at("character_id").get_to(kill.victimID);
+                victim.at("ship_type_id").get_to(kill.shipTypeID);
+            } catch (const json::exception &) {
+                queued.item->resolved = true;
+                return; // Structures and npcs have no character
+            }
+            kill.shipName = mEsiSession->getTypeName(kill.shipTypeID);
+
+            mVictimQueue.push_back({ queued.systemID, std::move(kill), queued.priority, queued.token, queued.item });
+            schedulePump();
+        },
+        priority, token);
+}
+
+void eo::KillHistory::resolveVictim(QueuedVictim queued)
+{
+    const auto characterID = queued.kill.victimID;
+    const auto priority    = queued.priority;
+    const auto token       = queued.token;
+    mEsiSession->convertCharacterIDAsync(
+        characterID,
+        [this, queued = std::move(queued), slot = acquire(mVictimStage)](const esi::Character &character) {
+            auto kill       = queued.kill;
+            kill.victimName = character.name;
+            insert(queued.systemID, std::move(kill));
+            queued.item->resolved = true;
+        },
+        priority, token);
+}
@@ -0,0 +1,151 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "db.h"
+#include "esisession.h"
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+namespace eo {
+
+/*
+ * The latest kills of each system, resolved and stored in the database.
+ *  - Every system has a watermark: The highest killmail id seen and when zkillboard was last asked
+ *  - A refresh only asks for the kills since then and resolves the ones above the watermark
+ *  - Coming back to a system shows the stored history right away
+ *  - New kills go through two stages, killmail and victim, each with a bound on the requests in flight.
+ *    The newest kills go first so the first rows show up as soon as possible.
+ *  - A cancelled refresh drops its queued kills and keeps the old watermark, the next refresh asks again
+ *  - If some kills fail to resolve, the watermark only moves up to the oldest of them
+ */
+class KillHistory {
+public:
+    constexpr static auto refresh_interval = std::chrono::minutes(2);
+    constexpr static auto history_keep     = std::chrono::hours(24 * 7);
+    constexpr static int  history_length   = 20;
+    // Requests in flight per stage, the IOState runs at most 8 at once
+    constexpr static int killmails_in_flight = 4;
+    constexpr static int victims_in_flight   = 4;
+
+    struct Kill {
+        int32       killmailID = 0;
+        std::string killTime; // esi time, newest first
+        int32       victimID = 0;
+        std::string victimName;
+        int32       shipTypeID = 0;
+        std::string shipName;
+    };
+
+    KillHistory(db::SqliteSPtr              dbconnection,
+                std::shared_ptr<EsiSession> session,
+                std::shared_ptr<IOState>    iostate,
+                int                         killmailsInFlight = killmails_in_flight,
+                int                         victimsInFlight   = victims_in_flight);
+
+    KillHistory(const KillHistory &) = delete;
+    KillHistory &operator=(const KillHistory &) = delete;
+
+    // Newest first, loaded from the database on the first call for a system
+    const std::vector<Kill> &get(int32 systemID);
+
+    // Does nothing if the system was refreshed in the last refresh_interval
+    void refresh(int32 systemID, RequestPriority priority = RequestPriority::High, CancellationToken token = {});
+
+private:
+    struct Watermark {
+        int32                                 killmailID = 0;
+        std::chrono::system_clock::time_point checked{};
+    };
+
+    struct SystemHistory {
+        std::vector<Kill> kills;
+        Watermark         watermark;
+        // Failed requests are retried after the refresh_interval
+        std::chrono::steady_clock::time_point requested{};
+
+        // The kills of the last merge still in the pipeline, to measure the time to the first row and to complete
+        int                                   unresolved = 0;
+        bool                                  firstRow   = false;
+        bool                                  cancelled  = false;
+        int32                                 failed     = 0; // Oldest kill that did not resolve, 0 if there is none
+        std::chrono::steady_clock::time_point mergedAt{};
+        // Becomes the watermark once the merged kills are through the pipeline
+        Watermark merged;
+    };
+
+    // Released when the last copy is gone, that is also when the session drops the callback of a failed request
+    using Token = std::shared_ptr<void>;
+
+    // One per merged kill, set to resolved once the kill is stored or turned out to have no victim
+    struct Item {
+        int32 killmailID = 0;
+        bool  resolved   = false;
+        Token batch; // Shared by the kills of one merge
+    };
+    using ItemToken = std::shared_ptr<Item>;
+
+    struct Stage {
+        int limit    = 0;
+        int inFlight = 0;
+    };
+
+    struct QueuedKillmail {
+        int32             systemID;
+        esi::ZkbKill      kill;
+        RequestPriority   priority;
+        CancellationToken token;
+        ItemToken         item;
+    };
+
+    struct QueuedVictim {
+        int32             systemID;
+        Kill              kill;
+        RequestPriority   priority;
+        CancellationToken token;
+        ItemToken         item;
+    };
+
+    SystemHistory &load(int32 systemID);
+    void           merge(int32 systemID, std::vector<esi::ZkbKill> kills, RequestPriority priority, const CancellationToken &token);
+    void           insert(int32 systemID, Kill kill);
+    void           storeWatermark(int32 systemID, const Watermark &watermark);
+
+    Token     acquire(Stage &stage);
+    ItemToken makeItem(int32 systemID, int32 killmailID, CancellationToken token);
+    void      schedulePump();
+    void      pump();
+    void      resolveKillmail(QueuedKillmail queued);
+    void      resolveVictim(QueuedVictim queued);
+
+    std::unordered_map<int32, SystemHistory> mHistories;
+
+    Stage                      mKillmailStage;
+    Stage                      mVictimStage;
+    std::deque<QueuedKillmail> mKillmailQueue;
+    std::deque<QueuedVictim>   mVictimQueue;
+    bool                       mPumpScheduled = false;
+
+    db::SqliteSPtr              mDbConnection;
+    std::shared_ptr<EsiSession> mEsiSession;
+    std::shared_ptr<IOState>    mIOState;
+
+    // Last member, gone before anything a token touches
+    Token mAlive = std::make_shared<char>();
+};
+}
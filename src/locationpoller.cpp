@@ -0,0 +1,146 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "locationpoller.h"
+#include "logging.h"
+
+#include <algorithm>
+
+eo::LocationPoller::LocationPoller(std::shared_ptr<EsiSession> session)
+    : mEsiSession(std::move(session))
+{
+    if (!mEsiSession) {
+        throw std::logic_error("LocationPoller requires a valid session");
+    }
+
+    for (const auto characterID : mEsiSession->getCharacterIDs()) {
+        addCharacter(characterID);
+    }
+
+    mEsiSession->addCharacterListener([this](int32 characterID) { addCharacter(characterID); });
+}
+
+eo::LocationPoller::~LocationPoller()
+{
+    for (auto &[id, character] : mCharacters) {
+        character.timer->cancel();
+    }
+}
+
+void eo::LocationPoller::addListener(LocationCallback callback, CancellationToken token)
+{
+    mListeners.emplace_back(std::move(callback), std::move(token));
+}
+
+const eo::esi::CharacterLocation *eo::LocationPoller::getLocation(int32 characterID) const
+{
+    const auto it = mCharacters.find(characterID);
+    if (it == end(mCharacters) || !it->second.known) {
+        return nullptr;
+    }
+    return &it->second.location;
+}
+
+void eo::LocationPoller::addCharacter(int32 characterID)
+{
+    if (mCharacters.find(characterID) != end(mCharacters)) {
+        return;
+    }
+
+    // Spread the characters over the interval instead of polling all at once
+    const auto delay = (poll_stagger * mCharacters.size()) % cache_period;
+
+    auto &character = mCharacters[characterID];
+    character.timer = std::make_unique<net::steady_timer>(*mEsiSession->getIOState().getIoC());
+    schedulePoll(characterID, delay);
+}
+
+void eo::LocationPoller::schedulePoll(int32 characterID, std::chrono::steady_clock::duration delay)
+{
+    auto &     character  = mCharacters.at(characterID);
+    const auto generation = ++character.generation;
+
+    character.timer->expires_after(delay);
+    character.timer->async_wait([this, characterID, generation](const boost::system::error_code &ec) {
+        // A handler which was already queued can not be cancelled anymore
+        if (ec || mCharacters.at(characterID).generation != generation) {
+            return;
+        }
+        poll(characterID);
+    });
+}
+
+void eo::LocationPoller::poll(int32 characterID)
+{
+    // Replaced once the response arrives, keeps the polling alive if the request fails
+    schedulePoll(characterID, fallback_interval);
+
+    mEsiSession->getCharacterLocationAsync(characterID, [this, characterID](const esi::CharacterLocation &location) {
+        updateLocation(characterID, location);
+        schedulePoll(characterID, nextPollDelay(mCharacters.at(characterID)));
+    });
+}
+
+void eo::LocationPoller::updateLocation(int32 characterID, const esi::CharacterLocation &location)
+{
+    auto &character = mCharacters.at(characterID);
+
+    const bool changed = !character.known || character.location.solarSystemID != location.solarSystemID
+                         || character.location.stationID != location.stationID
+                         || character.location.structureID != location.structureID;
+
+    character.location       = location;
+    character.known          = true;
+    character.unchangedPolls = changed ? 0 : character.unchangedPolls + 1;
+
+    if (!changed) {
+        return;
+    }
+
+    log::info("Character {0} is now in system {1}", characterID, location.solarSystemID);
+
+    // The owner of a cancelled listener might be gone already
+    const auto cancelled = [](auto &&listener) { return listener.second.isCancelled(); };
+    mListeners.erase(std::remove_if(begin(mListeners), end(mListeners), cancelled), end(mListeners));
+
+    // Listeners might add listeners
+    for (std::size_t i = 0; i < mListeners.size(); i++) {
+        if (!mListeners[i].second.isCancelled()) {
+            mListeners[i].first(characterID, location);
+        }
+    }
+}
+
+std::chrono::steady_clock::duration eo::LocationPoller::nextPollDelay(const PolledCharacter &character)
+{
+    if (!character.location.expires) {
+        return fallback_interval;
+    }
+
+    const auto now  = std::chrono::steady_clock::now();
+    auto       next = std::max(*character.location.expires, now) + expiry_slack;
+
+    const bool docked    = character.location.isDocked();
+    const int  threshold = docked ? 1 : backoff_after;
+    if (character.unchangedPolls >= threshold) {
+        // Skip whole cache periods so the polls stay right behind an expiry
+        const int maxskipped = static_cast<int>(max_idle_interval / cache_period) - 1;
+        const int doublings  = std::min(character.unchangedPolls - threshold + 1, 8);
+        next += cache_period * std::min((1 << doublings) - 1, maxskipped);
+    }
+
+    return next - now;
+}
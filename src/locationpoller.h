@@ -0,0 +1,88 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "esisession.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/asio/steady_timer.hpp>
+
+namespace eo {
+
+/*
+ * Polls the location of every character of the session.
+ * Each character has its own timer, the first polls are staggered
+ * so the characters do not all hit esi at the same time.
+ *
+ * Esi caches the location for a few seconds and tells us until when with
+ * the Expires header. A moving character is polled right after the
+ * expiry, an idle or docked character skips a cache period.
+ */
+class LocationPoller {
+public:
+    using LocationCallback = std::function<void(int32 characterID, const esi::CharacterLocation &)>;
+
+    // Used if the response had no expiry or the request failed
+    constexpr static auto fallback_interval = std::chrono::seconds(10);
+    constexpr static auto poll_stagger      = std::chrono::seconds(1);
+    // Poll a bit after the expiry so we do not get the old cached response
+    constexpr static auto expiry_slack = std::chrono::milliseconds(250);
+    // How long esi caches the location
+    constexpr static auto cache_period = std::chrono::seconds(5);
+
+    // Unchanged polls before backing off, docked characters back off right away.
+    // Never slower than the old fixed interval, a jump or an undock still shows up within it
+    constexpr static int  backoff_after     = 6;
+    constexpr static auto max_idle_interval = fallback_interval;
+
+    explicit LocationPoller(std::shared_ptr<EsiSession> session);
+    ~LocationPoller();
+
+    LocationPoller(const LocationPoller &) = delete;
+    LocationPoller &operator=(const LocationPoller &) = delete;
+
+    // Gets called whenever the location of a character changed, until the token is cancelled
+    void addListener(LocationCallback callback, CancellationToken token = {});
+
+    // nullptr if the location was not retrieved yet
+    [[nodiscard]] const esi::CharacterLocation *getLocation(int32 characterID) const;
+
+private:
+    struct PolledCharacter {
+        std::unique_ptr<net::steady_timer> timer;
+        esi::CharacterLocation             location{};
+        bool                               known          = false;
+        int                                unchangedPolls = 0;
+        // Only the latest scheduled poll may fire
+        unsigned generation = 0;
+    };
+
+    void addCharacter(int32 characterID);
+    void schedulePoll(int32 characterID, std::chrono::steady_clock::duration delay);
+    void poll(int32 characterID);
+    void updateLocation(int32 characterID, const esi::CharacterLocation &location);
+
+    [[nodiscard]] static std::chrono::steady_clock::duration nextPollDelay(const PolledCharacter &character);
+
+    std::map<int32, PolledCharacter>                            mCharacters;
+    std::vector<std::pair<LocationCallback, CancellationToken>> mListeners;
+    std::shared_ptr<EsiSession>                                 mEsiSession;
+};
+}
@@ -0,0 +1,121 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <limits>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace eo {
+
+// Weight of a cached value without heap allocations
+struct ShallowWeight {
+    template<typename Value>
+    std::size_t operator()(const Value &) const
+    {
+        return sizeof(Value);
+    }
+};
+
+struct CacheStats {
+    std::size_t hits    = 0;
+    std::size_t misses  = 0;
+    std::size_t entries = 0;
+    std::size_t bytes   = 0;
+
+    [[nodiscard]] double hitRatio() const { return hits + misses == 0 ? 0. : static_cast<double>(hits) / (hits + misses); }
+};
+
+/*
+ * Map which holds at most capacity entries and byteBudget bytes, the least recently used entries get evicted.
+ * The bytes are estimated with the Weight of the values, cached values must not be changed through get().
+ * Not synchronized, everything which uses it runs on the thread polling the IOState.
+ */
+template<typename Key, typename Value, typename Weight = ShallowWeight>
+class LruCache {
+public:
+    // The list node and the index node of an entry
+    constexpr static std::size_t entry_overhead = sizeof(Key) + 6 * sizeof(void *);
+
+    explicit LruCache(std::size_t capacity, std::size_t byteBudget = std::numeric_limits<std::size_t>::max())
+        : mCapacity(capacity)
+        , mByteBudget(byteBudget)
+    {
+    }
+
+    // nullptr if the key is not cached, otherwise the entry becomes the most recently used one
+    const Value *get(const Key &key)
+    {
+        const auto it = mIndex.find(key);
+        if (it == end(mIndex)) {
+            ++mMisses;
+            return nullptr;
+        }
+        ++mHits;
+        mEntries.splice(begin(mEntries), mEntries, it->second);
+        return &it->second->value;
+    }
+
+    void put(const Key &key, Value value)
+    {
+        erase(key);
+
+        const auto bytes = entry_overhead + Weight{}(value);
+        mEntries.push_front({ key, std::move(value), bytes });
+        mIndex.emplace(key, begin(mEntries));
+        mBytes += bytes;
+
+        // Keeps at least the new entry even if it alone is over the budget
+        while (mEntries.size() > 1 && (mEntries.size() > mCapacity || mBytes > mByteBudget)) {
+            erase(mEntries.back().key);
+        }
+    }
+
+    void erase(const Key &key)
+    {
+        const auto it = mIndex.find(key);
+        if (it != end(mIndex)) {
+            mBytes -= it->second->bytes;
+            mEntries.erase(it->second);
+            mIndex.erase(it);
+        }
+    }
+
+    [[nodiscard]] bool        contains(const Key &key) const { return mIndex.find(key) != end(mIndex); }
+    [[nodiscard]] std::size_t size() const { return mEntries.size(); }
+    [[nodiscard]] std::size_t capacity() const { return mCapacity; }
+    [[nodiscard]] std::size_t bytes() const { return mBytes; }
+    [[nodiscard]] std::size_t byteBudget() const { return mByteBudget; }
+    [[nodiscard]] CacheStats  stats() const { return { mHits, mMisses, mEntries.size(), mBytes }; }
+
+private:
+    struct Entry {
+        Key         key;
+        Value       value;
+        std::size_t bytes;
+    };
+
+    // Most recently used first
+    std::list<Entry>                                             mEntries;
+    std::unordered_map<Key, typename std::list<Entry>::iterator> mIndex;
+    std::size_t                                                  mCapacity;
+    std::size_t                                                  mByteBudget;
+    std::size_t                                                  mBytes  = 0;
+    std::size_t                                                  mHits   = 0;
+    std::size_t                                                  mMisses = 0;
+};
+}
@@ -0,0 +1,126 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "requests.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace eo {
+
+/*
+ * Coalesces requests for the same key, e.g. two characters in the same system:
+ * Only the first caller makes the request, everyone gets the result.
+ * Cancelled callers are dropped, the request itself is cancelled once nobody waits for it anymore.
+ */
+template<typename Key, typename Value>
+class PendingRequests {
+public:
+    using Callback = std::function<void(const Value &)>;
+
+    // Returns true if there was no request for the key yet and the caller has to make it with requestToken(key)
+    bool add(const Key &key, Callback callback, CancellationToken token = {})
+    {
+        if (token.isCancelled()) {
+            return false;
+        }
+
+        auto [it, inserted] = mPending.try_emplace(key);
+        const auto handler  = token.onCancel([this, key] { cancelled(key); });
+        it->second.callbacks.push_back({ std::move(callback), token, handler });
+        return inserted;
+    }
+
+    void resolve(const Key &key, const Value &value)
+    {
+        const auto it = mPending.find(key);
+        if (it == end(mPending)) {
+            return;
+        }
+
+        // Callbacks might add new requests for the same key
+        auto waiting = std::move(it->second);
+        mPending.erase(it);
+        release(waiting);
+
+        for (auto &caller : waiting.callbacks) {
+            if (!caller.token.isCancelled()) {
+                caller.callback(value);
+            }
+        }
+    }
+
+    // Drops the callbacks e.g. if the request failed
+    void discard(const Key &key)
+    {
+        if (const auto it = mPending.find(key); it != end(mPending)) {
+            release(it->second);
+            mPending.erase(it);
+        }
+    }
+
+    // Cancelled once every caller waiting for the key cancelled
+    [[nodiscard]] CancellationToken requestToken(const Key &key) const
+    {
+        const auto it = mPending.find(key);
+        return it == end(mPending) ? CancellationToken{} : it->second.request;
+    }
+
+    [[nodiscard]] bool        isPending(const Key &key) const { return mPending.find(key) != end(mPending); }
+    [[nodiscard]] std::size_t size() const { return mPending.size(); }
+
+private:
+    struct Caller {
+        Callback          callback;
+        CancellationToken token;
+        std::size_t       handler; // Of the token, removed once the key is done
+    };
+
+    struct Waiting {
+        std::vector<Caller> callbacks;
+        CancellationToken   request = CancellationToken::make();
+    };
+
+    // The tokens of the callers often live much longer than one request
+    static void release(const Waiting &waiting)
+    {
+        for (const auto &caller : waiting.callbacks) {
+            caller.token.removeHandler(caller.handler);
+        }
+    }
+
+    void cancelled(const Key &key)
+    {
+        const auto it = mPending.find(key);
+        if (it == end(mPending)) {
+            return;
+        }
+
+        const auto &callbacks = it->second.callbacks;
+        if (std::all_of(begin(callbacks), end(callbacks), [](auto &&caller) { return caller.token.isCancelled(); })) {
+            const auto request = it->second.request;
+            release(it->second);
+            mPending.erase(it);
+            request.cancel();
+        }
+    }
+
+    std::map<Key, Waiting> mPending;
+};
+}
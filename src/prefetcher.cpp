@@ -0,0 +1,107 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "prefetcher.h"
+#include "logging.h"
+
+#include <nlohmann/json.hpp>
+
+eo::Prefetcher::Prefetcher(std::shared_ptr<EsiSession> session, LocationPoller &poller)
+    : mEsiSession(std::move(session))
+{
+    poller.addListener([this](int32, const esi::CharacterLocation &location) { prefetchAround(location.solarSystemID); });
+}
+
+void eo::Prefetcher::prefetchAround(int32 solarSystemID)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (const auto visited = mVisited.get(solarSystemID); visited && now - *visited < revisit_interval) {
+        return;
+    }
+    mVisited.put(solarSystemID, now);
+
+    const auto &universe = mEsiSession->getUniverse();
+    const auto  index    = universe.indexOf(solarSystemID);
+    if (index == UniverseGraph::invalid_index) {
+        return; // Stargates not known yet
+    }
+
+    // A new round, whatever is left of the previous one is not needed anymore
+    mRound.cancel();
+    mRound  = CancellationToken::make();
+    mBudget = request_budget;
+    ++mGeneration;
+
+    const auto [first, last] = universe.neighbours(index);
+    log::info("Prefetching {0} systems around {1}", last - first, solarSystemID);
+    for (auto it = first; it != last; ++it) {
+        prefetchSystem(universe.systemID(*it), mGeneration);
+    }
+}
+
+void eo::Prefetcher::prefetchSystem(int32 solarSystemID, unsigned generation)
+{
+    if (!spend(generation)) {
+        return;
+    }
+    mEsiSession->resolveSolarSystemAsync(
+        solarSystemID, [](auto &&) {}, RequestPriority::Low, mRound);
+
+    if (!spend(generation)) {
+        return;
+    }
+    mEsiSession->getKillsInSystemAsync(
+        solarSystemID, kills_per_system,
+        [this, generation](const std::vector<esi::ZkbKill> &kills) {
+            for (const auto &kill : kills) {
+                prefetchKillmail(kill, generation);
+            }
+        },
+        RequestPriority::Low, mRound);
+}
+
+void eo::Prefetcher::prefetchKillmail(const esi::ZkbKill &kill, unsigned generation)
+{
+    if (!spend(generation)) {
+        return;
+    }
+
+    mEsiSession->resolveKillmailAsync(
+        kill.killmailID, kill.killmailHash,
+        [this, generation](const esi::Killmail &killmail) {
+            int32 victim = 0;
+            try {
+                victim = nlohmann::json::parse(killmail.victimJson).at("character_id");
+            } catch (const nlohmann::json::exception &) {
+                return; // Structures and npcs have no character
+            }
+
+            if (spend(generation)) {
+                mEsiSession->convertCharacterIDAsync(
+                    victim, [](auto &&) {}, RequestPriority::Low, mRound);
+            }
+        },
+        RequestPriority::Low, mRound);
+}
+
+bool eo::Prefetcher::spend(unsigned generation)
+{
+    if (generation != mGeneration || mBudget <= 0) {
+        return false;
+    }
+    --mBudget;
+    return true;
+}
@@ -0,0 +1,62 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "esisession.h"
+#include "locationpoller.h"
+#include "lrucache.h"
+
+#include <memory>
+
+namespace eo {
+
+/*
+ * Warms the caches for the systems one jump away from where a character just arrived:
+ * System data, kill list, the latest killmails and their victims, all as low priority requests.
+ * Each jump has a budget of requests and cancels what is left of the previous jump,
+ * recently visited systems are not prefetched again.
+ */
+class Prefetcher {
+public:
+    // Calls into the session, most of them are served by the caches without a request
+    constexpr static int         request_budget   = 64;
+    constexpr static int         kills_per_system = 5;
+    constexpr static std::size_t visited_systems  = 16;
+    // A system visited this recently still has warm neighbours
+    constexpr static auto revisit_interval = std::chrono::minutes(2);
+
+    Prefetcher(std::shared_ptr<EsiSession> session, LocationPoller &poller);
+
+    void prefetchAround(int32 solarSystemID);
+
+    [[nodiscard]] int getRemainingBudget() const { return mBudget; }
+
+private:
+    void prefetchSystem(int32 solarSystemID, unsigned generation);
+    void prefetchKillmail(const esi::ZkbKill &kill, unsigned generation);
+
+    // False if the budget is used up or a newer jump started another round
+    bool spend(unsigned generation);
+
+    std::shared_ptr<EsiSession>                             mEsiSession;
+    LruCache<int32, std::chrono::steady_clock::time_point> mVisited{ visited_systems };
+
+    // Cancels the requests of the previous round which are still queued or running
+    CancellationToken mRound;
+    int               mBudget     = 0;
+    unsigned          mGeneration = 0;
+};
+}
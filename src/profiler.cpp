@@ -0,0 +1,174 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "profiler.h"
+
+#include "glad/glad.h"
+#include "imgui.h"
+
+#include <algorithm>
+#include <string>
+
+#include <fmt/core.h>
+
+namespace {
+constexpr std::array<const char *, eo::FrameProfiler::phase_count> phase_names = {
+    "Frame", "New frame", "Contents", "Layout", "Hash", "Upload", "Draw", "Swap", "Gpu",
+};
+
+constexpr float graph_height = 24.f;
+}
+
+void eo::FrameProfiler::add(Phase phase, double us)
+{
+    // The profiler might have been disabled while a timer was running
+    if (!mEnabled) {
+        return;
+    }
+
+    auto &series = mSeries[phase];
+    series.current += us;
+    series.timed = true;
+}
+
+void eo::FrameProfiler::endFrame()
+{
+    if (!mEnabled) {
+        return;
+    }
+
+    for (auto &series : mSeries) {
+        // A phase which did not run, e.g. the draw of a frame which was not presented, keeps its percentiles
+        if (!series.timed) {
+            continue;
+        }
+
+        series.samples[series.sampleCount % window_frames] = static_cast<float>(series.current);
+        series.sampleCount++;
+        series.current = 0.;
+        series.timed   = false;
+
+        mScratch.assign(begin(series.samples), begin(series.samples) + std::min(series.sampleCount, window_frames));
+        const auto percentile = [this](double p) {
+            const auto nth = begin(mScratch) + static_cast<std::ptrdiff_t>(p * (mScratch.size() - 1));
+            std::nth_element(begin(mScratch), nth, end(mScratch));
+            return *nth;
+        };
+
+        series.p50[series.graphNext] = percentile(.5);
+        series.p99[series.graphNext] = percentile(.99);
+        series.graphNext             = (series.graphNext + 1) % graph_frames;
+    }
+}
+
+void eo::FrameProfiler::setEnabled(bool enabled)
+{
+    mEnabled = enabled;
+    if (mEnabled && mSeries.empty()) {
+        mSeries.resize(phase_count);
+    }
+}
+
+void eo::FrameProfiler::renderPanel()
+{
+    ImGui::SetNextWindowBgAlpha(0.8f);
+    bool open = true;
+    if (ImGui::Begin("Profiler", &open, ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::Text("Rolling p50 and p99 over %zu frames, in us", window_frames);
+        ImGui::Text("Frame, Layout and the phases after it include this panel");
+
+        for (int phase = 0; phase < phase_count; ++phase) {
+            const auto &series = mSeries[phase];
+            if (series.sampleCount == 0) {
+                continue;
+            }
+
+            const auto last = (series.graphNext + graph_frames - 1) % graph_frames;
+            const auto max  = *std::max_element(begin(series.p99), end(series.p99));
+            const auto p50  = fmt::format("p50 {0:.0f}", series.p50[last]);
+            const auto p99  = fmt::format("p99 {0:.0f}", series.p99[last]);
+
+            // Both graphs share the scale, the p50 one shows how far the tail is off
+            ImGui::Text("%s", phase_names[phase]);
+            ImGui::PushID(phase);
+            ImGui::PlotLines("##p50", series.p50.data(), graph_frames, static_cast<int>(series.graphNext), p50.c_str(), 0.f, max,
+                             ImVec2(120.f, graph_height));
+            ImGui::SameLine();
+            ImGui::PlotLines("##p99", series.p99.data(), graph_frames, static_cast<int>(series.graphNext), p99.c_str(), 0.f, max,
+                             ImVec2(120.f, graph_height));
+            ImGui::PopID();
+        }
+    }
+    ImGui::End();
+
+    if (!open) {
+        setEnabled(false);
+    }
+}
+
+eo::GpuTimer::~GpuTimer()
+{
+    if (mQueries[0] != 0) {
+        glDeleteQueries(static_cast<GLsizei>(query_count), mQueries.data());
+    }
+}
+
+void eo::GpuTimer::begin()
+{
+    // Timer queries are core since 3.3, older contexts might have the extension
+    if (!(GLAD_GL_VERSION_3_3 || GLAD_GL_ARB_timer_query) || mPending == query_count) {
+        return;
+    }
+
+    if (mQueries[0] == 0) {
+        glGenQueries(static_cast<GLsizei>(query_count), mQueries.data());
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, mQueries[(mOldest + mPending) % query_count]);
+    mRunning = true;
+}
+
+void eo::GpuTimer::end()
+{
+    if (!mRunning) {
+        return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    mRunning = false;
+    mPending++;
+}
+
+void eo::GpuTimer::collect(FrameProfiler &profiler, FrameProfiler::Phase phase)
+{
+    // Results arrive in order, the first one which is not available ends the search
+    while (mPending > 0) {
+        const auto query     = mQueries[mOldest];
+        GLint      available = GL_FALSE;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE) {
+            break;
+        }
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        profiler.add(phase, elapsed / 1e3);
+
+        mOldest = (mOldest + 1) % query_count;
+        mPending--;
+    }
+}
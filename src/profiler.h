@@ -0,0 +1,124 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "util.h"
+
+namespace eo {
+
+/*
+ * Timings of the phases of the frames of a window:
+ *  - Scoped cpu timers, the times of a phase add up if it is timed several times in a frame
+ *  - Keeps the last samples of every phase and shows the rolling p50 and p99 as graphs
+ * Disabled profilers only check a flag, the timers do not read the clock and nothing is allocated.
+ */
+class FrameProfiler {
+public:
+    enum Phase { Frame, NewFrame, Contents, Layout, Hash, Upload, Draw, Swap, Gpu, phase_count };
+
+    constexpr static std::size_t window_frames = 120; // The percentiles are taken over these
+    constexpr static std::size_t graph_frames  = 240;
+
+    class Timer {
+    public:
+        Timer(FrameProfiler *profiler, Phase phase)
+            : mProfiler(profiler)
+            , mPhase(phase)
+        {
+            if (mProfiler) {
+                mStart = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~Timer()
+        {
+            if (mProfiler) {
+                mProfiler->add(mPhase, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - mStart).count());
+            }
+        }
+
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+    private:
+        FrameProfiler *                       mProfiler;
+        Phase                                 mPhase;
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    [[nodiscard]] Timer time(Phase phase) { return Timer(mEnabled ? this : nullptr, phase); }
+
+    // Microseconds spent in the phase during the current frame
+    void add(Phase phase, double us);
+    // Records the samples of the current frame
+    void endFrame();
+
+    void               setEnabled(bool enabled);
+    [[nodiscard]] bool isEnabled() const { return mEnabled; }
+
+    // An imgui window with the graphs, has to be called during an imgui frame. Closing it disables the profiler.
+    // Its own layout, upload and draw are part of the measured phases
+    void renderPanel();
+
+private:
+    struct Series {
+        std::array<float, window_frames> samples{};
+        std::array<float, graph_frames>  p50{}, p99{};
+        std::size_t                      sampleCount = 0;
+        std::size_t                      graphNext   = 0;
+        double                           current     = 0.;
+        bool                             timed       = false;
+    };
+
+    bool                mEnabled = false;
+    std::vector<Series> mSeries; // Allocated once enabled
+    std::vector<float>  mScratch;
+};
+
+/*
+ * GL_TIME_ELAPSED queries around a part of the frame, if the context supports timer queries.
+ * The results arrive some frames later and get added to the frame they arrived in.
+ * Uses the context current at the first begin(), which also has to be current when it is destroyed.
+ */
+class GpuTimer {
+public:
+    GpuTimer() = default;
+    ~GpuTimer();
+
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    // Skipped if every query is still waiting for its result
+    void begin();
+    void end();
+    // Adds the results which arrived to the phase
+    void collect(FrameProfiler &profiler, FrameProfiler::Phase phase);
+
+private:
+    constexpr static std::size_t query_count = 4;
+
+    std::array<uint, query_count> mQueries{};
+    std::size_t                   mOldest  = 0; // Of the queries in flight
+    std::size_t                   mPending = 0;
+    bool                          mRunning = false;
+};
+}
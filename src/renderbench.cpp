@@ -0,0 +1,182 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "imguiwindow.h"
+#include "logging.h"
+
+#include "glad/glad.h"
+#include "imgui.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr int warmup_frames = 5;   // Not measured, the first frames compile shaders and fill caches
+constexpr int dump_interval = 100; // Frames between two dumps
+
+/*
+ * The demo of ImguiWindow with every header open followed by a long list of systems.
+ * Scrolls a bit every frame, the output only depends on the frame number so dumps can be compared.
+ */
+class BenchWindow : public eo::ImguiWindow {
+public:
+    BenchWindow(int width, int height, int rows)
+        : ImguiWindow(width, height, "Render Benchmark", 0, 0)
+        , mRows(rows)
+    {
+    }
+
+protected:
+    void renderImguiContents() override
+    {
+        ImGui::Text("Frame %d", mFrame);
+
+        for (int i = 0; i < 12; ++i) {
+            const std::string is = std::to_string(i);
+            if (ImGui::CollapsingHeader(is.c_str(), ImGuiTreeNodeFlags_DefaultOpen)) {
+                for (int j = 0; j < 50; j++) {
+                    ImGui::Button("Drueck mich");
+                    ImGui::SameLine();
+                    ImGui::TextColored(ImVec4(1, 1, 0, 1), "Hallo %d Was geht", j);
+                }
+            }
+        }
+
+        for (int row = 0; row < mRows; ++row) {
+            const float security = std::fmod(row * 0.37f, 2.f) - 1.f;
+            ImGui::Text("%d", 30000000 + row);
+            ImGui::SameLine();
+            ImGui::TextColored(ImVec4(security < 0.f ? 1.f : 0.f, security < 0.f ? 0.f : 1.f, 0, 1), "%.1f", security);
+            ImGui::SameLine();
+            ImGui::Text("%d jumps, %d kills in the last hour", row % 40, row % 7);
+        }
+
+        ImGui::SetScrollY(std::fmod(mFrame * 23.f, ImGui::GetScrollMaxY() + 1.f));
+        ++mFrame;
+    }
+
+private:
+    int mRows;
+    int mFrame = 0;
+};
+
+// The cpu time of this thread, the rasterizer threads of llvmpipe do not count
+double thread_time_us()
+{
+    timespec time{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+// Portable arbitrary map, keeps the alpha of the transparent overlay
+void write_pam(const std::string &path, const std::vector<eo::byte> &pixels, eo::math::vec2 size)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        eo::log::error("Could not write {0}", path);
+        return;
+    }
+
+    file << "P7\nWIDTH " << static_cast<int>(size.x) << "\nHEIGHT " << static_cast<int>(size.y)
+         << "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+    file.write(reinterpret_cast<const char *>(pixels.data()), static_cast<std::streamsize>(pixels.size()));
+}
+
+double percentile(const std::vector<double> &sorted, double p)
+{
+    return sorted[std::min(sorted.size() - 1, static_cast<std::size_t>(p * sorted.size()))];
+}
+}
+
+/*
+ * Renders frames of a heavy ui headless (EGL, llvmpipe without a gpu) and reports the cpu time per frame.
+ * Usage: eo-render-bench [--frames n] [--rows n] [--width n] [--height n] [--dump directory]
+ * With --dump every 100th frame is written to the existing directory as frameNNNN.pam, e.g. to compare against golden images.
+ */
+int main(int argc, char **argv)
+{
+    int         frames = 500, rows = 5000, width = 1280, height = 720;
+    std::string dump;
+
+    for (int i = 1; i < argc; i += 2) {
+        const std::string option = argv[i];
+        if (i + 1 >= argc) {
+            eo::log::error("Missing the value of {0}", option);
+            return 1;
+        }
+
+        const char *value = argv[i + 1];
+        if (option == "--frames") {
+            frames = std::stoi(value);
+        } else if (option == "--rows") {
+            rows = std::stoi(value);
+        } else if (option == "--width") {
+            width = std::stoi(value);
+        } else if (option == "--height") {
+            height = std::stoi(value);
+        } else if (option == "--dump") {
+            dump = value;
+        } else {
+            eo::log::error("Unknown option {0}", option);
+            return 1;
+        }
+    }
+
+    eo::DisplayWindow::useHeadless();
+    BenchWindow window(width, height, rows);
+
+    std::vector<double> cpu, wall;
+    for (int frame = -warmup_frames; frame < frames; ++frame) {
+        const auto start_wall = std::chrono::steady_clock::now();
+        const auto start_cpu  = thread_time_us();
+        window.frame();
+        const auto end_cpu = thread_time_us();
+
+        if (frame >= 0) {
+            cpu.push_back(end_cpu - start_cpu);
+            wall.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_wall).count());
+        }
+
+        // Not measured, every frame starts with an idle renderer
+        glFinish();
+
+        if (!dump.empty() && frame >= 0 && frame % dump_interval == 0) {
+            write_pam(fmt::format("{0}/frame{1:04}.pam", dump, frame), window.readPixels(), window.getFramebufferSize());
+        }
+    }
+
+    if (cpu.empty()) {
+        return 0;
+    }
+
+    std::sort(begin(cpu), end(cpu));
+    const auto mean_cpu  = std::accumulate(begin(cpu), end(cpu), 0.) / cpu.size();
+    const auto mean_wall = std::accumulate(begin(wall), end(wall), 0.) / wall.size();
+
+    eo::log::info("{0} frames of {1} rows at {2}x{3}", frames, rows, width, height);
+    eo::log::info("cpu time per frame: mean {0:.0f} us, p50 {1:.0f} us, p99 {2:.0f} us, max {3:.0f} us", mean_cpu, percentile(cpu, .5),
+                  percentile(cpu, .99), cpu.back());
+    eo::log::info("wall time per frame: mean {0:.0f} us", mean_wall);
+
+    return 0;
+}
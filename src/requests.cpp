@@ -15,6 +15,8 @@
  */
 
 #include "requests.h"
+#include "logging.h"
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -22,26 +24,83 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/beast/version.hpp>
 
 namespace eo {
 namespace ssl = boost::asio::ssl;
 using tcp     = net::ip::tcp;
 
+namespace {
+    http::response<http::string_body> to_beast_response(const HttpResponse &response)
+    {
+        http::response<http::string_body> httpresponse{ std::piecewise_construct };
+        httpresponse.result(response.statusCode);
+        httpresponse.body() = response.body;
+
+        const auto makevisitor
+            = [&httpresponse](const auto &value) { return [&value, &httpresponse](const auto &header) { httpresponse.set(header, value); }; };
+
+        httpresponse.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+
+        for (auto &[field, value] : response.headers) {
+            const auto visitor = makevisitor(value);
+            std::visit(visitor, field);
+        }
+
+        httpresponse.prepare_payload();
+        return httpresponse;
+    }
+
+    HttpRequest from_beast_request(const http::request<http::string_body> &httprequest)
+    {
+        HttpRequest request;
+        request.requestType = httprequest.method() == http::verb::post ? HttpRequest::POST : HttpRequest::GET;
+        request.target      = std::string(httprequest.target());
+        request.body        = httprequest.body();
+        for (const auto &field : httprequest) {
+            FieldMap::key_type    key{ field.name() };
+            FieldMap::mapped_type value{ field.value() };
+            request.headers[key] = std::move(value);
+        }
+        // TODO port, hostname
+        return request;
+    }
+}
+
 class AsyncHttpRequest : public std::enable_shared_from_this<AsyncHttpRequest> {
 public:
-    explicit AsyncHttpRequest(HttpRequest r, IOState &state, std::function<void(const HttpResponse &, IOState &)> callback)
-        : request(std::move(r))
+    explicit AsyncHttpRequest(HttpRequest                                         r,
+                              IOState &                                           state,
+                              std::function<void(const HttpResponse &, IOState &)> callback,
+                              RequestPriority                                     priority,
+                              CancellationToken                                   token)
+        : priority(priority)
+        , token(std::move(token))
+        , request(std::move(r))
         , ctx(ssl::context::tlsv12_client)
         , mStream(*state.getIoC(), ctx)
         , mResolver(*state.getIoC())
         , mCallback(std::move(callback))
         , mIOState(state)
     {
+        // Drops the request from the queue right away if it did not start yet
+        mCancelHandler = this->token.onCancel([&state] { state.startQueuedRequests(); });
     }
 
+    ~AsyncHttpRequest() { token.removeHandler(mCancelHandler); }
+
     void run()
     {
+        // Closing the socket fails the running operation, the step waiting for it then sees the cancelled token
+        token.removeHandler(mCancelHandler);
+        mCancelHandler = token.onCancel([weak = weak_from_this()] {
+            if (const auto self = weak.lock()) {
+                self->mResolver.cancel();
+                beast::get_lowest_layer(self->mStream).close();
+            }
+        });
+
         ctx.set_default_verify_paths();
         mResolver.async_resolve(request.hostname, request.port,
                                 beast::bind_front_handler(&AsyncHttpRequest::on_resolve, shared_from_this()));
@@ -49,6 +108,10 @@ public:
 
     void on_resolve(beast::error_code ec, const tcp::resolver::results_type &results)
     {
+        if (ec || token.isCancelled()) {
+            return finish(ec, 0);
+        }
+
         beast::get_lowest_layer(mStream).expires_after(std::chrono::seconds(30));
         beast::get_lowest_layer(mStream).async_connect(results,
                                                        beast::bind_front_handler(&AsyncHttpRequest::on_connect, shared_from_this()));
@@ -56,11 +119,19 @@ public:
 
     void on_connect(beast::error_code ec, const tcp::resolver::results_type::endpoint_type &)
     {
+        if (ec || token.isCancelled()) {
+            return finish(ec, 0);
+        }
+
         mStream.async_handshake(ssl::stream_base::client, beast::bind_front_handler(&AsyncHttpRequest::on_handshake, shared_from_this()));
     }
 
     void on_handshake(beast::error_code ec)
     {
+        if (ec || token.isCancelled()) {
+            return finish(ec, 0);
+        }
+
         beast::get_lowest_layer(mStream).expires_after(std::chrono::seconds(30));
 
         httprequest = { request.requestType == eo::HttpRequest::GET ? http::verb::get : http::verb::post, request.target, 11 };
@@ -83,14 +154,30 @@ public:
         http::async_write(mStream, httprequest, beast::bind_front_handler(&AsyncHttpRequest::on_write, shared_from_this()));
     }
 
-    void on_write(beast::error_code ec, std::size_t bytes_transferred)
+    void on_write(beast::error_code ec, std::size_t)
     {
+        if (ec || token.isCancelled()) {
+            return finish(ec, 0);
+        }
+
         http::async_read(mStream, buffer, httpresponse, beast::bind_front_handler(&AsyncHttpRequest::on_read, shared_from_this()));
     }
 
-    void on_read(beast::error_code ec, std::size_t bytes_transferred)
+    void on_read(beast::error_code ec, std::size_t bytes_transferred) { finish(ec, bytes_transferred); }
+
+    // Every request ends up here exactly once, even a failed or cancelled one
+    void finish(beast::error_code ec, std::size_t bytes_transferred)
     {
-        response.statusCode = 200;
+        token.removeHandler(mCancelHandler);
+        mCancelHandler = 0;
+
+        // Free the slot right away, the shutdown below can take a while
+        mIOState.requestFinished(priority, bytes_transferred, token.isCancelled());
+        if (token.isCancelled()) {
+            return;
+        }
+
+        response.statusCode = ec ? 0 : httpresponse.result_int();
         response.body       = std::move(httpresponse.body());
 
         for (const auto &field : httpresponse) {
@@ -99,11 +186,24 @@ public:
             response.headers[key] = std::move(value);
         }
 
-        net::post(*mIOState.getIoC(), bind(mCallback, std::move(response), mIOState));
-        mStream.async_shutdown([kp = shared_from_this()](auto &&) {});
+        net::post(*mIOState.getIoC(), [callback = std::move(mCallback), response = std::move(response), &state = mIOState] {
+            callback(response, state);
+        });
+        if (!ec) {
+            mStream.async_shutdown([kp = shared_from_this()](auto &&) {});
+        }
     }
 
+    [[nodiscard]] bool isCancelled() const { return token.isCancelled(); }
+    [[nodiscard]] bool hasToken(const CancellationToken &other) const { return token == other; }
+
+    // Only while queued, the in flight counters depend on the priority
+    void promote() { priority = RequestPriority::High; }
+
 private:
+    RequestPriority                                      priority;
+    CancellationToken                                    token;
+    std::size_t                                          mCancelHandler = 0;
     std::function<void(const HttpResponse &, IOState &)> mCallback;
 
     IOState &                            mIOState;
@@ -117,6 +217,153 @@ private:
     http::response<http::string_body>    httpresponse;
     http::request<http::string_body>     httprequest;
 };
+
+class AsyncHttpListener : public HttpListener, public std::enable_shared_from_this<AsyncHttpListener> {
+public:
+    constexpr static auto connection_timeout = std::chrono::seconds(10);
+
+    explicit AsyncHttpListener(IOState &                           state,
+                               tcp::endpoint                       endpoint,
+                               std::chrono::steady_clock::duration timeout,
+                               IOState::ListenerHandler            handler,
+                               IOState::ListenerFinished           finished)
+        : mIOState(state)
+        , mEndpoint(std::move(endpoint))
+        , mTimeout(timeout)
+        , mAcceptor(*state.getIoC())
+        , mTimer(*state.getIoC())
+        , mHandler(std::move(handler))
+        , mFinished(std::move(finished))
+    {
+    }
+
+    void run()
+    {
+        beast::error_code ec;
+        mAcceptor.open(mEndpoint.protocol(), ec);
+        if (!ec) {
+            mAcceptor.set_option(net::socket_base::reuse_address(true), ec);
+        }
+        if (!ec) {
+            mAcceptor.bind(mEndpoint, ec);
+        }
+        if (!ec) {
+            mAcceptor.listen(net::socket_base::max_listen_connections, ec);
+        }
+
+        if (ec) {
+            log::error("Could not listen on {0}:{1}: {2}", mEndpoint.address().to_string(), mEndpoint.port(), ec.message());
+            // Dont call back from within expectAsyncHttpRequest
+            net::post(*mIOState.getIoC(), [self = shared_from_this()] { self->finish(false); });
+            return;
+        }
+
+        mTimer.expires_after(mTimeout);
+        mTimer.async_wait([self = shared_from_this()](beast::error_code ec) {
+            if (!ec) {
+                log::error("No request arrived on port {0} in time", self->mEndpoint.port());
+                self->finish(false);
+            }
+        });
+
+        accept();
+    }
+
+    void close() override
+    {
+        mFinished = nullptr;
+        shutdown();
+    }
+
+private:
+    struct Connection {
+        explicit Connection(tcp::socket socket)
+            : stream(std::move(socket))
+        {
+        }
+
+        beast::tcp_stream                 stream;
+        beast::flat_buffer                buffer;
+        http::request<http::string_body>  request;
+        http::response<http::string_body> response;
+    };
+
+    void accept()
+    {
+        mAcceptor.async_accept(beast::bind_front_handler(&AsyncHttpListener::on_accept, shared_from_this()));
+    }
+
+    void on_accept(beast::error_code ec, tcp::socket socket)
+    {
+        if (mDone) {
+            return;
+        }
+
+        if (ec == net::error::operation_aborted) {
+            return;
+        } else if (ec) {
+            // Errors like EMFILE persist, accepting again right away would only spin the io loop
+            log::error("Could not accept a connection on port {0}: {1}", mEndpoint.port(), ec.message());
+            finish(false);
+            return;
+        }
+
+        // Browsers like to open additional connections, so every connection is handled on its own
+        auto connection = std::make_shared<Connection>(std::move(socket));
+        connection->stream.expires_after(connection_timeout);
+        http::async_read(connection->stream, connection->buffer, connection->request,
+                         [self = shared_from_this(), connection](beast::error_code ec, std::size_t) { self->on_read(ec, connection); });
+
+        accept();
+    }
+
+    void on_read(beast::error_code ec, const std::shared_ptr<Connection> &connection)
+    {
+        if (ec || mDone) {
+            return;
+        }
+
+        HttpResponse response;
+        const bool   accepted = mHandler(from_beast_request(connection->request), response);
+        connection->response  = to_beast_response(response);
+
+        http::async_write(connection->stream, connection->response,
+                          [connection](beast::error_code ec, std::size_t) { connection->stream.socket().shutdown(tcp::socket::shutdown_send, ec); });
+
+        if (accepted) {
+            finish(true);
+        }
+    }
+
+    void finish(bool accepted)
+    {
+        if (mDone) {
+            return;
+        }
+
+        shutdown();
+        if (mFinished) {
+            mFinished(accepted);
+        }
+    }
+
+    void shutdown()
+    {
+        mDone = true;
+        beast::error_code ec;
+        mAcceptor.close(ec);
+        mTimer.cancel();
+    }
+
+    IOState &                           mIOState;
+    tcp::endpoint                       mEndpoint;
+    std::chrono::steady_clock::duration mTimeout;
+    tcp::acceptor                       mAcceptor;
+    net::steady_timer                   mTimer;
+    IOState::ListenerHandler            mHandler;
+    IOState::ListenerFinished           mFinished;
+    bool                                mDone = false;
+};
 }
 
 eo::IOState::IOState()
@@ -126,15 +373,161 @@ eo::IOState::IOState()
 {
 }
 
-void eo::IOState::pollIoC() { mIoContext->poll(); }
+std::size_t eo::IOState::pollIoC() { return mIoContext->poll(); }
 
 void eo::IOState::runIoC() { mIoContext->run(); }
 
 void eo::IOState::makeAsyncHttpRequest(const struct HttpRequest &                                  request,
-                                       std::function<void(const struct HttpResponse &, IOState &)> callback)
+                                       std::function<void(const struct HttpResponse &, IOState &)> callback,
+                                       RequestPriority                                             priority,
+                                       CancellationToken                                           token)
+{
+    if (token.isCancelled()) {
+        requestCancelled(0);
+        return;
+    }
+
+    auto &queue = priority == RequestPriority::High ? mQueuedRequests : mQueuedLowPriority;
+    queue.push_back(std::make_shared<AsyncHttpRequest>(request, *this, std::move(callback), priority, std::move(token)));
+    startQueuedRequests();
+}
+
+void eo::IOState::promoteRequest(const CancellationToken &token)
 {
-    auto asyncrequest = std::make_shared<AsyncHttpRequest>(request, *this, std::move(callback));
-    asyncrequest->run();
+    if (token == CancellationToken{}) {
+        return; // Requests without a token can not be told apart
+    }
+
+    const auto it
+        = std::find_if(begin(mQueuedLowPriority), end(mQueuedLowPriority), [&token](auto &&request) { return request->hasToken(token); });
+    if (it == end(mQueuedLowPriority)) {
+        return;
+    }
+
+    auto request = std::move(*it);
+    mQueuedLowPriority.erase(it);
+    request->promote();
+    mQueuedRequests.push_back(std::move(request));
+    startQueuedRequests();
+}
+
+void eo::IOState::setMaxConcurrentRequests(std::size_t max)
+{
+    mMaxConcurrentRequests = std::max<std::size_t>(max, 1);
+    startQueuedRequests();
+}
+
+void eo::IOState::requestFinished(RequestPriority priority, std::size_t bytesReceived, bool cancelled)
+{
+    --mRequestsInFlight;
+    if (priority == RequestPriority::Low) {
+        --mLowPriorityInFlight;
+    }
+
+    if (cancelled) {
+        requestCancelled(bytesReceived);
+    } else if (bytesReceived > 0) {
+        ++mFinishedRequests;
+        mAverageResponseBytes = (mAverageResponseBytes * (mFinishedRequests - 1) + bytesReceived) / mFinishedRequests;
+    }
+
+    startQueuedRequests();
+}
+
+void eo::IOState::requestCancelled(std::size_t bytesReceived)
+{
+    ++mCancelledRequests;
+    if (bytesReceived < mAverageResponseBytes) {
+        mBytesSaved += mAverageResponseBytes - bytesReceived;
+    }
+}
+
+void eo::IOState::startQueuedRequests()
+{
+    // Cancelled requests give up their place in the queues without starting
+    const auto dropcancelled = [this](auto &queue) {
+        const auto cancelled = std::remove_if(begin(queue), end(queue), [](auto &&request) { return request->isCancelled(); });
+        for (auto it = cancelled; it != end(queue); ++it) {
+            requestCancelled(0);
+        }
+        queue.erase(cancelled, end(queue));
+    };
+    dropcancelled(mQueuedRequests);
+    dropcancelled(mQueuedLowPriority);
+
+    while (mRequestsInFlight < mMaxConcurrentRequests && !mQueuedRequests.empty()) {
+        auto request = std::move(mQueuedRequests.front());
+        mQueuedRequests.pop_front();
+        ++mRequestsInFlight;
+        request->run();
+    }
+
+    // Keep slots free for high priority requests which arrive in the meantime
+    const auto maxlowpriority = std::max<std::size_t>(mMaxConcurrentRequests / 2, 1);
+    while (mQueuedRequests.empty() && mRequestsInFlight < mMaxConcurrentRequests && mLowPriorityInFlight < maxlowpriority
+           && !mQueuedLowPriority.empty()) {
+        auto request = std::move(mQueuedLowPriority.front());
+        mQueuedLowPriority.pop_front();
+        ++mRequestsInFlight;
+        ++mLowPriorityInFlight;
+        request->run();
+    }
+}
+
+eo::CancellationToken eo::CancellationToken::make()
+{
+    CancellationToken token;
+    token.mState = std::make_shared<State>();
+    return token;
+}
+
+void eo::CancellationToken::cancel() const
+{
+    if (!mState || mState->cancelled) {
+        return;
+    }
+    mState->cancelled = true;
+
+    // Handlers might register new handlers, those get called right away
+    const auto handlers = std::move(mState->handlers);
+    mState->handlers.clear();
+    for (const auto &[id, handler] : handlers) {
+        handler();
+    }
+}
+
+std::size_t eo::CancellationToken::onCancel(std::function<void()> handler) const
+{
+    if (!mState) {
+        return 0;
+    }
+    if (mState->cancelled) {
+        handler();
+        return 0;
+    }
+    mState->handlers.emplace_back(++mState->lastHandler, std::move(handler));
+    return mState->lastHandler;
+}
+
+void eo::CancellationToken::removeHandler(std::size_t id) const
+{
+    if (!mState || id == 0) {
+        return;
+    }
+    auto &handlers = mState->handlers;
+    handlers.erase(std::remove_if(begin(handlers), end(handlers), [id](auto &&handler) { return handler.first == id; }), end(handlers));
+}
+
+std::shared_ptr<eo::HttpListener> eo::IOState::expectAsyncHttpRequest(ListenerHandler                     handler,
+                                                                      ListenerFinished                    finished,
+                                                                      std::chrono::steady_clock::duration timeout,
+                                                                      unsigned short                      port,
+                                                                      const std::string &                 ip)
+{
+    auto listener = std::make_shared<AsyncHttpListener>(*this, tcp::endpoint{ net::ip::make_address(ip), port }, timeout,
+                                                        std::move(handler), std::move(finished));
+    listener->run();
+    return listener;
 }
 
 void eo::open_url_browser(const std::string &url)
@@ -221,7 +614,7 @@ eo::HttpResponse eo::makeHttpRequest(const HttpRequest &request)
     http::read(stream, buffer, httpresponse);
 
     HttpResponse response;
-    response.statusCode = 200;
+    response.statusCode = httpresponse.result_int();
     response.body       = std::move(httpresponse.body());
 
     for (const auto &field : httpresponse) {
@@ -245,29 +638,57 @@ eo::HttpRequest eo::expectHttpRequest(const HttpResponse &response, unsigned sho
     http::request<http::string_body> httprequest;
     http::read(socket, buffer, httprequest);
 
-    http::response<http::string_body> httpresponse{ std::piecewise_construct };
-    httpresponse.body() = response.body;
+    http::write(socket, to_beast_response(response));
+
+    return from_beast_request(httprequest);
+}
+
+std::optional<std::string> eo::get_query_parameter(std::string_view target, std::string_view name)
+{
+    const auto query = target.find('?');
+    if (query == target.npos) {
+        return std::nullopt;
+    }
 
-    const auto makevisitor
-        = [&httpresponse](const auto &value) { return [&value, &httpresponse](const auto &header) { httpresponse.set(header, value); }; };
+    auto pos = query + 1;
+    while (pos < target.length()) {
+        auto end = target.find('&', pos);
+        if (end == target.npos) {
+            end = target.length();
+        }
 
-    httpresponse.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+        const auto parameter = target.substr(pos, end - pos);
+        const auto equals    = parameter.find('=');
+        if (parameter.substr(0, equals) == name) {
+            return std::string(equals == parameter.npos ? std::string_view{} : parameter.substr(equals + 1));
+        }
 
-    for (auto &[field, value] : response.headers) {
-        const auto visitor = makevisitor(value);
-        std::visit(visitor, field);
+        pos = end + 1;
     }
 
-    http::write(socket, httpresponse);
+    return std::nullopt;
+}
 
-    HttpRequest request;
-    request.target = std::string(httprequest.target());
-    request.body   = httprequest.body();
-    for (const auto &field : httprequest) {
-        FieldMap::key_type    key{ field.name() };
-        FieldMap::mapped_type value{ field.value() };
-        request.headers[key] = std::move(value);
+std::optional<std::chrono::steady_clock::time_point> eo::get_cache_expiry(const HttpResponse &response)
+{
+    const auto expires = response.headers.find(http::field::expires);
+    if (expires == end(response.headers)) {
+        return std::nullopt;
+    }
+
+    const auto expiresAt = parse_http_date(expires->second);
+    if (expiresAt == std::chrono::system_clock::time_point{}) {
+        return std::nullopt;
     }
-    // TODO Type, port, hostname
-    return request;
+
+    auto       now  = std::chrono::system_clock::now();
+    const auto date = response.headers.find(http::field::date);
+    if (date != end(response.headers)) {
+        if (const auto servertime = parse_http_date(date->second); servertime != std::chrono::system_clock::time_point{}) {
+            now = servertime;
+        }
+    }
+
+    const auto remaining = std::max(expiresAt - now, std::chrono::system_clock::duration::zero());
+    return std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(remaining);
 }
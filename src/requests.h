@@ -16,9 +16,13 @@
 
 #pragma once
 #include "util.h"
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
+#include <optional>
 #include <variant>
+#include <vector>
 
 #include <boost/asio/executor_work_guard.hpp>
 #include <boost/asio/io_context.hpp>
@@ -36,32 +40,135 @@ namespace http  = beast::http;
 namespace net   = boost::asio;
 using FieldMap  = std::map<std::variant<http::field, std::string>, std::string>;
 
+struct HttpRequest;
+struct HttpResponse;
+class AsyncHttpRequest;
+
+// Low priority requests (e.g. prefetching) only start if no high priority request is waiting
+enum class RequestPriority { High, Low };
+
+/*
+ * Shared by everyone working on the same thing e.g. the kills of the shown system.
+ * Cancelled requests do not start or get their socket closed, their callbacks are never called.
+ * A default constructed token is never cancelled.
+ */
+class CancellationToken {
+public:
+    CancellationToken() = default;
+    [[nodiscard]] static CancellationToken make();
+
+    void cancel() const;
+
+    [[nodiscard]] bool isCancelled() const { return mState && mState->cancelled; }
+
+    // Copies of the same token are equal, all default constructed tokens too
+    [[nodiscard]] bool operator==(const CancellationToken &other) const { return mState == other.mState; }
+
+    // Called once on cancel, right away if the token is already cancelled.
+    // Returns the id for removeHandler(), 0 if the handler is not kept
+    std::size_t onCancel(std::function<void()> handler) const;
+    // Long lived tokens would otherwise collect the handlers of everything that already finished
+    void removeHandler(std::size_t id) const;
+
+private:
+    struct State {
+        bool                                                       cancelled   = false;
+        std::size_t                                                lastHandler = 0;
+        std::vector<std::pair<std::size_t, std::function<void()>>> handlers;
+    };
+
+    std::shared_ptr<State> mState;
+};
+
+/*
+ * Handle to a running AsyncHttpListener
+ */
+class HttpListener {
+public:
+    virtual ~HttpListener() = default;
+
+    // Stops listening without calling the finished callback
+    virtual void close() = 0;
+};
+
 class IOState {
 public:
+    // Gets called for every received request. Fills the response and returns true if the request was the expected one
+    using ListenerHandler  = std::function<bool(const HttpRequest &, HttpResponse &)>;
+    using ListenerFinished = std::function<void(bool accepted)>;
+
     IOState();
 
     inline auto &getIoC() { return mIoContext; }
 
-    void pollIoC();
-    void runIoC();
+    // Returns the number of handlers which ran
+    std::size_t pollIoC();
+    void        runIoC();
+
+    // Requests are scheduled in order, at most getMaxConcurrentRequests() are in flight at the same time.
+    // Low priority requests use at most half of the slots, so high priority ones never wait long
+    void makeAsyncHttpRequest(const struct HttpRequest &                                  request,
+                              std::function<void(const struct HttpResponse &, IOState &)> callback,
+                              RequestPriority                                             priority = RequestPriority::High,
+                              CancellationToken                                           token    = {});
 
-    void makeAsyncHttpRequest(const struct HttpRequest &request, std::function<void(const struct HttpResponse &, IOState &)> callback);
+    // Moves the queued low priority request with the given token to the high priority queue,
+    // e.g. once somebody waits for what is being prefetched. A running request keeps its slot
+    void promoteRequest(const CancellationToken &token);
+
+    void                      setMaxConcurrentRequests(std::size_t max);
+    [[nodiscard]] std::size_t getMaxConcurrentRequests() const { return mMaxConcurrentRequests; }
+    [[nodiscard]] std::size_t getRequestsInFlight() const { return mRequestsInFlight; }
+    [[nodiscard]] std::size_t getQueuedRequests() const { return mQueuedRequests.size() + mQueuedLowPriority.size(); }
+    [[nodiscard]] std::size_t getCancelledRequests() const { return mCancelledRequests; }
+    // Estimated from the average size of the finished responses
+    [[nodiscard]] std::size_t getBytesSaved() const { return mBytesSaved; }
+
+    // Serves http requests in the background until the handler accepts one or the timeout expires
+    std::shared_ptr<HttpListener> expectAsyncHttpRequest(ListenerHandler                     handler,
+                                                         ListenerFinished                    finished,
+                                                         std::chrono::steady_clock::duration timeout,
+                                                         unsigned short                      port = 8080,
+                                                         const std::string &                 ip   = "0.0.0.0");
 
 private:
+    friend class AsyncHttpRequest;
+    void requestFinished(RequestPriority priority, std::size_t bytesReceived, bool cancelled);
+    void requestCancelled(std::size_t bytesReceived);
+    void startQueuedRequests();
+
     std::shared_ptr<net::io_context>                         mIoContext;
     net::executor_work_guard<net::io_context::executor_type> workGuard;
+
+    std::size_t                                   mMaxConcurrentRequests = 8;
+    std::size_t                                   mRequestsInFlight      = 0;
+    std::size_t                                   mLowPriorityInFlight   = 0;
+    std::deque<std::shared_ptr<AsyncHttpRequest>> mQueuedRequests;
+    std::deque<std::shared_ptr<AsyncHttpRequest>> mQueuedLowPriority;
+
+    std::size_t mCancelledRequests    = 0;
+    std::size_t mBytesSaved           = 0;
+    std::size_t mFinishedRequests     = 0;
+    std::size_t mAverageResponseBytes = 0;
 };
 
 void        open_url_browser(const std::string &url);
 std::string urlencode(const std::string &input);
 std::string base64_safe(const std::string &base64);
 
+// Returns the value of a parameter in the query part of the target e.g. /callback/?code=abc
+std::optional<std::string> get_query_parameter(std::string_view target, std::string_view name);
+
 struct HttpResponse {
-    int         statusCode;
+    int         statusCode = 200;
     FieldMap    headers;
     std::string body;
 };
 
+// When the cached response expires according to its Expires header.
+// Relative to the Date header so a wrong local clock does not matter
+std::optional<std::chrono::steady_clock::time_point> get_cache_expiry(const HttpResponse &response);
+
 struct HttpRequest {
     enum Type { GET, POST };
     std::string hostname;
@@ -0,0 +1,80 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+#include "staticuniverse.h"
+#include "universe.h"
+
+#include <chrono>
+#include <random>
+
+/*
+ * Runs 1k fewest jumps (breadth first) and safest (Dijkstra) route queries between random systems.
+ * Uses assets/universe.bin if it exists, otherwise a random connected cluster of the same size.
+ */
+int main()
+{
+    constexpr std::size_t query_count  = 1000;
+    constexpr std::size_t system_count = 8285;
+
+    std::mt19937 random(42);
+
+    eo::UniverseGraph graph;
+    if (const auto universe = eo::StaticUniverse::open()) {
+        graph = universe->makeGraph();
+    } else {
+        eo::log::info("No static universe snapshot, using a random cluster");
+
+        std::vector<eo::UniverseGraph::System> systems;
+        std::uniform_real_distribution<float>  security(-1.f, 1.f);
+        for (std::size_t i = 0; i < system_count; i++) {
+            systems.push_back({ eo::int32(30000000 + i), security(random) });
+        }
+
+        // A chain keeps everything reachable, the short jumps add about as many gates per system as the real cluster
+        std::vector<std::pair<eo::int32, eo::int32>> connections;
+        std::uniform_int_distribution<std::size_t>   jump(2, 40);
+        for (std::size_t i = 0; i + 1 < system_count; i++) {
+            connections.emplace_back(systems[i].systemID, systems[i + 1].systemID);
+            connections.emplace_back(systems[i].systemID, systems[(i + jump(random)) % system_count].systemID);
+        }
+        graph = eo::UniverseGraph(std::move(systems), connections);
+    }
+
+    std::vector<std::pair<eo::int32, eo::int32>> queries;
+    std::uniform_int_distribution<eo::uint32>    pick(0, eo::uint32(graph.systemCount() - 1));
+    for (std::size_t i = 0; i < query_count; i++) {
+        queries.emplace_back(graph.systemID(pick(random)), graph.systemID(pick(random)));
+    }
+
+    const auto measure = [&](const char *name, auto &&query) {
+        std::size_t jumps = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto &[from, to] : queries) {
+            jumps += query(from, to).size();
+        }
+        const auto duration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+
+        eo::log::info("{0} {1} routes over {2} systems took {3:.0f} us, {4:.1f} us per query, {5:.1f} systems per route", query_count,
+                      name, graph.systemCount(), duration.count(), duration.count() / query_count, double(jumps) / query_count);
+    };
+
+    measure("shortest", [&](eo::int32 from, eo::int32 to) { return graph.shortestRoute(from, to); });
+    measure("safest", [&](eo::int32 from, eo::int32 to) { return graph.route(from, to, eo::SafestWeight{ graph }); });
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "logging.h"
+#include "spatialindex.h"
+#include "staticuniverse.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+/*
+ * Runs 10k radius queries (jump drive ranges) around random systems of the cluster.
+ * Uses assets/universe.bin if it exists, otherwise a random cluster of the same size.
+ * Afterwards the radius and nearest queries are checked against a brute force scan.
+ */
+int main()
+{
+    constexpr std::size_t query_count  = 10000;
+    constexpr std::size_t system_count = 8285;
+    constexpr float       radius       = 7.f; // ly, a jump freighter with max skills
+
+    std::mt19937 random(42);
+
+    eo::SpatialIndex index;
+    if (const auto universe = eo::StaticUniverse::open()) {
+        index = universe->makeSpatialIndex();
+    } else {
+        eo::log::info("No static universe snapshot, using a random cluster");
+
+        std::vector<eo::SpatialIndex::Entry> entries;
+        std::normal_distribution<float>      position(0.f, 60.f);
+        for (std::size_t i = 0; i < system_count; i++) {
+            entries.push_back({ eo::math::vec3(position(random), position(random) * 0.2f, position(random)), eo::int32(30000000 + i) });
+        }
+        index = eo::SpatialIndex(std::move(entries));
+    }
+
+    // Query around existing systems like the overlay does
+    std::vector<eo::math::vec3>                centers;
+    std::uniform_int_distribution<std::size_t> pick(0, index.size() - 1);
+    for (std::size_t i = 0; i < query_count; i++) {
+        centers.push_back(index.entries()[pick(random)].position);
+    }
+
+    std::vector<eo::SpatialIndex::Result> results;
+    std::size_t                           found = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto &center : centers) {
+        results.clear();
+        index.withinRadius(center, radius, results);
+        found += results.size();
+    }
+    const auto duration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+
+    eo::log::info("{0} radius queries ({1} ly) over {2} systems took {3:.0f} us, {4:.2f} us per query, {5:.1f} systems per query",
+                  query_count, radius, index.size(), duration.count(), duration.count() / query_count,
+                  double(found) / query_count);
+
+    const auto distance2 = [](const eo::math::vec3 &a, const eo::math::vec3 &b) {
+        const auto d = a - b;
+        return d.x * d.x + d.y * d.y + d.z * d.z;
+    };
+
+    constexpr std::size_t nearest_count = 10;
+
+    std::size_t mismatches = 0;
+    for (const auto &center : centers) {
+        std::vector<std::pair<float, eo::int32>> expected;
+        for (const auto &entry : index.entries()) {
+            expected.emplace_back(distance2(entry.position, center), entry.systemID);
+        }
+        std::sort(begin(expected), end(expected));
+
+        std::vector<eo::int32> expectedWithin;
+        for (const auto &[d2, systemID] : expected) {
+            if (d2 <= radius * radius) {
+                expectedWithin.push_back(systemID);
+            }
+        }
+        std::sort(begin(expectedWithin), end(expectedWithin));
+
+        results.clear();
+        index.withinRadius(center, radius, results);
+        std::vector<eo::int32> within;
+        for (const auto &result : results) {
+            within.push_back(result.systemID);
+        }
+        std::sort(begin(within), end(within));
+
+        // Ties may be ordered differently, so only the distances of the nearest systems have to match
+        const auto nearest = index.nearest(center, nearest_count);
+
+        bool equal = within == expectedWithin && index.countWithinRadius(center, radius) == expectedWithin.size();
+        equal      = equal && nearest.size() == std::min(nearest_count, expected.size());
+        for (std::size_t i = 0; equal && i < nearest.size(); i++) {
+            equal = std::abs(nearest[i].distance - std::sqrt(expected[i].first)) < 1e-4f;
+        }
+        mismatches += equal ? 0 : 1;
+    }
+
+    if (mismatches > 0) {
+        eo::log::error("{0} of {1} queries differ from a brute force scan", mismatches, query_count);
+        return 1;
+    }
+    eo::log::info("All queries match a brute force scan");
+
+    return 0;
+}
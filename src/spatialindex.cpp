@@ -0,0 +1,201 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spatialindex.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sqlite3.h>
+
+namespace {
+float distance2(const eo::math::vec3 &a, const eo::math::vec3 &b)
+{
+    const auto d = a - b;
+    return d.x * d.x + d.y * d.y + d.z * d.z;
+}
+
+struct Range {
+    std::size_t first, last;
+    int         axis;
+};
+}
+
+eo::SpatialIndex::SpatialIndex(std::vector<Entry> entries)
+    : mEntries(std::move(entries))
+{
+    build(0, mEntries.size(), 0);
+
+    mIndices.reserve(mEntries.size());
+    for (uint32 i = 0; i < mEntries.size(); i++) {
+        mIndices.emplace(mEntries[i].systemID, i);
+    }
+}
+
+void eo::SpatialIndex::build(std::size_t first, std::size_t last, int axis)
+{
+    if (last - first <= leaf_size) {
+        return;
+    }
+
+    const auto middle = first + (last - first) / 2;
+    std::nth_element(begin(mEntries) + first, begin(mEntries) + middle, begin(mEntries) + last,
+                     [axis](const Entry &a, const Entry &b) { return a.position[axis] < b.position[axis]; });
+
+    build(first, middle, (axis + 1) % 3);
+    build(middle + 1, last, (axis + 1) % 3);
+}
+
+template<typename Visitor>
+void eo::SpatialIndex::visitWithinRadius(const math::vec3 &center, float radius, Visitor &&visitor) const
+{
+    const float radius2 = radius * radius;
+
+    // Depth is logarithmic, a small fixed stack avoids the recursion
+    Range       stack[64];
+    std::size_t top = 0;
+    stack[top++]    = { 0, mEntries.size(), 0 };
+
+    while (top > 0) {
+        const auto [first, last, axis] = stack[--top];
+
+        if (last - first <= leaf_size) {
+            for (auto i = first; i < last; i++) {
+                if (const auto d2 = distance2(mEntries[i].position, center); d2 <= radius2) {
+                    visitor(mEntries[i], d2);
+                }
+            }
+            continue;
+        }
+
+        const auto  middle = first + (last - first) / 2;
+        const auto &median = mEntries[middle];
+        if (const auto d2 = distance2(median.position, center); d2 <= radius2) {
+            visitor(median, d2);
+        }
+
+        // Only descend into the halves the sphere reaches
+        const float delta = center[axis] - median.position[axis];
+        const int   next  = (axis + 1) % 3;
+        if (delta <= radius) {
+            stack[top++] = { first, middle, next };
+        }
+        if (delta >= -radius) {
+            stack[top++] = { middle + 1, last, next };
+        }
+    }
+}
+
+void eo::SpatialIndex::withinRadius(const math::vec3 &center, float radius, std::vector<Result> &results) const
+{
+    visitWithinRadius(center, radius, [&](const Entry &entry, float d2) { results.push_back({ entry.systemID, std::sqrt(d2) }); });
+}
+
+std::size_t eo::SpatialIndex::countWithinRadius(const math::vec3 &center, float radius) const
+{
+    std::size_t count = 0;
+    visitWithinRadius(center, radius, [&](const Entry &, float) { count++; });
+    return count;
+}
+
+std::vector<eo::SpatialIndex::Result> eo::SpatialIndex::nearest(const math::vec3 &center, std::size_t k) const
+{
+    // Max heap of the best k so far, its top is the current search radius
+    std::vector<std::pair<float, uint32>> best;
+    best.reserve(k + 1);
+
+    const auto consider = [&](std::size_t index) {
+        const auto d2 = distance2(mEntries[index].position, center);
+        if (best.size() < k) {
+            best.emplace_back(d2, index);
+            std::push_heap(begin(best), end(best));
+        } else if (k > 0 && d2 < best.front().first) {
+            std::pop_heap(begin(best), end(best));
+            best.back() = { d2, index };
+            std::push_heap(begin(best), end(best));
+        }
+    };
+    const auto reaches = [&](float delta) { return best.size() < k || delta * delta < best.front().first; };
+
+    Range       stack[64];
+    std::size_t top = 0;
+    stack[top++]    = { 0, mEntries.size(), 0 };
+
+    while (top > 0) {
+        const auto [first, last, axis] = stack[--top];
+
+        if (last - first <= leaf_size) {
+            for (auto i = first; i < last; i++) {
+                consider(i);
+            }
+            continue;
+        }
+
+        const auto middle = first + (last - first) / 2;
+        consider(middle);
+
+        // Visit the side of the center first, the other one only if it can still contain a closer system
+        const float delta = center[axis] - mEntries[middle].position[axis];
+        const int   next  = (axis + 1) % 3;
+        const Range near  = delta <= 0 ? Range{ first, middle, next } : Range{ middle + 1, last, next };
+        const Range far   = delta <= 0 ? Range{ middle + 1, last, next } : Range{ first, middle, next };
+
+        // The far side is pushed first, so the near side gets popped and shrinks the radius before
+        if (reaches(delta)) {
+            stack[top++] = far;
+        }
+        stack[top++] = near;
+    }
+
+    std::sort_heap(begin(best), end(best));
+
+    std::vector<Result> results;
+    results.reserve(best.size());
+    for (const auto &[d2, index] : best) {
+        results.push_back({ mEntries[index].systemID, std::sqrt(d2) });
+    }
+    return results;
+}
+
+std::optional<eo::math::vec3> eo::SpatialIndex::position(int32 systemID) const
+{
+    const auto it = mIndices.find(systemID);
+    if (it == end(mIndices)) {
+        return std::nullopt;
+    }
+    return mEntries[it->second].position;
+}
+
+eo::SpatialIndex eo::load_spatial_index(db::SqliteSPtr dbconnection)
+{
+    std::vector<SpatialIndex::Entry> entries;
+
+    auto stmt = db::make_statement(dbconnection, "SELECT id, position FROM solarsystem;");
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        // Stored in light years, see esi::SolarSystem
+        const auto blob = db::column_get_blob(stmt.get(), 1);
+        if (blob.size() != sizeof(math::vec3)) {
+            log::error("Invalid position of system {0}", sqlite3_column_int(stmt.get(), 0));
+            continue;
+        }
+
+        auto &entry = entries.emplace_back();
+        std::memcpy(&entry.position[0], blob.data(), sizeof(entry.position));
+        entry.systemID = sqlite3_column_int(stmt.get(), 0);
+    }
+
+    return SpatialIndex(std::move(entries));
+}
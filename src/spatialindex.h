@@ -0,0 +1,82 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "db.h"
+#include "math.h"
+#include "util.h"
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace eo {
+
+constexpr double meters_per_lightyear = 9.4607304725808e15;
+
+/*
+ * K-d tree over the system positions in light years.
+ * The tree is implicit: every range of mEntries stores its median in the middle
+ * and the two halves left and right of it, split along x, y, z in turns.
+ */
+class SpatialIndex {
+public:
+    struct Entry {
+        math::vec3 position;
+        int32      systemID;
+    };
+
+    struct Result {
+        int32 systemID;
+        float distance; // ly
+    };
+
+    SpatialIndex() = default;
+    explicit SpatialIndex(std::vector<Entry> entries);
+
+    // Appends all systems within the radius, unordered. The center system is part of the result
+    void withinRadius(const math::vec3 &center, float radius, std::vector<Result> &results) const;
+    [[nodiscard]] std::size_t countWithinRadius(const math::vec3 &center, float radius) const;
+
+    // The k nearest systems ordered by distance
+    [[nodiscard]] std::vector<Result> nearest(const math::vec3 &center, std::size_t k) const;
+
+    [[nodiscard]] std::optional<math::vec3> position(int32 systemID) const;
+    [[nodiscard]] std::size_t               size() const { return mEntries.size(); }
+    [[nodiscard]] const std::vector<Entry> &entries() const { return mEntries; }
+
+private:
+    // Ranges this small are scanned instead of split further
+    constexpr static std::size_t leaf_size = 8;
+
+    void build(std::size_t first, std::size_t last, int axis);
+
+    template<typename Visitor>
+    void visitWithinRadius(const math::vec3 &center, float radius, Visitor &&visitor) const;
+
+    std::vector<Entry>                mEntries;
+    std::unordered_map<int32, uint32> mIndices;
+};
+
+// Converts an esi/sde position in meters
+inline math::vec3 to_lightyears(double x, double y, double z)
+{
+    return math::vec3(x / meters_per_lightyear, y / meters_per_lightyear, z / meters_per_lightyear);
+}
+
+// Builds the index from the positions of the cached systems
+SpatialIndex load_spatial_index(db::SqliteSPtr dbconnection);
+}
@@ -0,0 +1,145 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "staticuniverse.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+
+namespace {
+template<typename Record, typename Member>
+const Record *find_sorted(const Record *first, const Record *last, eo::int32 id, Member member)
+{
+    const auto it = std::lower_bound(first, last, id, [member](const Record &record, eo::int32 value) { return record.*member < value; });
+    return it != last && (*it).*member == id ? it : nullptr;
+}
+}
+
+std::unique_ptr<eo::StaticUniverse> eo::StaticUniverse::open()
+{
+    if (auto universe = open("assets/universe.bin")) {
+        return universe;
+    }
+    return open(get_exe_dir() + "assets/universe.bin");
+}
+
+std::unique_ptr<eo::StaticUniverse> eo::StaticUniverse::open(const std::string &path)
+{
+    std::unique_ptr<StaticUniverse> universe{ new StaticUniverse(path) };
+    if (!universe->mFile || universe->mFile.size() < sizeof(Header)) {
+        return nullptr;
+    }
+
+    const auto *data   = reinterpret_cast<const char *>(universe->mFile.data());
+    const auto *header = reinterpret_cast<const Header *>(data);
+    universe->mHeader  = header;
+    if (std::memcmp(header->magic, "EOUV", 4) != 0 || header->version != version) {
+        log::error("{0} is not a universe snapshot of version {1}", path, version);
+        return nullptr;
+    }
+
+    // The sections follow each other without padding, the system records start 8 byte aligned after the header
+    std::size_t offset  = sizeof(Header);
+    const auto  section = [&](std::size_t size) {
+        const char *start = data + offset;
+        offset += size;
+        return start;
+    };
+
+    universe->mSystems        = reinterpret_cast<const System *>(section(sizeof(System) * header->systemCount));
+    universe->mStargates      = reinterpret_cast<const Stargate *>(section(sizeof(Stargate) * header->stargateCount));
+    universe->mConstellations = reinterpret_cast<const Constellation *>(section(sizeof(Constellation) * header->constellationCount));
+    universe->mRegions        = reinterpret_cast<const Region *>(section(sizeof(Region) * header->regionCount));
+    universe->mIDs            = reinterpret_cast<const int32 *>(section(sizeof(int32) * header->idCount));
+    universe->mStrings        = section(header->stringSize);
+
+    if (offset != universe->mFile.size() || (header->stringSize > 0 && universe->mStrings[header->stringSize - 1] != '\0')) {
+        log::error("{0} is truncated or corrupt", path);
+        return nullptr;
+    }
+
+    log::info("Loaded the static universe with {0} systems and {1} stargates", header->systemCount, header->stargateCount);
+    return universe;
+}
+
+const eo::StaticUniverse::System *eo::StaticUniverse::findSystem(int32 systemID) const
+{
+    return find_sorted(mSystems, mSystems + mHeader->systemCount, systemID, &System::systemID);
+}
+
+const eo::StaticUniverse::System *eo::StaticUniverse::findSystem(std::string_view name) const
+{
+    const auto [first, last] = systems();
+    const auto it            = std::find_if(first, last, [&](const System &system) {
+        const auto systemname = string(system.name);
+        return systemname.length() == name.length() && strncasecmp(systemname.data(), name.data(), name.length()) == 0;
+    });
+    return it != last ? it : nullptr;
+}
+
+const eo::StaticUniverse::Constellation *eo::StaticUniverse::findConstellation(int32 constellationID) const
+{
+    return find_sorted(mConstellations, mConstellations + mHeader->constellationCount, constellationID, &Constellation::constellationID);
+}
+
+const eo::StaticUniverse::Region *eo::StaticUniverse::findRegion(int32 regionID) const
+{
+    return find_sorted(mRegions, mRegions + mHeader->regionCount, regionID, &Region::regionID);
+}
+
+eo::StaticUniverse::Range<eo::StaticUniverse::Stargate> eo::StaticUniverse::stargates(const System &system) const
+{
+    return { mStargates + system.firstStargate, mStargates + system.firstStargate + system.stargateCount };
+}
+
+eo::StaticUniverse::Range<eo::int32> eo::StaticUniverse::planets(const System &system) const
+{
+    return { mIDs + system.firstPlanet, mIDs + system.firstPlanet + system.planetCount };
+}
+
+eo::StaticUniverse::Range<eo::int32> eo::StaticUniverse::stations(const System &system) const
+{
+    return { mIDs + system.firstStation, mIDs + system.firstStation + system.stationCount };
+}
+
+eo::UniverseGraph eo::StaticUniverse::makeGraph() const
+{
+    std::vector<UniverseGraph::System> systems;
+    systems.reserve(mHeader->systemCount);
+    for (auto [it, last] = this->systems(); it != last; ++it) {
+        systems.push_back({ it->systemID, it->securityStatus });
+    }
+
+    std::vector<std::pair<int32, int32>> connections;
+    connections.reserve(mHeader->stargateCount);
+    for (auto it = mStargates; it != mStargates + mHeader->stargateCount; ++it) {
+        connections.emplace_back(it->systemID, it->destinationSystemID);
+    }
+
+    return UniverseGraph(std::move(systems), connections);
+}
+
+eo::SpatialIndex eo::StaticUniverse::makeSpatialIndex() const
+{
+    std::vector<SpatialIndex::Entry> entries;
+    entries.reserve(mHeader->systemCount);
+    for (auto [it, last] = systems(); it != last; ++it) {
+        entries.push_back({ to_lightyears(it->x, it->y, it->z), it->systemID });
+    }
+    return SpatialIndex(std::move(entries));
+}
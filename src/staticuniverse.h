@@ -0,0 +1,128 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "spatialindex.h"
+#include "universe.h"
+#include "util.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace eo {
+
+/*
+ * Static universe data (regions, constellations, systems and stargates) from the sde.
+ * The file is generated by universeconverter.py and mapped into memory as is,
+ * all lookups work directly on the mapped records.
+ */
+class StaticUniverse {
+public:
+    constexpr static uint32 version = 1;
+
+    struct Header {
+        char   magic[4];
+        uint32 version;
+        uint32 regionCount;
+        uint32 constellationCount;
+        uint32 systemCount;
+        uint32 stargateCount;
+        uint32 idCount;
+        uint32 stringSize;
+    };
+
+    // Sorted by id, the ranges index into the stargate and id arrays
+    struct System {
+        double x, y, z;
+        int32  systemID;
+        int32  constellationID;
+        int32  starID;
+        float  securityStatus;
+        uint32 name;
+        uint32 securityClass;
+        uint32 firstStargate, stargateCount;
+        uint32 firstPlanet, planetCount;
+        uint32 firstStation, stationCount;
+    };
+
+    struct Stargate {
+        int32 stargateID;
+        int32 systemID;
+        int32 destinationSystemID;
+        int32 destinationStargateID;
+    };
+
+    struct Constellation {
+        int32  constellationID;
+        int32  regionID;
+        uint32 name;
+    };
+
+    struct Region {
+        int32  regionID;
+        uint32 name;
+    };
+
+    template<typename T>
+    using Range = std::pair<const T *, const T *>;
+
+    // nullptr if the file does not exist or is not a valid snapshot
+    static std::unique_ptr<StaticUniverse> open(const std::string &path);
+    // assets/universe.bin in the working directory, otherwise next to the executable
+    static std::unique_ptr<StaticUniverse> open();
+
+    StaticUniverse(const StaticUniverse &) = delete;
+    StaticUniverse &operator=(const StaticUniverse &) = delete;
+
+    [[nodiscard]] const System *       findSystem(int32 systemID) const;
+    [[nodiscard]] const System *       findSystem(std::string_view name) const; // Case insensitive
+    [[nodiscard]] const Constellation *findConstellation(int32 constellationID) const;
+    [[nodiscard]] const Region *       findRegion(int32 regionID) const;
+
+    [[nodiscard]] Range<System>   systems() const { return { mSystems, mSystems + mHeader->systemCount }; }
+    [[nodiscard]] Range<Stargate> stargates(const System &system) const;
+    [[nodiscard]] Range<int32>    planets(const System &system) const;
+    [[nodiscard]] Range<int32>    stations(const System &system) const;
+    [[nodiscard]] std::string_view string(uint32 offset) const { return mStrings + offset; }
+
+    [[nodiscard]] UniverseGraph makeGraph() const;
+    [[nodiscard]] SpatialIndex  makeSpatialIndex() const;
+
+private:
+    explicit StaticUniverse(const std::string &path)
+        : mFile(path)
+    {
+    }
+
+    MappedFile mFile;
+
+    const Header *       mHeader         = nullptr;
+    const System *       mSystems        = nullptr;
+    const Stargate *     mStargates      = nullptr;
+    const Constellation *mConstellations = nullptr;
+    const Region *       mRegions        = nullptr;
+    const int32 *        mIDs            = nullptr;
+    const char *         mStrings        = nullptr;
+};
+
+static_assert(sizeof(StaticUniverse::Header) == 32);
+static_assert(sizeof(StaticUniverse::System) == 72);
+static_assert(sizeof(StaticUniverse::Stargate) == 16);
+static_assert(sizeof(StaticUniverse::Constellation) == 12);
+static_assert(sizeof(StaticUniverse::Region) == 8);
+}
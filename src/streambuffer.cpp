@@ -0,0 +1,179 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "streambuffer.h"
+#include "logging.h"
+
+#include "glad/glad.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+namespace {
+// A frame reserves at most a third of the ring, so the gpu can read two older frames while the next one is written
+constexpr std::size_t frames_in_flight = 3;
+constexpr GLuint64    fence_timeout    = 1'000'000'000; // ns
+
+constexpr GLbitfield persistent_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+std::size_t align_up(std::size_t offset, std::size_t alignment) { return (offset + alignment - 1) / alignment * alignment; }
+
+void wait_for(GLsync fence)
+{
+    for (;;) {
+        switch (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, fence_timeout)) {
+        case GL_ALREADY_SIGNALED:
+        case GL_CONDITION_SATISFIED:
+            return;
+        case GL_WAIT_FAILED:
+            eo::log::error("Waiting for a stream buffer fence failed");
+            return;
+        default:
+            break; // Timeout, the gpu is still busy
+        }
+    }
+}
+}
+
+eo::StreamBuffer::StreamBuffer(std::size_t capacity)
+    : mPersistent(GLAD_GL_ARB_buffer_storage)
+{
+    allocate(capacity);
+}
+
+eo::StreamBuffer::~StreamBuffer() { release(); }
+
+std::size_t eo::StreamBuffer::begin(std::size_t bytes, std::size_t alignment)
+{
+    if (!mPersistent) {
+        if (bytes > mCapacity) {
+            allocate(std::max(2 * mCapacity, bytes));
+        }
+
+        // Orphaning hands the old storage to the driver, the gpu keeps reading it while we fill the new one
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(mCapacity), nullptr, GL_STREAM_DRAW);
+        mCurrent = { 0, bytes, nullptr };
+        return 0;
+    }
+
+    if (frames_in_flight * (bytes + alignment) > mCapacity) {
+        allocate(std::max(2 * mCapacity, frames_in_flight * (bytes + alignment)));
+    }
+
+    auto offset = align_up(mHead, alignment);
+    if (offset + bytes > mCapacity) {
+        offset = 0;
+    }
+
+    retire(offset, offset + bytes);
+    mCurrent = { offset, offset + bytes, nullptr };
+    mHead    = offset + bytes;
+    return offset;
+}
+
+void eo::StreamBuffer::write(std::size_t offset, const void *data, std::size_t bytes)
+{
+    if (bytes == 0) {
+        return;
+    }
+
+    if (mPersistent) {
+        std::memcpy(mMapping + offset, data, bytes);
+        return;
+    }
+
+    // Rebound every time, the vertex and index stream get written alternately
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(bytes), data);
+}
+
+void eo::StreamBuffer::end()
+{
+    if (!mPersistent || mCurrent.begin == mCurrent.end) {
+        return;
+    }
+
+    mCurrent.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    mInFlight.push_back(mCurrent);
+    mCurrent = {};
+}
+
+void eo::StreamBuffer::allocate(std::size_t capacity)
+{
+    release();
+
+    mCapacity = capacity;
+    glGenBuffers(1, &mBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+
+    if (mPersistent) {
+        glBufferStorage(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(mCapacity), nullptr, persistent_flags);
+        mMapping = static_cast<byte *>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, static_cast<GLsizeiptr>(mCapacity), persistent_flags));
+        if (mMapping) {
+            return;
+        }
+
+        // The storage is immutable, so the fallback needs a fresh buffer
+        log::error("Could not map the stream buffer persistently, falling back to glBufferSubData");
+        mPersistent = false;
+        glDeleteBuffers(1, &mBuffer);
+        glGenBuffers(1, &mBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+    }
+
+    glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(mCapacity), nullptr, GL_STREAM_DRAW);
+}
+
+void eo::StreamBuffer::release()
+{
+    // Deleting the buffer is fine even if the gpu still reads it, the driver keeps the storage alive
+    for (const auto &segment : mInFlight) {
+        glDeleteSync(segment.fence);
+    }
+    mInFlight.clear();
+    mHead = 0;
+
+    if (!mBuffer) {
+        return;
+    }
+
+    if (mMapping) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        mMapping = nullptr;
+    }
+
+    glDeleteBuffers(1, &mBuffer);
+    mBuffer = 0;
+}
+
+void eo::StreamBuffer::retire(std::size_t begin, std::size_t end)
+{
+    // Fences signal in order, once the newest overlapping one signaled everything older is done as well
+    const auto newest = std::find_if(mInFlight.rbegin(), mInFlight.rend(),
+                                     [&](const Segment &segment) { return segment.begin < end && begin < segment.end; });
+    if (newest == mInFlight.rend()) {
+        return;
+    }
+
+    const auto done = newest.base();
+    wait_for(std::prev(done)->fence);
+
+    std::for_each(mInFlight.begin(), done, [](const Segment &segment) { glDeleteSync(segment.fence); });
+    mInFlight.erase(mInFlight.begin(), done);
+}
@@ -0,0 +1,76 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <cstddef>
+#include <deque>
+
+#include "util.h"
+
+// GLsync without pulling in glad
+struct __GLsync;
+
+namespace eo {
+
+/*
+ * A buffer object the geometry of a frame gets streamed into, all draw lists share it.
+ *  - With GL_ARB_buffer_storage it is persistently mapped and used as a ring,
+ *    a fence per frame tells when the gpu is done reading a region
+ *  - Otherwise (plain GL 3.3) the storage is orphaned once per frame and filled with glBufferSubData
+ * Only binds itself to GL_COPY_WRITE_BUFFER, so the bindings of the vertex array stay untouched.
+ */
+class StreamBuffer {
+public:
+    explicit StreamBuffer(std::size_t capacity);
+    ~StreamBuffer();
+
+    StreamBuffer(const StreamBuffer &) = delete;
+    StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+    // Reserves bytes for the frame, returns the offset of the reserved range which is aligned to alignment.
+    // Might replace the buffer object if it is too small, see getBuffer()
+    std::size_t begin(std::size_t bytes, std::size_t alignment);
+    // Copies into the reserved range, offset is absolute like the one returned by begin()
+    void write(std::size_t offset, const void *data, std::size_t bytes);
+    // Fences the reserved range after the draws using it got submitted
+    void end();
+
+    [[nodiscard]] uint        getBuffer() const { return mBuffer; }
+    [[nodiscard]] std::size_t getCapacity() const { return mCapacity; }
+    [[nodiscard]] bool        isPersistent() const { return mPersistent; }
+
+private:
+    struct Segment {
+        std::size_t begin, end;
+        __GLsync *  fence;
+    };
+
+    void allocate(std::size_t capacity);
+    void release();
+    // Waits until the gpu is done with everything overlapping [begin, end)
+    void retire(std::size_t begin, std::size_t end);
+
+    bool        mPersistent;
+    uint        mBuffer   = 0;
+    std::size_t mCapacity = 0;
+    byte *      mMapping  = nullptr;
+
+    // Persistent only: the next free byte and the ranges the gpu might still read, oldest first
+    std::size_t         mHead = 0;
+    Segment             mCurrent{};
+    std::deque<Segment> mInFlight;
+};
+}
@@ -0,0 +1,226 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "systemactivity.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <nlohmann/json.hpp>
+#include <sqlite3.h>
+
+using json = nlohmann::json;
+
+eo::SystemActivity::SystemActivity(db::SqliteSPtr dbconnection, std::shared_ptr<IOState> iostate)
+    : mDbConnection(std::move(dbconnection))
+    , mIOState(std::move(iostate))
+    , mKillsTimer(*mIOState->getIoC())
+    , mJumpsTimer(*mIOState->getIoC())
+{
+    // The last stored hour is good enough until the first sync finished
+    loadLatest();
+
+    sync(Feed::Kills);
+    sync(Feed::Jumps);
+}
+
+eo::SystemActivity::~SystemActivity()
+{
+    mKillsTimer.cancel();
+    mJumpsTimer.cancel();
+}
+
+eo::SystemActivity::Activity eo::SystemActivity::get(int32 systemID) const
+{
+    const auto it = mRows.find(systemID);
+    if (it == end(mRows)) {
+        return {};
+    }
+
+    const auto i = it->second;
+    return { mShipKills[i], mNpcKills[i], mPodKills[i], mShipJumps[i] };
+}
+
+std::vector<float> eo::SystemActivity::killsPerSystem(const UniverseGraph &graph) const
+{
+    std::vector<float> kills(graph.systemCount(), 0.f);
+    for (std::size_t i = 0; i < mSystemIDs.size(); i++) {
+        if (const auto index = graph.indexOf(mSystemIDs[i]); index != UniverseGraph::invalid_index) {
+            kills[index] = mShipKills[i] + mPodKills[i];
+        }
+    }
+    return kills;
+}
+
+void eo::SystemActivity::sync(Feed feed)
+{
+    HttpRequest request;
+    request.hostname = "esi.evetech.net";
+    request.target   = feed == Feed::Kills ? "/v2/universe/system_kills/" : "/v1/universe/system_jumps/";
+
+    mIOState->makeAsyncHttpRequest(request, [this, feed](auto &&response, auto &&) {
+        const auto expiry = get_cache_expiry(response);
+        if (response.statusCode != 200 || !expiry) {
+            log::error("Could not sync the system activity, status {0}", response.statusCode);
+            schedule(feed, retry_delay);
+            return;
+        }
+
+        // The feeds are generated once per hour, the hour they belong to is the last modification
+        std::string hour;
+        if (const auto modified = response.headers.find(http::field::last_modified); modified != end(response.headers)) {
+            hour = format_esi_time(parse_http_date(modified->second));
+        } else {
+            hour = format_esi_time(std::chrono::system_clock::now());
+        }
+
+        try {
+            apply(feed, hour, response.body);
+        } catch (const json::exception &e) {
+            log::error("Invalid system activity response: {0}", e.what());
+            schedule(feed, retry_delay);
+            return;
+        }
+
+        schedule(feed, *expiry - std::chrono::steady_clock::now() + expiry_slack);
+    });
+}
+
+void eo::SystemActivity::schedule(Feed feed, std::chrono::steady_clock::duration delay)
+{
+    auto &timer = feed == Feed::Kills ? mKillsTimer : mJumpsTimer;
+    timer.expires_after(delay);
+    timer.async_wait([this, feed](const boost::system::error_code &ec) {
+        if (ec) {
+            return; // Cancelled
+        }
+        sync(feed);
+    });
+}
+
+void eo::SystemActivity::apply(Feed feed, const std::string &hour, const std::string &body)
+{
+    auto &currenthour = feed == Feed::Kills ? mKillsHour : mJumpsHour;
+    if (hour == currenthour) {
+        return; // Nothing new
+    }
+
+    const auto j = json::parse(body);
+
+    // Systems without activity are not part of the feed
+    if (feed == Feed::Kills) {
+        std::fill(begin(mShipKills), end(mShipKills), 0);
+        std::fill(begin(mNpcKills), end(mNpcKills), 0);
+        std::fill(begin(mPodKills), end(mPodKills), 0);
+        for (const auto &system : j) {
+            const auto i = row(system.at("system_id"));
+            system.at("ship_kills").get_to(mShipKills[i]);
+            system.at("npc_kills").get_to(mNpcKills[i]);
+            system.at("pod_kills").get_to(mPodKills[i]);
+        }
+    } else {
+        std::fill(begin(mShipJumps), end(mShipJumps), 0);
+        for (const auto &system : j) {
+            const auto i = row(system.at("system_id"));
+            system.at("ship_jumps").get_to(mShipJumps[i]);
+        }
+    }
+
+    currenthour = hour;
+    log::info("Updated the system {0} of {1}", feed == Feed::Kills ? "kills" : "jumps", hour);
+
+    store(feed, hour);
+}
+
+void eo::SystemActivity::store(Feed feed, const std::string &hour)
+{
+    const auto kills = feed == Feed::Kills;
+
+    auto exists = db::make_statement(mDbConnection, kills ? "SELECT COUNT(*) FROM systemkills WHERE hour = ?;"
+                                                          : "SELECT COUNT(*) FROM systemjumps WHERE hour = ?;");
+    sqlite3_bind_text(exists.get(), 1, hour.c_str(), hour.length(), nullptr);
+    if (sqlite3_step(exists.get()) == SQLITE_ROW && sqlite3_column_int(exists.get(), 0) > 0) {
+        return; // Loaded from the database
+    }
+    exists.reset();
+
+    sqlite3_exec(mDbConnection.get(), "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    auto insert = db::make_statement(mDbConnection,
+                                     kills ? "INSERT INTO systemkills VALUES(?,?,?,?,?)" : "INSERT INTO systemjumps VALUES(?,?,?)");
+    for (std::size_t i = 0; i < mSystemIDs.size(); i++) {
+        if (kills && mShipKills[i] == 0 && mNpcKills[i] == 0 && mPodKills[i] == 0) {
+            continue;
+        }
+        if (!kills && mShipJumps[i] == 0) {
+            continue;
+        }
+
+        sqlite3_bind_text(insert.get(), 1, hour.c_str(), hour.length(), nullptr);
+        sqlite3_bind_int(insert.get(), 2, mSystemIDs[i]);
+        if (kills) {
+            sqlite3_bind_int(insert.get(), 3, mShipKills[i]);
+            sqlite3_bind_int(insert.get(), 4, mNpcKills[i]);
+            sqlite3_bind_int(insert.get(), 5, mPodKills[i]);
+        } else {
+            sqlite3_bind_int(insert.get(), 3, mShipJumps[i]);
+        }
+        sqlite3_step(insert.get());
+        sqlite3_reset(insert.get());
+    }
+    insert.reset();
+
+    const auto oldest = format_esi_time(std::chrono::system_clock::now() - history_keep);
+    auto       prune
+        = db::make_statement(mDbConnection, kills ? "DELETE FROM systemkills WHERE hour < ?;" : "DELETE FROM systemjumps WHERE hour < ?;");
+    sqlite3_bind_text(prune.get(), 1, oldest.c_str(), oldest.length(), nullptr);
+    sqlite3_step(prune.get());
+    prune.reset();
+
+    sqlite3_exec(mDbConnection.get(), "END TRANSACTION;", nullptr, nullptr, nullptr);
+}
+
+void eo::SystemActivity::loadLatest()
+{
+    auto stmt = db::make_statement(mDbConnection, "SELECT hour, systemid, shipkills, npckills, podkills FROM systemkills "
+                                                  "WHERE hour = (SELECT MAX(hour) FROM systemkills);");
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        mKillsHour    = db::column_get_string(stmt.get(), 0);
+        const auto i  = row(sqlite3_column_int(stmt.get(), 1));
+        mShipKills[i] = sqlite3_column_int(stmt.get(), 2);
+        mNpcKills[i]  = sqlite3_column_int(stmt.get(), 3);
+        mPodKills[i]  = sqlite3_column_int(stmt.get(), 4);
+    }
+
+    stmt = db::make_statement(mDbConnection, "SELECT hour, systemid, shipjumps FROM systemjumps "
+                                             "WHERE hour = (SELECT MAX(hour) FROM systemjumps);");
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        mJumpsHour    = db::column_get_string(stmt.get(), 0);
+        const auto i  = row(sqlite3_column_int(stmt.get(), 1));
+        mShipJumps[i] = sqlite3_column_int(stmt.get(), 2);
+    }
+}
+
+eo::uint32 eo::SystemActivity::row(int32 systemID)
+{
+    const auto [it, inserted] = mRows.try_emplace(systemID, static_cast<uint32>(mSystemIDs.size()));
+    if (inserted) {
+        mSystemIDs.push_back(systemID);
+        mShipKills.push_back(0);
+        mNpcKills.push_back(0);
+        mPodKills.push_back(0);
+        mShipJumps.push_back(0);
+    }
+    return it->second;
+}
@@ -0,0 +1,92 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "db.h"
+#include "requests.h"
+#include "universe.h"
+
+#include <unordered_map>
+#include <vector>
+
+#include <boost/asio/steady_timer.hpp>
+
+namespace eo {
+
+/*
+ * Kills and jumps of every system in the last hour from the esi bulk endpoints
+ * /universe/system_kills/ and /universe/system_jumps/.
+ *  - Each feed is fetched again right after its Expires
+ *  - The values are kept in columns with one row per system
+ *  - Every hour is stored in the database as history
+ */
+class SystemActivity {
+public:
+    constexpr static auto retry_delay  = std::chrono::minutes(1);
+    constexpr static auto expiry_slack = std::chrono::seconds(5);
+    constexpr static auto history_keep = std::chrono::hours(24 * 7);
+
+    struct Activity {
+        int32 shipKills = 0;
+        int32 npcKills  = 0;
+        int32 podKills  = 0;
+        int32 shipJumps = 0;
+    };
+
+    SystemActivity(db::SqliteSPtr dbconnection, std::shared_ptr<IOState> iostate);
+    ~SystemActivity();
+
+    SystemActivity(const SystemActivity &) = delete;
+    SystemActivity &operator=(const SystemActivity &) = delete;
+
+    // Zero for systems without any activity
+    [[nodiscard]] Activity get(int32 systemID) const;
+
+    // Ship and pod kills indexed like the graph, for KillsWeight
+    [[nodiscard]] std::vector<float> killsPerSystem(const UniverseGraph &graph) const;
+
+    // The hour the values belong to, empty if nothing was loaded yet
+    [[nodiscard]] const std::string &getKillsHour() const { return mKillsHour; }
+    [[nodiscard]] const std::string &getJumpsHour() const { return mJumpsHour; }
+
+private:
+    enum class Feed { Kills, Jumps };
+
+    void sync(Feed feed);
+    void schedule(Feed feed, std::chrono::steady_clock::duration delay);
+    void apply(Feed feed, const std::string &hour, const std::string &body);
+    void store(Feed feed, const std::string &hour);
+    void loadLatest();
+
+    uint32 row(int32 systemID);
+
+    // Columns, one row per system
+    std::vector<int32>                mSystemIDs;
+    std::vector<int32>                mShipKills;
+    std::vector<int32>                mNpcKills;
+    std::vector<int32>                mPodKills;
+    std::vector<int32>                mShipJumps;
+    std::unordered_map<int32, uint32> mRows;
+
+    std::string mKillsHour;
+    std::string mJumpsHour;
+
+    db::SqliteSPtr           mDbConnection;
+    std::shared_ptr<IOState> mIOState;
+    net::steady_timer        mKillsTimer;
+    net::steady_timer        mJumpsTimer;
+};
+}
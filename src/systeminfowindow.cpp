@@ -19,11 +19,8 @@
 #include "logging.h"
 
 #include <algorithm>
-#include <nlohmann/json.hpp>
 #include <utility>
 
-using json = nlohmann::json;
-
 namespace {
 std::string simplertimestring(const std::string &isotime)
 {
@@ -35,56 +32,222 @@ std::string simplertimestring(const std::string &isotime)
 }
 }
 
-eo::SystemInfoWindow::SystemInfoWindow(std::shared_ptr<EsiSession> session)
+eo::SystemInfoWindow::SystemInfoWindow(std::shared_ptr<EsiSession>     session,
+                                       std::shared_ptr<LocationPoller> poller,
+                                       std::shared_ptr<SystemActivity> activity,
+                                       std::shared_ptr<KillHistory>    history)
     : ImguiWindow(256, 256, "System Info Window", 0, 0)
-    , mEsiSession(std::move(std::move(session)))
+    , mEsiSession(std::move(session))
+    , mLocationPoller(std::move(poller))
+    , mSystemActivity(std::move(activity))
+    , mKillHistory(std::move(history))
+{
+    mLocationPoller->addListener(
+        [this](int32 characterID, const esi::CharacterLocation &location) {
+            if (characterID == mCharacterID) {
+                showSystem(location.solarSystemID);
+            }
+        },
+        mWindowToken);
+
+    if (const auto characters = mEsiSession->getCharacterIDs(); !characters.empty()) {
+        selectCharacter(characters.front());
+    }
+}
+
+eo::SystemInfoWindow::~SystemInfoWindow()
+{
+    // The scheduler destroys closed windows while the poller and the session keep running
+    mResolveToken.cancel();
+    mSystemToken.cancel();
+    mWindowToken.cancel();
+}
+
+void eo::SystemInfoWindow::selectCharacter(int32 characterID)
 {
-    cachedKillmails.reserve(20);
-    fetchNextSystem(true);
+    mCharacterID = characterID;
+
+    // The poller might already know where the character is
+    if (const auto location = mLocationPoller->getLocation(characterID)) {
+        showSystem(location->solarSystemID);
+    }
+}
+
+void eo::SystemInfoWindow::showSystem(int32 solarSystemID)
+{
+    // Only the latest jump counts, a slow resolve of an older one must not replace it
+    mResolveToken.cancel();
+    mResolveToken = CancellationToken::make();
+
+    mEsiSession->resolveSolarSystemAsync(
+        solarSystemID,
+        [this](auto &&location) {
+            if (location.systemID == currentSystem.systemID) {
+                return;
+            }
+
+            // Whatever is still running for the last system is not shown anymore
+            mSystemToken.cancel();
+            mSystemToken  = CancellationToken::make();
+            currentSystem = location;
+            mKillHistory->refresh(location.systemID, RequestPriority::High, mSystemToken);
+
+            const auto &iostate = mEsiSession->getIOState();
+            log::info("Cancelled {0} requests so far, about {1} KiB saved", iostate.getCancelledRequests(),
+                      iostate.getBytesSaved() / 1024);
+        },
+        RequestPriority::High, mResolveToken);
 }
 
-void eo::SystemInfoWindow::fetchNextSystem(bool now)
+void eo::SystemInfoWindow::renderCharacterSelection()
 {
-    if ((std::chrono::steady_clock::now() - lastCheck) > refresh_system || now) {
-        mEsiSession->getCharacterLocationAsync([this](auto &&location) {
-            mEsiSession->resolveSolarSystemAsync(location.solarSystemID, [this](auto &&location) {
-                if (location.systemID == currentSystem.systemID) {
-                    return;
+    const auto characters = mEsiSession->getCharacterIDs();
+    if (std::find(begin(characters), end(characters), mCharacterID) == end(characters)) {
+        if (characters.empty()) {
+            mCharacterID = 0;
+        } else {
+            selectCharacter(characters.front());
+        }
+    }
+
+    if (characters.size() > 1) {
+        const auto  selected = mEsiSession->getCharacter(mCharacterID);
+        const char *preview  = selected ? dynamicText(selected->characterName) : "";
+        if (ImGui::BeginCombo("Character", preview)) {
+            for (const auto characterID : characters) {
+                const auto character = mEsiSession->getCharacter(characterID);
+                if (ImGui::Selectable(dynamicText(character->characterName), characterID == mCharacterID)) {
+                    selectCharacter(characterID);
                 }
+            }
+            ImGui::EndCombo();
+        }
+    }
+
+    if (const auto state = mEsiSession->getLoginState(); state == EsiSession::LoginState::WaitingForLogin) {
+        ImGui::TextColored(ImVec4(1, 1, 0, 1), "Waiting for the login in your browser");
+    } else if (state == EsiSession::LoginState::LoginFailed) {
+        ImGui::TextColored(ImVec4(1, 0, 0, 1), "Login failed");
+    }
+
+    if (ImGui::Button(characters.empty() ? "Login" : "Add character")) {
+        mEsiSession->login();
+    }
+    ImGui::Separator();
+}
+
+void eo::SystemInfoWindow::renderRoute()
+{
+    if (ImGui::InputText("Destination", mDestinationInput.data(), mDestinationInput.size())) {
+        mDestinationID = mEsiSession->findSystemID(mDestinationInput.data());
+    }
+    ImGui::RadioButton("Shortest", &mRouteType, Shortest);
+    ImGui::SameLine();
+    ImGui::RadioButton("Safest", &mRouteType, Safest);
+    ImGui::SameLine();
+    ImGui::RadioButton("Least kills", &mRouteType, LeastKills);
+
+    if (mDestinationID == 0 || currentSystem.systemID == 0) {
+        ImGui::Text("Unknown destination");
+        return;
+    }
+
+    // Cheap enough to do every frame, so the route follows the character
+    const auto &       universe = mEsiSession->getUniverse();
+    std::vector<int32> route;
+    if (mRouteType == Safest) {
+        route = universe.route(currentSystem.systemID, mDestinationID, SafestWeight{ universe });
+    } else if (mRouteType == LeastKills) {
+        // Only changes with a new hour of the kills feed or when the graph got new systems
+        if (mKillsHour != mSystemActivity->getKillsHour() || mKillsPerSystem.size() != universe.systemCount()) {
+            mKillsPerSystem = mSystemActivity->killsPerSystem(universe);
+            mKillsHour      = mSystemActivity->getKillsHour();
+        }
+        route = universe.route(currentSystem.systemID, mDestinationID, KillsWeight{ mKillsPerSystem });
+    } else {
+        route = universe.shortestRoute(currentSystem.systemID, mDestinationID);
+    }
+    if (route.empty()) {
+        ImGui::Text("No route through the known stargates");
+        return;
+    }
 
-                currentSystem = location;
-                cachedKillmails.clear();
-                cachedKillmails.reserve(3);
-
-                mEsiSession->getKillsInSystemAsync(location.systemID, 20, [&](auto &&killmails) {
-                    for (auto &&km : killmails) {
-                        mEsiSession->resolveKillmailAsync(km.killmailID, km.killmailHash, [&, km](auto &&killmail) {
-                            const auto j = json::parse(killmail.victimJson);
-                            try {
-                                const int32 characterID = j.at("character_id");
-                                const int32 shipTypeID  = j.at("ship_type_id");
-                                mEsiSession->convertCharacterIDAsync(characterID, [&, shipTypeID, km, killmail](auto &&character) {
-                                    cachedKillmails.emplace_back(character, mEsiSession->getTypeName(shipTypeID), km.killmailID,
-                                                                 simplertimestring(killmail.killTime), killmail.killTime);
-                                    // TODO im too lazy to do this more efficient
-                                    std::sort(begin(cachedKillmails), end(cachedKillmails),
-                                              [](auto &&a, auto &&b) { return std::get<4>(a) > std::get<4>(b); });
-                                });
-                            } catch (const json::out_of_range &e) {
-                            }
-                        });
-                    }
-                });
-            });
-        });
-
-        lastCheck = std::chrono::steady_clock::now();
+    ImGui::Text("%zu jumps", route.size() - 1);
+    for (const auto systemID : route) {
+        const auto security = universe.securityStatus(universe.indexOf(systemID));
+        ImGui::TextColored(security >= 0.45f ? ImVec4(0.3, 1, 0.3, 1) : ImVec4(1, 0.3, 0.3, 1), "%.1f", security);
+        ImGui::SameLine();
+        ImGui::Text("%s", systemName(systemID).c_str());
     }
 }
 
+void eo::SystemInfoWindow::renderCacheStats()
+{
+    const auto report = mEsiSession->getCacheStats();
+    const auto row    = [](const char *name, const CacheStats &stats) {
+        ImGui::Text("%s", name);
+        ImGui::NextColumn();
+        ImGui::Text("%.1f%% hits", stats.hitRatio() * 100.);
+        ImGui::NextColumn();
+        ImGui::Text("%zu entries", stats.entries);
+        ImGui::NextColumn();
+        ImGui::Text("%zu KiB", stats.bytes / 1024);
+        ImGui::NextColumn();
+    };
+
+    ImGui::Columns(4);
+    row("Systems", report.systems);
+    row("Killmails", report.killmails);
+    row("Characters", report.characters);
+    row("Type names", report.typeNames);
+    row("Kill lists", report.killLists);
+    ImGui::Columns(1);
+}
+
+void eo::SystemInfoWindow::renderNearbySystems()
+{
+    ImGui::SliderFloat("Range (ly)", &mJumpRange, 1.f, 10.f, "%.1f");
+
+    if (currentSystem.systemID == 0) {
+        ImGui::Text("Unknown position");
+        return;
+    }
+
+    mNearbySystems.clear();
+    mEsiSession->getSpatialIndex().withinRadius(currentSystem.position, mJumpRange, mNearbySystems);
+    // The index might not contain the current system yet
+    mNearbySystems.erase(std::remove_if(begin(mNearbySystems), end(mNearbySystems),
+                                        [this](auto &&nearby) { return nearby.systemID == currentSystem.systemID; }),
+                         end(mNearbySystems));
+    std::sort(begin(mNearbySystems), end(mNearbySystems), [](auto &&a, auto &&b) { return a.distance < b.distance; });
+
+    ImGui::Text("%zu systems in range", mNearbySystems.size());
+    ImGui::Columns(3);
+    for (const auto &nearby : mNearbySystems) {
+        ImGui::Text("%s", systemName(nearby.systemID).c_str());
+        ImGui::NextColumn();
+        ImGui::Text("%.2f ly", nearby.distance);
+        ImGui::NextColumn();
+        const auto activity = mSystemActivity->get(nearby.systemID);
+        ImGui::Text("%d kills", activity.shipKills + activity.podKills);
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+}
+
+const std::string &eo::SystemInfoWindow::systemName(int32 systemID)
+{
+    auto &name = mSystemNames[systemID];
+    if (name.empty()) {
+        name = mEsiSession->getSystemName(systemID);
+    }
+    return name;
+}
+
 void eo::SystemInfoWindow::renderImguiContents()
 {
-    fetchNextSystem();
+    renderCharacterSelection();
+
     if (ImGui::CollapsingHeader(currentSystem.name.c_str(), ImGuiTreeNodeFlags_DefaultOpen)) {
         ImGui::Columns(2);
         ImGui::Text("Name");
@@ -101,27 +264,57 @@ void eo::SystemInfoWindow::renderImguiContents()
         ImGui::NextColumn();
         ImGui::TextColored(ImVec4(1, 0.3, 0.3, 1), "%.1f", currentSystem.securityStatus);
         ImGui::NextColumn();
+
+        ImGui::Text("Stargates / Planets / Stations");
+        ImGui::NextColumn();
+        ImGui::Text("%zu / %zu / %zu", currentSystem.stargates.size(), currentSystem.planets.size(), currentSystem.stations.size());
+        ImGui::NextColumn();
+
+        const auto activity = mSystemActivity->get(currentSystem.systemID);
+        ImGui::Text("Kills last hour");
+        ImGui::NextColumn();
+        ImGui::Text("%d ships, %d pods, %d npcs", activity.shipKills, activity.podKills, activity.npcKills);
+        ImGui::NextColumn();
+
+        ImGui::Text("Jumps last hour");
+        ImGui::NextColumn();
+        ImGui::Text("%d", activity.shipJumps);
+        ImGui::NextColumn();
         ImGui::Columns(1);
         ImGui::Separator();
 
         if (ImGui::CollapsingHeader("Last killmails")) {
             ImGui::Columns(4);
-            for (const auto &km : cachedKillmails) {
-                ImGui::Text("%s", std::get<0>(km).name.c_str());
+            // Cheap if the system was refreshed recently, keeps the list up to date while staying in a system
+            mKillHistory->refresh(currentSystem.systemID, RequestPriority::High, mSystemToken);
+            for (const auto &kill : mKillHistory->get(currentSystem.systemID)) {
+                ImGui::Text("%s", dynamicText(kill.victimName));
                 ImGui::NextColumn();
-                ImGui::Text("%s", std::get<1>(km).c_str());
+                ImGui::Text("%s", kill.shipName.c_str());
                 ImGui::NextColumn();
-                ImGui::PushID(std::get<2>(km));
+                ImGui::PushID(kill.killmailID);
                 if (ImGui::Button("Open")) {
-                    open_url_browser(fmt::format("https://zkillboard.com/kill/{0}/", std::get<2>(km)));
+                    open_url_browser(fmt::format("https://zkillboard.com/kill/{0}/", kill.killmailID));
                 }
                 ImGui::PopID();
                 ImGui::NextColumn();
 
-                ImGui::Text("%s", std::get<3>(km).c_str());
+                ImGui::Text("%s", simplertimestring(kill.killTime).c_str());
                 ImGui::NextColumn();
             }
             ImGui::Columns(1);
         }
+
+        if (ImGui::CollapsingHeader("Route")) {
+            renderRoute();
+        }
+
+        if (ImGui::CollapsingHeader("Nearby systems")) {
+            renderNearbySystems();
+        }
+
+        if (ImGui::CollapsingHeader("Caches")) {
+            renderCacheStats();
+        }
     }
 }
@@ -17,27 +17,61 @@
 #pragma once
 #include "esisession.h"
 #include "imguiwindow.h"
+#include "killhistory.h"
+#include "locationpoller.h"
+#include "systemactivity.h"
 
 #include <array>
 #include <chrono>
-#include <tuple>
+#include <unordered_map>
 
 namespace eo {
 class SystemInfoWindow : public ImguiWindow {
 public:
-    constexpr static auto refresh_system = std::chrono::seconds(10);
-    explicit SystemInfoWindow(std::shared_ptr<EsiSession> esisession);
+    explicit SystemInfoWindow(std::shared_ptr<EsiSession>     esisession,
+                              std::shared_ptr<LocationPoller> poller,
+                              std::shared_ptr<SystemActivity> activity,
+                              std::shared_ptr<KillHistory>    history);
+    ~SystemInfoWindow() override;
 
 protected:
     void renderImguiContents() override;
 
-    void fetchNextSystem(bool now = false);
+    void renderCharacterSelection();
+    void selectCharacter(int32 characterID);
+    void showSystem(int32 solarSystemID);
+    void renderRoute();
+    void renderNearbySystems();
+    void renderCacheStats();
+    const std::string &systemName(int32 systemID);
 
 private:
-    esi::SolarSystem                      currentSystem{};
-    std::shared_ptr<EsiSession>           mEsiSession{};
-    std::chrono::steady_clock::time_point lastCheck = std::chrono::steady_clock::now();
+    esi::SolarSystem                currentSystem{};
+    std::shared_ptr<EsiSession>     mEsiSession{};
+    std::shared_ptr<LocationPoller> mLocationPoller{};
+    std::shared_ptr<SystemActivity> mSystemActivity{};
+    std::shared_ptr<KillHistory>    mKillHistory{};
 
-    std::vector<std::tuple<esi::Character, std::string, int32, std::string, std::string>> cachedKillmails;
+    // The character whose location is shown, 0 if there is none
+    int32 mCharacterID = 0;
+    // Cancelled when another system is shown
+    CancellationToken mSystemToken;
+    // Cancelled by the next showSystem(), so only the latest system gets shown
+    CancellationToken mResolveToken;
+    // Cancelled when the window is destroyed, callbacks into the window are registered with it
+    CancellationToken mWindowToken = CancellationToken::make();
+
+    enum RouteType { Shortest, Safest, LeastKills };
+    std::array<char, 64>                   mDestinationInput{};
+    int32                                  mDestinationID = 0;
+    int                                    mRouteType     = Shortest;
+    std::unordered_map<int32, std::string> mSystemNames;
+
+    // Input of the least kills route and the hour of the kills feed it was built from
+    std::vector<float> mKillsPerSystem;
+    std::string        mKillsHour;
+
+    float                             mJumpRange = 5.f; // ly
+    std::vector<SpatialIndex::Result> mNearbySystems;
 };
 }
@@ -0,0 +1,158 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tokenmanager.h"
+#include "logging.h"
+
+eo::TokenManager::TokenManager(db::SqliteSPtr               dbconnection,
+                               std::shared_ptr<IOState>     iostate,
+                               std::shared_ptr<jwt::KeySet> keys,
+                               TokenData                    token)
+    : mToken(std::move(token))
+    , mDbConnection(std::move(dbconnection))
+    , mIOState(std::move(iostate))
+    , mKeys(std::move(keys))
+    , mTimer(*mIOState->getIoC())
+{
+    scheduleRefresh();
+}
+
+eo::TokenManager::~TokenManager() { mTimer.cancel(); }
+
+void eo::TokenManager::withToken(TokenCallback callback)
+{
+    if (!mRefreshing && !token_expired(mToken)) {
+        callback(mToken);
+        return;
+    }
+
+    mWaiting.push_back(std::move(callback));
+
+    if (!mRefreshing) {
+        refreshAsync();
+    }
+}
+
+void eo::TokenManager::setToken(TokenData token)
+{
+    ++mGeneration;
+    db::store_in_db(mDbConnection, token);
+    tokenRefreshed(std::move(token));
+}
+
+void eo::TokenManager::refreshAsync()
+{
+    if (mRefreshing) {
+        return;
+    }
+
+    mRefreshing = true;
+    mTimer.cancel();
+
+    log::info("Refreshing the access token of {0}", mToken.characterName);
+
+    const auto generation = ++mGeneration;
+    const auto current    = [this, generation, alive = std::weak_ptr<void>(mAlive)] {
+        return !alive.expired() && generation == mGeneration;
+    };
+
+    mIOState->makeAsyncHttpRequest(make_refresh_request(mToken), [this, current](auto &&response, auto &&) {
+        if (!current()) {
+            return;
+        }
+
+        TokenData   token = mToken;
+        std::string kid;
+        try {
+            apply_refresh_response(token, response);
+            kid = jwt::decode(token.accessToken).kid;
+        } catch (const std::exception &e) {
+            refreshFailed(e.what());
+            return;
+        }
+
+        // The new access token carries its expiry, only unknown signing keys require a request
+        mKeys->ensureKeyAsync(kid, *mIOState, [this, current, token = std::move(token)]() mutable {
+            if (current()) {
+                verifyRefreshed(std::move(token));
+            }
+        });
+    });
+}
+
+void eo::TokenManager::verifyRefreshed(TokenData token)
+{
+    try {
+        const auto verifyresult = verify_token(token.accessToken, *mKeys);
+        token.expiresOn         = verifyresult.expiresOn;
+        token.expiresAt         = parse_esi_time(token.expiresOn);
+    } catch (const std::exception &e) {
+        refreshFailed(e.what());
+        return;
+    }
+
+    db::store_in_db(mDbConnection, token);
+    tokenRefreshed(std::move(token));
+}
+
+void eo::TokenManager::scheduleRefresh()
+{
+    const auto now = std::chrono::system_clock::now();
+    const auto due = mToken.expiresAt - refresh_margin;
+
+    if (due <= now) {
+        refreshAsync();
+        return;
+    }
+
+    mTimer.expires_after(std::chrono::duration_cast<std::chrono::steady_clock::duration>(due - now));
+    mTimer.async_wait([this](const boost::system::error_code &ec) {
+        if (ec) {
+            return; // Cancelled
+        }
+        refreshAsync();
+    });
+}
+
+void eo::TokenManager::refreshFailed(const std::string &reason)
+{
+    log::error("Could not refresh the access token: {0}", reason);
+    log::info("Retrying in {0} seconds", retry_delay.count());
+
+    // Waiting requests stay queued until a refresh succeeded
+    mTimer.expires_after(retry_delay);
+    mTimer.async_wait([this](const boost::system::error_code &ec) {
+        if (ec) {
+            return;
+        }
+        mRefreshing = false;
+        refreshAsync();
+    });
+}
+
+void eo::TokenManager::tokenRefreshed(TokenData token)
+{
+    mToken      = std::move(token);
+    mRefreshing = false;
+    scheduleRefresh();
+
+    // A callback might queue new work, so swap before flushing
+    std::vector<TokenCallback> waiting;
+    waiting.swap(mWaiting);
+    for (auto &callback : waiting) {
+        callback(mToken);
+    }
+}
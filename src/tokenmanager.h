@@ -0,0 +1,86 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "authentication.h"
+#include "db.h"
+#include "jwt.h"
+#include "requests.h"
+
+#include <functional>
+#include <vector>
+
+#include <boost/asio/steady_timer.hpp>
+
+namespace eo {
+
+/*
+ * Keeps the access token of one character valid:
+ *  - Refreshes the token on the IOState some time before it expires
+ *  - Requests made while a refresh is running wait for the new token
+ *  - A refresh which finishes after setToken() or the destruction is dropped
+ */
+class TokenManager {
+public:
+    using TokenCallback = std::function<void(const TokenData &)>;
+
+    constexpr static auto refresh_margin = std::chrono::minutes(2);
+    constexpr static auto retry_delay    = std::chrono::seconds(15);
+
+    explicit TokenManager(db::SqliteSPtr               dbconnection,
+                          std::shared_ptr<IOState>     iostate,
+                          std::shared_ptr<jwt::KeySet> keys,
+                          TokenData                    token);
+    ~TokenManager();
+
+    TokenManager(const TokenManager &) = delete;
+    TokenManager &operator=(const TokenManager &) = delete;
+
+    // Calls the callback with a token which is not expired.
+    // If the token is expired or a refresh is running the callback gets queued
+    void withToken(TokenCallback callback);
+
+    // Replaces the token e.g. after a new authentication and stores it in the db
+    void setToken(TokenData token);
+
+    void refreshAsync();
+
+    [[nodiscard]] const TokenData &getToken() const { return mToken; }
+    [[nodiscard]] bool             isRefreshing() const { return mRefreshing; }
+
+private:
+    void scheduleRefresh();
+    void refreshFailed(const std::string &reason);
+    void tokenRefreshed(TokenData token);
+    void verifyRefreshed(TokenData token);
+
+    // Invariant: Valid token which might be expired
+    TokenData mToken;
+    bool      mRefreshing = false;
+    // Bumped by every refresh and setToken(), results of an older refresh are stale
+    unsigned mGeneration = 0;
+
+    std::vector<TokenCallback> mWaiting;
+
+    db::SqliteSPtr               mDbConnection;
+    std::shared_ptr<IOState>     mIOState;
+    std::shared_ptr<jwt::KeySet> mKeys;
+    net::steady_timer            mTimer;
+
+    // Last member, gone before anything the callbacks touch
+    std::shared_ptr<void> mAlive = std::make_shared<char>();
+};
+}
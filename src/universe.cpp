@@ -0,0 +1,163 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "universe.h"
+#include "logging.h"
+
+#include <algorithm>
+#include <sqlite3.h>
+
+eo::UniverseGraph::UniverseGraph(std::vector<System> systems, const std::vector<std::pair<int32, int32>> &connections)
+    : mSystems(std::move(systems))
+{
+    // Sorted by id so neighbouring ids are close in memory
+    std::sort(begin(mSystems), end(mSystems), [](auto &&a, auto &&b) { return a.systemID < b.systemID; });
+    mSystems.erase(std::unique(begin(mSystems), end(mSystems), [](auto &&a, auto &&b) { return a.systemID == b.systemID; }),
+                   end(mSystems));
+
+    mIndices.reserve(mSystems.size());
+    for (uint32 i = 0; i < mSystems.size(); i++) {
+        mIndices.emplace(mSystems[i].systemID, i);
+    }
+
+    std::vector<std::pair<uint32, uint32>> edges;
+    edges.reserve(connections.size() * 2);
+    for (const auto &[from, to] : connections) {
+        const auto a = indexOf(from);
+        const auto b = indexOf(to);
+        if (a == invalid_index || b == invalid_index || a == b) {
+            continue;
+        }
+        edges.emplace_back(a, b);
+        edges.emplace_back(b, a);
+    }
+    std::sort(begin(edges), end(edges));
+    edges.erase(std::unique(begin(edges), end(edges)), end(edges));
+
+    mOffsets.assign(mSystems.size() + 1, 0);
+    mNeighbours.reserve(edges.size());
+    for (const auto &[from, to] : edges) {
+        mOffsets[from + 1]++;
+        mNeighbours.push_back(to);
+    }
+    for (std::size_t i = 1; i < mOffsets.size(); i++) {
+        mOffsets[i] += mOffsets[i - 1];
+    }
+}
+
+bool eo::UniverseGraph::connect(int32 from, int32 to)
+{
+    const auto a = indexOf(from);
+    const auto b = indexOf(to);
+    if (a == invalid_index || b == invalid_index) {
+        return false;
+    }
+    if (a != b) {
+        addNeighbour(a, b);
+        addNeighbour(b, a);
+    }
+    return true;
+}
+
+void eo::UniverseGraph::addNeighbour(uint32 from, uint32 to)
+{
+    // Neighbours stay sorted like after construction, so duplicates are found with a binary search
+    const auto first = begin(mNeighbours) + mOffsets[from];
+    const auto last  = begin(mNeighbours) + mOffsets[from + 1];
+    const auto it    = std::lower_bound(first, last, to);
+    if (it != last && *it == to) {
+        return;
+    }
+
+    mNeighbours.insert(it, to);
+    for (auto i = from + 1; i < mOffsets.size(); i++) {
+        mOffsets[i]++;
+    }
+}
+
+eo::uint32 eo::UniverseGraph::indexOf(int32 systemID) const
+{
+    const auto it = mIndices.find(systemID);
+    return it != end(mIndices) ? it->second : invalid_index;
+}
+
+std::vector<eo::int32> eo::UniverseGraph::shortestRoute(int32 from, int32 to) const
+{
+    const auto start = indexOf(from);
+    const auto goal  = indexOf(to);
+    if (start == invalid_index || goal == invalid_index) {
+        return {};
+    }
+
+    // Every jump costs the same, so a breadth first search is enough
+    mPrevious.assign(mSystems.size(), invalid_index);
+    mPrevious[start] = start;
+
+    std::vector<uint32> frontier{ start };
+    std::vector<uint32> next;
+    while (!frontier.empty() && mPrevious[goal] == invalid_index) {
+        next.clear();
+        for (const auto current : frontier) {
+            const auto [first, last] = neighbours(current);
+            for (auto it = first; it != last; ++it) {
+                if (mPrevious[*it] == invalid_index) {
+                    mPrevious[*it] = current;
+                    next.push_back(*it);
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+
+    mPrevious[start] = invalid_index;
+    return buildRoute(start, goal);
+}
+
+std::vector<eo::int32> eo::UniverseGraph::buildRoute(uint32 from, uint32 to) const
+{
+    if (from != to && mPrevious[to] == invalid_index) {
+        return {}; // Not reachable
+    }
+
+    std::vector<int32> route;
+    for (auto current = to; current != invalid_index; current = mPrevious[current]) {
+        route.push_back(mSystems[current].systemID);
+        if (current == from) {
+            break;
+        }
+    }
+    std::reverse(begin(route), end(route));
+    return route;
+}
+
+eo::UniverseGraph eo::load_universe_graph(db::SqliteSPtr dbconnection)
+{
+    std::vector<UniverseGraph::System> systems;
+    auto                               stmt = db::make_statement(dbconnection, "SELECT id, secstatus FROM solarsystem;");
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        systems.push_back({ sqlite3_column_int(stmt.get(), 0), static_cast<float>(sqlite3_column_double(stmt.get(), 1)) });
+    }
+
+    std::vector<std::pair<int32, int32>> connections;
+    stmt = db::make_statement(dbconnection, "SELECT systemid, destinationsystemid FROM stargate;");
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+        connections.emplace_back(sqlite3_column_int(stmt.get(), 0), sqlite3_column_int(stmt.get(), 1));
+    }
+
+    UniverseGraph graph(std::move(systems), connections);
+    log::info("Loaded the universe graph with {0} systems and {1} connections", graph.systemCount(), graph.connectionCount());
+    return graph;
+}
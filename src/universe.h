@@ -0,0 +1,166 @@
+// Copyright 2019 Maximilian Schiller
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "db.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace eo {
+
+/*
+ * The stargate network as a compact graph (CSR adjacency arrays).
+ * Systems are addressed by a dense index, use indexOf() to map an esi id.
+ * Routing reuses internal buffers, so queries are cheap enough to run every frame,
+ * but a graph must only be used from one thread.
+ */
+class UniverseGraph {
+public:
+    constexpr static uint32 invalid_index = ~uint32(0);
+
+    struct System {
+        int32 systemID;
+        float securityStatus;
+    };
+
+    UniverseGraph() = default;
+    // Connections are bidirectional and may contain duplicates or unknown systems
+    UniverseGraph(std::vector<System> systems, const std::vector<std::pair<int32, int32>> &connections);
+
+    // Adds a bidirectional connection in place. Returns false if one of the systems is unknown
+    bool connect(int32 from, int32 to);
+
+    [[nodiscard]] uint32 indexOf(int32 systemID) const;
+    [[nodiscard]] int32  systemID(uint32 index) const { return mSystems[index].systemID; }
+    [[nodiscard]] float  securityStatus(uint32 index) const { return mSystems[index].securityStatus; }
+    [[nodiscard]] bool   isHighsec(uint32 index) const { return mSystems[index].securityStatus >= 0.45f; }
+
+    [[nodiscard]] std::size_t systemCount() const { return mSystems.size(); }
+    [[nodiscard]] std::size_t connectionCount() const { return mNeighbours.size(); }
+
+    // The systems reachable with one jump from the system with the given index
+    [[nodiscard]] std::pair<const uint32 *, const uint32 *> neighbours(uint32 index) const
+    {
+        return { mNeighbours.data() + mOffsets[index], mNeighbours.data() + mOffsets[index + 1] };
+    }
+
+    // Fewest jumps. Returns the system ids from start to destination, empty if there is no route
+    std::vector<int32> shortestRoute(int32 from, int32 to) const;
+
+    /*
+     * Cheapest route where weight(index) returns the cost (> 0) of jumping into the system
+     * with the given index. See the weights below.
+     */
+    template<typename Weight>
+    std::vector<int32> route(int32 from, int32 to, Weight &&weight) const;
+
+private:
+    std::vector<int32> buildRoute(uint32 from, uint32 to) const;
+    void               addNeighbour(uint32 from, uint32 to);
+
+    std::vector<System>               mSystems;
+    std::vector<uint32>               mOffsets;
+    std::vector<uint32>               mNeighbours;
+    std::unordered_map<int32, uint32> mIndices;
+
+    // Scratch buffers of the last query
+    mutable std::vector<float>  mCost;
+    mutable std::vector<uint32> mPrevious;
+    mutable std::vector<uint64> mOpen;
+};
+
+// Like the ingame "safer" setting: Leaving highsec is very expensive
+struct SafestWeight {
+    const UniverseGraph &graph;
+    float                unsafePenalty = 50.f;
+
+    float operator()(uint32 index) const { return graph.isHighsec(index) ? 1.f : unsafePenalty; }
+};
+
+// Avoids systems with recent kills, killsPerSystem is indexed like the graph
+struct KillsWeight {
+    const std::vector<float> &killsPerSystem;
+    float                     killPenalty = 1.f;
+
+    float operator()(uint32 index) const { return 1.f + killPenalty * killsPerSystem[index]; }
+};
+
+// Builds the graph from the cached systems and stargates
+UniverseGraph load_universe_graph(db::SqliteSPtr dbconnection);
+
+template<typename Weight>
+std::vector<int32> UniverseGraph::route(int32 from, int32 to, Weight &&weight) const
+{
+    const auto start = indexOf(from);
+    const auto goal  = indexOf(to);
+    if (start == invalid_index || goal == invalid_index) {
+        return {};
+    }
+
+    // Min heap on a reused buffer, a std::priority_queue would allocate on every query.
+    // Positive floats compare like their bit pattern, so cost and index are packed into one integer
+    const auto pack = [](float cost, uint32 index) {
+        uint32 bits;
+        std::memcpy(&bits, &cost, sizeof(bits));
+        return (uint64(bits) << 32) | index;
+    };
+
+    auto &open = mOpen;
+    open.clear();
+
+    mCost.assign(mSystems.size(), std::numeric_limits<float>::infinity());
+    mPrevious.assign(mSystems.size(), invalid_index);
+    mCost[start] = 0.f;
+    open.push_back(pack(0.f, start));
+
+    while (!open.empty()) {
+        std::pop_heap(begin(open), end(open), std::greater<>{});
+        const auto current = static_cast<uint32>(open.back());
+        const auto packed  = static_cast<uint32>(open.back() >> 32);
+        open.pop_back();
+
+        float cost;
+        std::memcpy(&cost, &packed, sizeof(cost));
+
+        if (current == goal) {
+            break;
+        }
+        if (cost > mCost[current]) {
+            continue; // Outdated entry
+        }
+
+        const auto [first, last] = neighbours(current);
+        for (auto it = first; it != last; ++it) {
+            const float next = cost + weight(*it);
+            if (next < mCost[*it]) {
+                mCost[*it]     = next;
+                mPrevious[*it] = current;
+                open.push_back(pack(next, *it));
+                std::push_heap(begin(open), end(open), std::greater<>{});
+            }
+        }
+    }
+
+    return buildRoute(start, goal);
+}
+}
@@ -17,8 +17,11 @@
 #include "util.h"
 #include <array>
 #include <cstring>
+#include <ctime>
 
 #ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #endif
@@ -49,3 +52,139 @@ std::string eo::get_exe_dir()
     static_assert(false, "This OS is currently no supported");
 #endif
 }
+
+eo::MappedFile::MappedFile(const std::string &path)
+{
+#ifdef __linux__
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st {
+    };
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            mMapping = mapping;
+            mSize    = st.st_size;
+        }
+    }
+    ::close(fd); // The mapping stays valid
+#else
+    static_assert(false, "This OS is currently no supported");
+#endif
+}
+
+eo::MappedFile::~MappedFile()
+{
+    if (mMapping) {
+        munmap(mMapping, mSize);
+    }
+}
+
+namespace {
+// Stripes of 64 bytes accumulate into eight lanes, like XXH3 does it
+constexpr std::size_t                        hash_lanes  = 8;
+constexpr std::size_t                        hash_stripe = hash_lanes * sizeof(eo::uint64);
+constexpr std::size_t                        hash_block  = 16; // Stripes between two scrambles
+constexpr eo::uint64                         hash_prime  = 0x9E3779B185EBCA87ull;
+constexpr std::array<eo::uint64, hash_lanes> hash_keys   = { 0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull,
+                                                             0x1f67b3b7a4a44072ull, 0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull,
+                                                             0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull };
+
+using HashLanes = std::array<eo::uint64, hash_lanes>;
+
+// Only 32 by 32 bit multiplies, the lanes vectorize even with plain SSE2
+void hash_accumulate(HashLanes &acc, const eo::byte *stripe, eo::uint64 key)
+{
+    for (std::size_t lane = 0; lane < hash_lanes; ++lane) {
+        eo::uint64 word;
+        std::memcpy(&word, stripe + lane * sizeof(word), sizeof(word));
+        const auto mixed = word ^ (hash_keys[lane] + key);
+        acc[lane] += (mixed & 0xffffffffu) * (mixed >> 32);
+        acc[lane ^ 1] += word;
+    }
+}
+
+void hash_scramble(HashLanes &acc)
+{
+    for (auto &lane : acc) {
+        lane ^= lane >> 47;
+        lane *= hash_prime;
+    }
+}
+
+eo::uint64 hash_avalanche(eo::uint64 hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xC2B2AE3D27D4EB4Full;
+    hash ^= hash >> 29;
+    hash *= 0x165667B19E3779F9ull;
+    return hash ^ (hash >> 32);
+}
+}
+
+eo::uint64 eo::fast_hash(const void *data, std::size_t size, uint64 seed)
+{
+    const auto *bytes = static_cast<const byte *>(data);
+
+    HashLanes acc;
+    acc.fill(seed);
+
+    // Every stripe gets its own key, reordered stripes do not hash the same
+    std::size_t stripe = 0;
+    for (; (stripe + 1) * hash_stripe <= size; ++stripe) {
+        hash_accumulate(acc, bytes + stripe * hash_stripe, stripe * hash_prime);
+        if (stripe % hash_block == hash_block - 1) {
+            hash_scramble(acc);
+        }
+    }
+
+    // Empty buffers may come without data (e.g. an empty ImVector), memcpy must not see a null pointer
+    std::array<byte, hash_stripe> tail{};
+    if (const auto remaining = size - stripe * hash_stripe; remaining > 0) {
+        std::memcpy(tail.data(), bytes + stripe * hash_stripe, remaining);
+    }
+    hash_accumulate(acc, tail.data(), stripe * hash_prime);
+    hash_scramble(acc);
+
+    auto hash = seed ^ (size * hash_prime);
+    for (const auto lane : acc) {
+        hash = hash_avalanche(hash ^ lane) * hash_prime;
+    }
+    return hash_avalanche(hash);
+}
+
+std::chrono::system_clock::time_point eo::parse_esi_time(const std::string &isotime)
+{
+    tm tm{};
+    if (!strptime(isotime.c_str(), "%Y-%m-%dT%H:%M:%S", &tm)) {
+        return {};
+    }
+#ifdef __linux__
+    return std::chrono::system_clock::from_time_t(timegm(&tm));
+#else
+    static_assert(false, "This OS is currently no supported");
+#endif
+}
+
+std::chrono::system_clock::time_point eo::parse_http_date(const std::string &httpdate)
+{
+    tm tm{};
+    if (!strptime(httpdate.c_str(), "%a, %d %b %Y %H:%M:%S", &tm)) {
+        return {};
+    }
+    return std::chrono::system_clock::from_time_t(timegm(&tm));
+}
+
+std::string eo::format_esi_time(std::chrono::system_clock::time_point time)
+{
+    const auto t = std::chrono::system_clock::to_time_t(time);
+    tm         tm{};
+    gmtime_r(&t, &tm);
+
+    std::array<char, 32> output = { 0 };
+    const auto           length = std::strftime(output.data(), output.size(), "%FT%T", &tm);
+    return std::string(output.data(), length);
+}
@@ -15,6 +15,7 @@
  */
 
 #pragma once
+#include <chrono>
 #include <cstdint>
 #include <string>
 #include <string_view>
@@ -25,6 +26,7 @@ namespace eo {
 using int32  = std::int32_t;
 using uint   = unsigned int;
 using uint32 = std::uint32_t;
+using uint64 = std::uint64_t;
 using int8   = std::int8_t;
 using uint8  = std::uint8_t;
 using byte   = uint8;
@@ -32,10 +34,37 @@ using byte   = uint8;
 std::string get_cwd();
 std::string get_exe_dir();
 
+// Parses an ESI/ISO 8601 timestamp like "2019-10-12T13:37:00Z" as UTC
+std::chrono::system_clock::time_point parse_esi_time(const std::string &isotime);
+std::string                           format_esi_time(std::chrono::system_clock::time_point time);
+// Parses a http date like "Sat, 12 Oct 2019 13:37:00 GMT" as used by the Date and Expires headers
+std::chrono::system_clock::time_point parse_http_date(const std::string &httpdate);
+
 constexpr const char *data_folder        = "data/";
 constexpr const char *settings_file      = "settings.json";
 inline const auto     settings_file_path = get_exe_dir() + data_folder + settings_file;
 
+// A file mapped read only into memory, empty if it could not be mapped
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    [[nodiscard]] const byte *data() const { return static_cast<const byte *>(mMapping); }
+    [[nodiscard]] std::size_t size() const { return mSize; }
+    explicit                  operator bool() const { return mMapping != nullptr; }
+
+private:
+    void *      mMapping = nullptr;
+    std::size_t mSize    = 0;
+};
+
+// Tells buffers apart quickly, e.g. whether a frame changed. The values depend on the byte order, do not store them
+uint64 fast_hash(const void *data, std::size_t size, uint64 seed = 0);
+
 template<typename F>
 struct scope_exit {
     scope_exit(F f)
@@ -0,0 +1,153 @@
+# Converts the universe tables of the sde (csv dumps as provided by fuzzwork)
+# into assets/universe.bin which is loaded by StaticUniverse (src/staticuniverse.h).
+#
+# Required files in the working directory:
+# mapRegions.csv, mapConstellations.csv, mapSolarSystems.csv, mapDenormalize.csv, mapJumps.csv
+#
+# usage: universeconverter.py [--fetch] [output]
+# --fetch downloads missing tables from fuzzwork first, the universe-asset target runs it like that.
+# output defaults to assets/universe.bin
+import bz2
+import csv
+import os
+import struct
+import sys
+import urllib.request
+
+VERSION = 1
+
+SDE_URL = 'https://www.fuzzwork.co.uk/dump/latest/'
+TABLES = ['mapRegions.csv', 'mapConstellations.csv', 'mapSolarSystems.csv', 'mapDenormalize.csv', 'mapJumps.csv']
+TIMEOUT = 60  # seconds without progress before a download fails
+
+
+def fetch_tables():
+    for table in TABLES:
+        try:
+            open(table).close()
+            continue
+        except FileNotFoundError:
+            pass
+        print('Downloading ' + SDE_URL + table + '.bz2')
+        with urllib.request.urlopen(SDE_URL + table + '.bz2', timeout=TIMEOUT) as response:
+            data = bz2.decompress(response.read())
+        # Renamed when complete, an interrupted download must not leave a table that later runs trust
+        with open(table + '.part', 'wb') as csvfile:
+            csvfile.write(data)
+        os.replace(table + '.part', table)
+
+
+arguments = [a for a in sys.argv[1:] if a != '--fetch']
+output_path = arguments[0] if arguments else 'assets/universe.bin'
+if '--fetch' in sys.argv:
+    try:
+        fetch_tables()
+    except OSError as e:
+        sys.exit('Could not download the sde tables: %s' % e)
+
+GROUP_STAR = 6
+GROUP_PLANET = 7
+GROUP_STARGATE = 10
+GROUP_STATION = 15
+
+
+def read_csv(filename):
+    with open(filename, newline='') as csvfile:
+        dialect = csv.Sniffer().sniff(csvfile.read(10000))
+        csvfile.seek(0)
+        return list(csv.DictReader(csvfile, dialect=dialect))
+
+
+def as_int(value):
+    return int(float(value)) if value not in ('', 'None') else 0
+
+
+strings = bytearray()
+string_offsets = dict()
+
+
+def add_string(s):
+    if s not in string_offsets:
+        string_offsets[s] = len(strings)
+        strings.extend(s.encode('utf-8') + b'\0')
+    return string_offsets[s]
+
+
+regions = sorted(read_csv('mapRegions.csv'), key=lambda r: as_int(r['regionID']))
+constellations = sorted(read_csv('mapConstellations.csv'), key=lambda c: as_int(c['constellationID']))
+systems = sorted(read_csv('mapSolarSystems.csv'), key=lambda s: as_int(s['solarSystemID']))
+
+stars = dict()
+planets = dict()
+stations = dict()
+stargates = dict()  # system id -> list of stargate ids
+stargate_system = dict()
+for item in read_csv('mapDenormalize.csv'):
+    group = as_int(item['groupID'])
+    system = as_int(item['solarSystemID'])
+    itemid = as_int(item['itemID'])
+    if group == GROUP_STAR:
+        stars[system] = itemid
+    elif group == GROUP_PLANET:
+        planets.setdefault(system, []).append(itemid)
+    elif group == GROUP_STATION:
+        stations.setdefault(system, []).append(itemid)
+    elif group == GROUP_STARGATE:
+        stargates.setdefault(system, []).append(itemid)
+        stargate_system[itemid] = system
+
+destinations = {as_int(j['stargateID']): as_int(j['destinationID']) for j in read_csv('mapJumps.csv')}
+
+system_records = bytearray()
+stargate_records = bytearray()
+ids = list()
+stargate_count = 0
+for s in systems:
+    systemid = as_int(s['solarSystemID'])
+
+    gates = sorted(g for g in stargates.get(systemid, []) if g in destinations)
+    first_stargate = stargate_count
+    for gate in gates:
+        destination = destinations[gate]
+        stargate_records += struct.pack('<iiii', gate, systemid, stargate_system.get(destination, 0), destination)
+    stargate_count += len(gates)
+
+    system_planets = sorted(planets.get(systemid, []))
+    first_planet = len(ids)
+    ids.extend(system_planets)
+    system_stations = sorted(stations.get(systemid, []))
+    first_station = len(ids)
+    ids.extend(system_stations)
+
+    system_records += struct.pack('<dddiiifIIIIIIII',
+                                  float(s['x']), float(s['y']), float(s['z']),
+                                  systemid, as_int(s['constellationID']), stars.get(systemid, 0), float(s['security']),
+                                  add_string(s['solarSystemName']), add_string(s['securityClass']),
+                                  first_stargate, len(gates),
+                                  first_planet, len(system_planets),
+                                  first_station, len(system_stations))
+
+constellation_records = bytearray()
+for c in constellations:
+    constellation_records += struct.pack('<iiI', as_int(c['constellationID']), as_int(c['regionID']),
+                                         add_string(c['constellationName']))
+
+region_records = bytearray()
+for r in regions:
+    region_records += struct.pack('<iI', as_int(r['regionID']), add_string(r['regionName']))
+
+header = struct.pack('<4sIIIIIII', b'EOUV', VERSION, len(regions), len(constellations), len(systems), stargate_count,
+                     len(ids), len(strings))
+
+with open(output_path + '.part', 'wb') as output:
+    output.write(header)
+    output.write(system_records)
+    output.write(stargate_records)
+    output.write(constellation_records)
+    output.write(region_records)
+    output.write(struct.pack('<%di' % len(ids), *ids))
+    output.write(strings)
+os.replace(output_path + '.part', output_path)
+
+print('Wrote %d systems, %d stargates, %d constellations and %d regions' % (len(systems), stargate_count,
+                                                                           len(constellations), len(regions)))